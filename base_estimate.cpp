@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+#include <transport_catalogue.pb.h>
+
+#include "base_estimate.h"
+#include "json.h"
+
+namespace transcat {
+
+    namespace {
+
+        using RouteInternalData = graph::Router<double>::RouteInternalData;
+
+        // Байт в варинте protobuf
+        size_t VarintSize(size_t value) {
+            size_t size = 1;
+            for (; value >= 0x80; value >>= 7) {
+                ++size;
+            }
+            return size;
+        }
+
+        // Справочник: остановки и автобусы с индексами по названию, маршруты с префиксными суммами
+        // и индексом автобусов остановок, пул названий. Заданные расстояния не учитываются
+        size_t EstimateCatalogueMemory(const TransportCatalogue &db) {
+            constexpr size_t map_node_overhead = 32;
+            size_t route_size = 0;
+            for (const Bus *p_bus: db.GetAllBuses()) {
+                route_size += p_bus->route.size();
+            }
+            const size_t stop_memory = sizeof(Stop) + map_node_overhead + sizeof(std::pair<std::string_view, StopPtr>);
+            const size_t bus_memory = sizeof(Bus) + map_node_overhead + sizeof(std::pair<std::string_view, const Bus *>);
+            return db.GetAllStops().size() * stop_memory + db.GetAllBuses().size() * bus_memory
+                   + route_size * (sizeof(StopPtr) + sizeof(distance_t) + sizeof(const Bus *))
+                   + db.GetNames().GetSize();
+        }
+
+        // Справочник в файле: названия, координаты и маршруты (номера остановок)
+        size_t EstimateCatalogueFileSize(const TransportCatalogue &db) {
+            const size_t stop_count = db.GetAllStops().size();
+            size_t size = db.GetNames().GetSize() + stop_count * (2 + 2 * 9 + 3 * VarintSize(stop_count));
+            for (const Bus *p_bus: db.GetAllBuses()) {
+                size += 16 + p_bus->route.size() * VarintSize(stop_count);
+            }
+            return size;
+        }
+
+        // Граф: ребра, списки смежности и автобусы ребер
+        size_t EstimateGraphMemory(const GraphSize &graph) {
+            return graph.vertex_count * sizeof(std::vector<graph::EdgeId>)
+                   + graph.edge_count * (sizeof(graph::Edge<double>) + sizeof(graph::EdgeId) + sizeof(const Bus *));
+        }
+
+        // Ребро в файле: from, to, weight и span_count с тегами и длиной сообщения
+        size_t EstimateGraphFileSize(const GraphSize &graph) {
+            return graph.edge_count * (2 + 4 + 2 * VarintSize(graph.vertex_count) + 8 + 1);
+        }
+
+    } // namespace
+
+    const EngineEstimate &BaseEstimate::For(RoutingEngine engine) const noexcept {
+        switch (engine) {
+            case RoutingEngine::AllPairs:
+                return all_pairs;
+            case RoutingEngine::OutOfCore:
+                return out_of_core;
+            default:
+                return on_demand;
+        }
+    }
+
+    BaseEstimate EstimateBase(const TransportCatalogue &db, const RoutingSettings &settings) {
+        BaseEstimate estimate;
+        estimate.graph = RequestHandler::EvaluateGraphSize(db, settings);
+        estimate.catalogue_memory = EstimateCatalogueMemory(db);
+
+        const size_t vertex_count = estimate.graph.vertex_count;
+        const size_t edge_count = estimate.graph.edge_count;
+        const size_t graph_memory = EstimateGraphMemory(estimate.graph);
+        const size_t base_file_size = EstimateCatalogueFileSize(db) + EstimateGraphFileSize(estimate.graph);
+        // при сериализации граф еще раз лежит в памяти - сообщениями protobuf
+        const size_t proto_graph_memory = edge_count * (sizeof(pb3::Edge) + sizeof(void *));
+
+        // по запросу: обратные списки ребер двунаправленного поиска
+        estimate.on_demand.file_size = base_file_size;
+        estimate.on_demand.peak_memory = estimate.catalogue_memory + graph_memory + proto_graph_memory
+                                         + (vertex_count + 1) * sizeof(size_t) + edge_count * sizeof(graph::EdgeId);
+
+        // таблица всех пар: V^2 записей в памяти, при сериализации - еще V^2 кодов строк
+        // (разность кодов соседних записей - до 4E по модулю, вес почти всегда выводится из предыдущего)
+        const size_t table_entries = vertex_count * vertex_count;
+        const size_t table_memory = vertex_count * sizeof(std::vector<std::optional<RouteInternalData>>)
+                                    + table_entries * sizeof(std::optional<RouteInternalData>);
+        const size_t proto_table_memory = vertex_count * sizeof(pb3::CompactRoutesRow)
+                                          + table_entries * sizeof(google::protobuf::int32);
+        estimate.all_pairs.file_size = base_file_size
+                                       + vertex_count * (4 + 8) + table_entries * VarintSize(4 * edge_count);
+        estimate.all_pairs.peak_memory = estimate.catalogue_memory + graph_memory + proto_graph_memory
+                                         + table_memory + proto_table_memory;
+
+        // таблица, записанная потоком: тот же файл, а в памяти - только пачка строк на поток
+        // (строка поиска Дейкстры и ее закодированная копия)
+        const size_t batch_rows = std::max(1u, std::thread::hardware_concurrency()) * 16;
+        estimate.out_of_core.file_size = estimate.all_pairs.file_size + (vertex_count + 1) * sizeof(uint64_t) + 12;
+        estimate.out_of_core.peak_memory = estimate.on_demand.peak_memory
+                                           + std::min(batch_rows, vertex_count) * vertex_count
+                                             * (sizeof(std::optional<RouteInternalData>) + VarintSize(4 * edge_count));
+        return estimate;
+    }
+
+    std::optional<RoutingEngine> ChooseEngine(const BaseEstimate &estimate, RoutingEngine engine,
+                                              size_t memory_budget) {
+        for (const auto candidate: {RoutingEngine::AllPairs, RoutingEngine::OutOfCore, RoutingEngine::OnDemand}) {
+            if (candidate >= engine && estimate.For(candidate).peak_memory <= memory_budget) {
+                return candidate;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void WriteEstimate(std::ostream &out, const BaseEstimate &estimate) {
+        using namespace std::string_literals;
+        auto count_to_json = [](size_t value) -> json::Node {
+            if (value <= static_cast<size_t>(std::numeric_limits<int>::max())) {
+                return static_cast<int>(value);
+            }
+            return static_cast<double>(value);
+        };
+        auto to_megabytes = [](size_t bytes) {
+            return static_cast<double>(bytes) / (1024 * 1024);
+        };
+        auto engine_to_json = [&to_megabytes](const EngineEstimate &engine) {
+            return json::Dict{
+                    {"peak_memory_mb"s, to_megabytes(engine.peak_memory)},
+                    {"file_size_mb"s, to_megabytes(engine.file_size)}
+            };
+        };
+        json::Print(json::Document{json::Dict{
+                {"vertex_count"s, count_to_json(estimate.graph.vertex_count)},
+                {"edge_count"s, count_to_json(estimate.graph.edge_count)},
+                {"catalogue_memory_mb"s, to_megabytes(estimate.catalogue_memory)},
+                {"all_pairs"s, engine_to_json(estimate.all_pairs)},
+                {"out_of_core"s, engine_to_json(estimate.out_of_core)},
+                {"on_demand"s, engine_to_json(estimate.on_demand)}
+        }}, out);
+        out << std::endl;
+    }
+
+} // namespace transcat
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <iostream>
+#include <optional>
+
+#include "domain.h"
+#include "request_handler.h"
+#include "transport_catalogue.h"
+
+namespace transcat {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Base Estimate
+    //
+    //   Оценка make_base до построения графа: размер графа считается по маршрутам точно,
+    //   пиковая память и размер файла базы - по размерам структур и формату сериализации.
+    //   Оценка грубая (без накладных расходов аллокатора), но порядок V^2 таблицы всех пар
+    //   она показывает заранее, а не через несколько часов построения.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    struct EngineEstimate {
+        size_t peak_memory = 0;     // байт
+        size_t file_size = 0;       // байт
+    };
+
+    struct BaseEstimate {
+        GraphSize graph;
+        size_t catalogue_memory = 0;
+        EngineEstimate all_pairs;
+        EngineEstimate out_of_core;
+        EngineEstimate on_demand;
+
+        [[nodiscard]] const EngineEstimate &For(RoutingEngine engine) const noexcept;
+    };
+
+    // Вызывается после заполнения справочника (JsonReader::ReadData)
+    [[nodiscard]] BaseEstimate EstimateBase(const TransportCatalogue &db, const RoutingSettings &settings);
+
+    // Движок, укладывающийся в бюджет памяти: заданный или, если он не помещается, следующий по порядку
+    // таблица всех пар -> таблица, записанная потоком -> поиск по запросу. nullopt - не помещается ни один
+    [[nodiscard]] std::optional<RoutingEngine> ChooseEngine(const BaseEstimate &estimate, RoutingEngine engine,
+                                                            size_t memory_budget);
+
+    // Оценка в формате JSON
+    void WriteEstimate(std::ostream &out, const BaseEstimate &estimate);
+
+} // namespace transcat
@@ -0,0 +1,247 @@
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+
+#include "base_patcher.h"
+#include "json_reader.h"
+#include "profile.h"
+#include "serialization.h"
+
+namespace transcat {
+
+    using namespace std::string_literals;
+
+    BasePatcher::BasePatcher(TransportCatalogue &db, renderer::MapRenderer &renderer)
+            : db_(db), renderer_(renderer) {
+    }
+
+    void BasePatcher::LoadBase(const std::filesystem::path &path) {
+        CatalogueDeserializer deserializer{old_db_};
+        deserializer.DeserializeFrom(path);
+        renderer_.UseSettings(deserializer.GetRenderSettings());
+        routing_settings_ = deserializer.GetRoutingSettings();
+        old_graph_ = deserializer.GetRouteGraph();
+        old_routes_ = deserializer.GetRoutesInternalData();
+    }
+
+    void BasePatcher::Apply(const json::Document &document) {
+        PROFILE_SCOPE("patch");
+        const json::Dict &data = document.GetRoot().AsDict();
+        json::Array patch_requests;
+        if (data.count("patch_requests"s)) {
+            patch_requests = data.at("patch_requests"s).AsArray();
+        }
+        FillCatalogue(patch_requests);
+        RepairRoutes();
+    }
+
+    const RoutingSettings &BasePatcher::GetRoutingSettings() const noexcept {
+        return routing_settings_;
+    }
+
+    const graph::DirectedWeightedGraph<double> &BasePatcher::GetRouteGraph() const {
+        return handler_->GetRouteGraph();
+    }
+
+    const graph::Router<double>::RoutesInternalData &BasePatcher::GetRoutesInternalData() const noexcept {
+        return routes_;
+    }
+
+    size_t BasePatcher::GetRecomputedRowCount() const noexcept {
+        return recomputed_rows_;
+    }
+
+    void BasePatcher::FillCatalogue(const json::Array &patch_requests) {
+        std::unordered_set<std::string_view> removed_stops;     // названия - в документе patch_requests
+        std::unordered_set<std::string_view> removed_buses;
+        std::vector<const json::Dict *> stop_requests;
+        std::vector<const json::Dict *> distance_requests;
+        json::Array base_requests;  // Stop и Bus в формате base_requests
+
+        for (const auto &node: patch_requests) {
+            const json::Dict &request = node.AsDict();
+            const std::string &type = request.at("type"s).AsString();
+            if (type == "Stop"s) {
+                stop_requests.push_back(&request);
+                base_requests.push_back(request);
+            } else if (type == "Bus"s) {
+                base_requests.push_back(request);
+            } else if (type == "RemoveStop"s) {
+                removed_stops.insert(request.at("name"s).AsString());
+            } else if (type == "RemoveBus"s) {
+                removed_buses.insert(request.at("name"s).AsString());
+            } else if (type == "Distance"s) {
+                distance_requests.push_back(&request);
+            } else {
+                throw std::invalid_argument("Unknown patch request type: "s + type);
+            }
+        }
+
+        // остановки: старые (кроме удаленных и измененных), затем новые.
+        // Справочник не перезаписывает уже добавленное, поэтому изменения всегда добавляются первыми.
+        std::unordered_set<std::string_view> patched_stops;
+        for (const json::Dict *request: stop_requests) {
+            patched_stops.insert(request->at("name"s).AsString());
+        }
+        for (StopPtr p_stop: old_db_.GetAllStops()) {
+            if (!removed_stops.count(p_stop->name) && !patched_stops.count(p_stop->name)) {
+                db_.AddStop(*p_stop);
+            }
+        }
+        for (const json::Dict *request: stop_requests) {
+            db_.AddStop({
+                                request->at("name"s).AsString(),
+                                request->at("latitude"s).AsDouble(),
+                                request->at("longitude"s).AsDouble()
+                        });
+        }
+
+        // расстояния: явно заданные, из новых остановок, затем старые
+        for (const json::Dict *request: distance_requests) {
+            StopPtr from = db_.GetStop(request->at("from"s).AsString());
+            StopPtr to = db_.GetStop(request->at("to"s).AsString());
+            if (!from || !to) {
+                throw std::invalid_argument("Unknown stop in distance patch"s);
+            }
+            db_.SetDistance({from, to}, request->at("distance"s).AsInt());
+        }
+        renderer::MapRenderer renderer;
+        query::JsonReader json_reader(db_, renderer);
+        json::Dict base;
+        base["base_requests"s] = std::move(base_requests);
+        json_reader.ReadData(json::Document(std::move(base)));
+        for (const auto &[from_to, distance]: old_db_.distances_) {
+            StopPtr from = db_.GetStop(from_to.from->name);
+            StopPtr to = db_.GetStop(from_to.to->name);
+            if (from && to) {
+                db_.SetDistance({from, to}, distance);
+            }
+        }
+
+        // автобусы: старые, не удаленные и не замененные изменениями
+        for (const Bus *p_bus: old_db_.GetAllBuses()) {
+            if (removed_buses.count(p_bus->name) || db_.GetBus(p_bus->name)) {
+                continue;
+            }
+            Bus bus{p_bus->name, {}, p_bus->unique_stops, p_bus->is_roundtrip, nullptr, nullptr, p_bus->schedule, {}};
+            for (StopPtr p_stop: p_bus->route) {
+                StopPtr p_new_stop = db_.GetStop(p_stop->name);
+                if (!p_new_stop) {
+                    throw std::logic_error("Bus "s + std::string(p_bus->name) + " uses removed stop "s
+                                           + std::string(p_stop->name));
+                }
+                bus.route.push_back(p_new_stop);
+            }
+            if (p_bus->start_stop) {
+                bus.start_stop = db_.GetStop(p_bus->start_stop->name);
+                bus.end_stop = db_.GetStop(p_bus->end_stop->name);
+            }
+            db_.AddBus(bus);
+        }
+
+        db_.Freeze();
+        db_.BuildTimetable((routing_settings_.bus_velocity * 1'000) / 60);
+        routing_settings_.use_geo_heuristic = db_.AreRoadDistancesAboveGreatCircle();
+    }
+
+    void BasePatcher::RepairRoutes() {
+        handler_.emplace(db_, renderer_, routing_settings_, db_.EvaluateVertexCount());
+        routes_.clear();
+        recomputed_rows_ = 0;
+        if (routing_settings_.engine != RoutingEngine::AllPairs) {
+            return;     // таблицы нет (маршруты ищутся по запросу) или сериализатор запишет ее потоком заново
+        }
+        const auto &graph = handler_->GetRouteGraph();
+        const graph::Router<double> router(graph, {});
+        const size_t vertex_count = graph.GetVertexCount();
+
+        // соответствие вершин: по названию остановки
+        const std::vector<StopPtr> old_stops = old_db_.GetAllStops();
+        std::vector<std::optional<graph::VertexId>> old_to_new(old_stops.size());
+        std::vector<std::optional<graph::VertexId>> new_to_old(vertex_count);
+        for (graph::VertexId old_vertex = 0; old_vertex < old_stops.size(); ++old_vertex) {
+            if (StopPtr p_stop = db_.GetStop(old_stops[old_vertex]->name)) {
+                const graph::VertexId vertex = handler_->GetVertexForStop(p_stop);
+                old_to_new[old_vertex] = vertex;
+                new_to_old[vertex] = old_vertex;
+            }
+        }
+
+        // соответствие ребер: неизменившееся ребро совпадает по автобусу, концам, числу остановок и весу
+        using EdgeKey = std::tuple<std::string_view, graph::VertexId, graph::VertexId, int, double>;
+        std::map<EdgeKey, std::vector<graph::EdgeId>> new_edges;
+        for (graph::EdgeId edge_id = graph.GetEdgeCount(); edge_id-- > 0;) {
+            const auto &edge = graph.GetEdge(edge_id);
+            new_edges[{db_.GetBusByEdge(edge_id)->name, edge.from, edge.to, edge.span_count, edge.weight}]
+                    .push_back(edge_id);
+        }
+        std::vector<std::optional<graph::EdgeId>> old_to_new_edge(old_graph_.GetEdgeCount());
+        std::vector<bool> is_matched(graph.GetEdgeCount(), false);
+        for (graph::EdgeId old_edge_id = 0; old_edge_id < old_graph_.GetEdgeCount(); ++old_edge_id) {
+            const auto &edge = old_graph_.GetEdge(old_edge_id);
+            if (!old_to_new[edge.from] || !old_to_new[edge.to]) {
+                continue;
+            }
+            auto it = new_edges.find({old_db_.GetBusByEdge(old_edge_id)->name, *old_to_new[edge.from],
+                                      *old_to_new[edge.to], edge.span_count, edge.weight});
+            if (it != new_edges.end() && !it->second.empty()) {
+                old_to_new_edge[old_edge_id] = it->second.back();
+                is_matched[it->second.back()] = true;
+                it->second.pop_back();
+            }
+        }
+        std::vector<graph::EdgeId> added_edges;
+        for (graph::EdgeId edge_id = 0; edge_id < graph.GetEdgeCount(); ++edge_id) {
+            if (!is_matched[edge_id]) {
+                added_edges.push_back(edge_id);
+            }
+        }
+
+        routes_.assign(vertex_count, {});
+        for (graph::VertexId vertex = 0; vertex < vertex_count; ++vertex) {
+            // строка новой остановки или строка, отсутствующая в старой базе, считается заново
+            const bool has_old_row = new_to_old[vertex] && *new_to_old[vertex] < old_routes_.size();
+            bool is_affected = !has_old_row;
+            const auto &old_row = has_old_row ? old_routes_[*new_to_old[vertex]] : routes_[vertex];
+
+            // дерево маршрутов строки использует удаленное или измененное ребро
+            for (size_t i = 0; !is_affected && i < old_row.size(); ++i) {
+                if (old_row[i] && old_row[i]->prev_edge && !old_to_new_edge[*old_row[i]->prev_edge]) {
+                    is_affected = true;
+                }
+            }
+            // новое ребро u -> v сокращает маршрут до v (вершины новых остановок раньше были недостижимы)
+            for (size_t i = 0; !is_affected && i < added_edges.size(); ++i) {
+                const auto &edge = graph.GetEdge(added_edges[i]);
+                if (!new_to_old[edge.from] || !old_row[*new_to_old[edge.from]]) {
+                    continue;
+                }
+                const double candidate = old_row[*new_to_old[edge.from]]->weight + edge.weight;
+                if (!new_to_old[edge.to] || !old_row[*new_to_old[edge.to]]
+                    || candidate < old_row[*new_to_old[edge.to]]->weight) {
+                    is_affected = true;
+                }
+            }
+
+            if (is_affected) {
+                routes_[vertex] = router.BuildRoutesFrom(vertex);
+                ++recomputed_rows_;
+                continue;
+            }
+            auto &row = routes_[vertex];
+            row.resize(vertex_count);
+            for (graph::VertexId old_vertex = 0; old_vertex < old_row.size(); ++old_vertex) {
+                if (old_row[old_vertex] && old_to_new[old_vertex]) {
+                    auto &route = row[*old_to_new[old_vertex]];
+                    route = graph::Router<double>::RouteInternalData{old_row[old_vertex]->weight, std::nullopt};
+                    if (old_row[old_vertex]->prev_edge) {
+                        route->prev_edge = old_to_new_edge[*old_row[old_vertex]->prev_edge];
+                    }
+                }
+            }
+        }
+        PROFILE_COUNT("patch.recomputed_rows", recomputed_rows_);
+    }
+
+} // namespace transcat
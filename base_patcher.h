@@ -0,0 +1,65 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+#include "transport_catalogue.h"
+#include "map_renderer.h"
+#include "request_handler.h"
+#include "json.h"
+
+namespace transcat {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Base Patcher
+    //
+    //   Применяет к готовой базе изменения (patch_requests) без полного пересчета:
+    //   справочник и граф собираются заново из старой базы (это дешево), а в таблице
+    //   кратчайших маршрутов пересчитываются поиском Дейкстры только затронутые строки.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    class BasePatcher {
+    public:
+        // db - новый, пустой справочник; в него попадет результат
+        BasePatcher(TransportCatalogue &db, renderer::MapRenderer &renderer);
+
+        // Загружает исходную базу. Настройки отрисовки передаются в renderer
+        void LoadBase(const std::filesystem::path &path);
+
+        // Применяет patch_requests документа
+        void Apply(const json::Document &document);
+
+        [[nodiscard]] const RoutingSettings &GetRoutingSettings() const noexcept;
+
+        [[nodiscard]] const graph::DirectedWeightedGraph<double> &GetRouteGraph() const;
+
+        [[nodiscard]] const graph::Router<double>::RoutesInternalData &GetRoutesInternalData() const noexcept;
+
+        // Количество строк таблицы маршрутов, пересчитанных заново
+        [[nodiscard]] size_t GetRecomputedRowCount() const noexcept;
+
+    private:
+        using RoutesInternalData = graph::Router<double>::RoutesInternalData;
+
+        // Заполняет новый справочник: изменения + не затронутые ими данные старой базы
+        void FillCatalogue(const json::Array &patch_requests);
+
+        // Переносит неизменившиеся строки таблицы маршрутов, остальные пересчитывает
+        void RepairRoutes();
+
+        TransportCatalogue &db_;
+        renderer::MapRenderer &renderer_;
+        RoutingSettings routing_settings_;
+
+        TransportCatalogue old_db_;
+        graph::DirectedWeightedGraph<double> old_graph_;
+        RoutesInternalData old_routes_;
+
+        std::optional<RequestHandler> handler_;
+        RoutesInternalData routes_;
+        size_t recomputed_rows_ = 0;
+    };
+
+} // namespace transcat
@@ -0,0 +1,231 @@
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+
+#include "city_generator.h"
+#include "../serialization.h"
+
+using namespace std::literals;
+using namespace transcat;
+
+namespace {
+
+    struct Options {
+        bench::CityOptions city;
+        double min_time = 0.5;          // секунд на один замер
+        std::string filter;             // замеры, в имени которых нет этой подстроки, пропускаются
+        std::string out;                // файл для результатов (по умолчанию - stdout)
+    };
+
+    struct Result {
+        std::string name;
+        size_t iterations = 0;
+        double real_time = 0;           // нс на итерацию
+        size_t items_per_iteration = 1;
+    };
+
+    // Повторяет body, пока суммарное время не превысит min_time (но не меньше одного раза).
+    // setup выполняется перед каждой итерацией и в замер не входит.
+    Result Measure(const std::string &name, double min_time, const std::function<void()> &setup,
+                   const std::function<void()> &body, size_t items_per_iteration = 1) {
+        using Clock = std::chrono::steady_clock;
+        Result result{name, 0, 0, items_per_iteration};
+        Clock::duration total{};
+        while (result.iterations == 0 || std::chrono::duration<double>(total).count() < min_time) {
+            setup();
+            const auto start = Clock::now();
+            body();
+            total += Clock::now() - start;
+            ++result.iterations;
+        }
+        result.real_time = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(total).count())
+                           / static_cast<double>(result.iterations);
+        std::cerr << name << ": "sv << result.real_time / 1e6 << " ms x "sv << result.iterations << std::endl;
+        return result;
+    }
+
+    Options ParseOptions(int argc, char *argv[]) {
+        Options options;
+        for (int i = 1; i < argc; ++i) {
+            const std::string_view arg(argv[i]);
+            const auto eq = arg.find('=');
+            const std::string_view key = arg.substr(0, eq);
+            const std::string value(eq == std::string_view::npos ? ""sv : arg.substr(eq + 1));
+            if (key == "--stops"sv) {
+                options.city.stop_count = std::stoul(value);
+            } else if (key == "--buses"sv) {
+                options.city.bus_count = std::stoul(value);
+            } else if (key == "--route-length"sv) {
+                options.city.route_length = std::stoul(value);
+            } else if (key == "--seed"sv) {
+                options.city.seed = static_cast<uint32_t>(std::stoul(value));
+            } else if (key == "--min-time"sv) {
+                options.min_time = std::stod(value);
+            } else if (key == "--filter"sv) {
+                options.filter = value;
+            } else if (key == "--out"sv) {
+                options.out = value;
+            } else {
+                throw std::invalid_argument("Unknown option: "s + std::string(arg));
+            }
+        }
+        return options;
+    }
+
+    json::Document MakeReport(const Options &options, const std::vector<Result> &results) {
+        json::Array benchmarks;
+        for (const Result &result: results) {
+            benchmarks.emplace_back(json::Dict{
+                    {"name", result.name},
+                    {"iterations", static_cast<int>(result.iterations)},
+                    {"real_time", result.real_time},
+                    {"items_per_second", 1e9 * static_cast<double>(result.items_per_iteration) / result.real_time},
+                    {"time_unit", "ns"s}
+            });
+        }
+        return json::Document{json::Dict{
+                {"context", json::Dict{
+                        {"stops", static_cast<int>(options.city.stop_count)},
+                        {"buses", static_cast<int>(options.city.bus_count)},
+                        {"route_length", static_cast<int>(options.city.route_length)},
+                        {"seed", static_cast<int>(options.city.seed)}
+                }},
+                {"benchmarks", std::move(benchmarks)}
+        }};
+    }
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    const Options options = ParseOptions(argc, argv);
+    const std::string base_file = "transcat_bench.db"s;
+    const json::Document city = bench::GenerateCity(options.city, base_file);
+    std::stringstream city_text;
+    json::Print(city, city_text);
+
+    std::vector<Result> results;
+    auto run = [&](const std::string &name, const std::function<void()> &setup, const std::function<void()> &body,
+                   size_t items = 1) {
+        if (name.find(options.filter) != std::string::npos) {
+            results.push_back(Measure(name, options.min_time, setup, body, items));
+        }
+    };
+    const auto no_setup = [] {};
+
+    // make_base по фазам
+    run("JsonLoad"s, no_setup, [&] {
+        std::istringstream in(city_text.str());
+        json::Load(in);
+    });
+
+    std::optional<TransportCatalogue> db;
+    std::optional<renderer::MapRenderer> renderer;
+    std::optional<query::JsonReader> json_reader;
+    auto fill = [&] {
+        json_reader.reset();
+        db.emplace();
+        renderer.emplace();
+        json_reader.emplace(*db, *renderer);
+        json_reader->ReadData(city);
+    };
+    run("FillCatalogue"s, [&] {
+        json_reader.reset();
+        db.emplace();
+        renderer.emplace();
+        json_reader.emplace(*db, *renderer);
+    }, [&] { json_reader->ReadData(city); });
+
+    // граф строится один раз на справочник (он запоминает автобусы ребер), поэтому справочник заполняется заново
+    std::optional<RequestHandler> handler;
+    run("BuildGraph"s, [&] {
+        handler.reset();
+        fill();
+    }, [&] {
+        handler.emplace(*db, *renderer, json_reader->GetRoutingSettings(), db->EvaluateVertexCount());
+    });
+    if (!handler) {
+        fill();
+        handler.emplace(*db, *renderer, json_reader->GetRoutingSettings(), db->EvaluateVertexCount());
+    }
+
+    std::optional<graph::Router<double>> router;
+    run("BuildRouter"s, [&] { router.reset(); }, [&] { router.emplace(handler->GetRouteGraph()); });
+    if (!router) {
+        router.emplace(handler->GetRouteGraph());
+    }
+
+    run("Serialize"s, no_setup, [&] {
+        CatalogueSerializer serializer{*db, renderer->GetSettings(), json_reader->GetRoutingSettings(),
+                                       handler->GetRouteGraph(), router->GetRoutesInternalData()};
+        serializer.SerializeTo(base_file);
+    });
+    {
+        CatalogueSerializer serializer{*db, renderer->GetSettings(), json_reader->GetRoutingSettings(),
+                                       handler->GetRouteGraph(), router->GetRoutesInternalData()};
+        serializer.SerializeTo(base_file);
+    }
+
+    // process_requests
+    std::optional<TransportCatalogue> loaded_db;
+    std::optional<CatalogueDeserializer> deserializer;
+    run("Deserialize"s, [&] {
+        deserializer.reset();
+        loaded_db.emplace();
+        deserializer.emplace(*loaded_db);
+    }, [&] { deserializer->DeserializeFrom(base_file); });
+    deserializer.reset();
+    loaded_db.emplace();
+    deserializer.emplace(*loaded_db);
+    deserializer->DeserializeFrom(base_file);
+
+    renderer::MapRenderer loaded_renderer;
+    loaded_renderer.UseSettings(deserializer->GetRenderSettings());
+    query::JsonReader loaded_reader(*loaded_db, loaded_renderer);
+    loaded_reader.SetRoutingSettings(deserializer->GetRoutingSettings());
+
+    // обработчик и маршрутизатор строятся один раз, как в process_requests: замеряются только запросы
+    const RequestHandler loaded_handler{*loaded_db, loaded_renderer, deserializer->GetRoutingSettings(),
+                                        loaded_db->EvaluateVertexCount(), deserializer->GetRouteGraph()};
+    graph::Router<double> loaded_router(loaded_handler.GetRouteGraph(), deserializer->GetRoutesInternalData());
+    loaded_router.SetRoutesRowLoader(deserializer->GetRoutesRowLoader(loaded_handler.GetRouteGraph()));
+    loaded_handler.SetupRouter(loaded_router);
+
+    const std::vector<std::pair<std::string, query::StatRequestType>> request_types{
+            {"Bus"s, query::StatRequestType::Bus},
+            {"Stop"s, query::StatRequestType::Stop},
+            {"Route"s, query::StatRequestType::Route},
+            {"Map"s, query::StatRequestType::Map},
+            {"NearestStops"s, query::StatRequestType::NearestStops},
+            {"StopsInArea"s, query::StatRequestType::StopsInArea},
+            {"Matrix"s, query::StatRequestType::Matrix},
+            {"Isochrone"s, query::StatRequestType::Isochrone},
+            {"SegmentTime"s, query::StatRequestType::SegmentTime}
+    };
+    for (const auto &[type_name, type]: request_types) {
+        // карта дорогая - ее запросов меньше
+        const size_t count = type == query::StatRequestType::Map ? 2 : 200;
+        const auto requests = loaded_reader.ParseStatRequests(
+                bench::GenerateStatRequests(options.city, type, count, base_file));
+        run("Stat/"s + type_name, no_setup, [&] {
+            std::ostringstream out;
+            loaded_reader.WriteInfo(out, requests, loaded_handler, loaded_router);
+        }, count);
+    }
+
+    std::remove(base_file.c_str());
+
+    const json::Document report = MakeReport(options, results);
+    if (options.out.empty()) {
+        json::Print(report, std::cout);
+        std::cout << std::endl;
+    } else {
+        std::ofstream out(options.out);
+        json::Print(report, out);
+        out << std::endl;
+    }
+    return 0;
+}
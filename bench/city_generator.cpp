@@ -0,0 +1,222 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "city_generator.h"
+
+namespace transcat::bench {
+
+    using namespace std::string_literals;
+
+    namespace {
+
+        const geo::Coordinates city_center{43.58, 39.72};
+        const double grid_step = 0.004;    // шаг решетки в градусах, около 400 м
+
+        size_t GetGridSide(const CityOptions &options) {
+            return std::max<size_t>(2, static_cast<size_t>(std::ceil(std::sqrt(options.stop_count))));
+        }
+
+        std::string GetStopName(size_t index) {
+            return "Stop "s + std::to_string(index);
+        }
+
+        geo::Coordinates GetStopPoint(const CityOptions &options, size_t index, std::mt19937 &generator) {
+            const size_t side = GetGridSide(options);
+            std::uniform_real_distribution<double> jitter(-grid_step / 4, grid_step / 4);
+            return {
+                    city_center.lat + (static_cast<double>(index / side) - static_cast<double>(side) / 2) * grid_step
+                    + jitter(generator),
+                    city_center.lng + (static_cast<double>(index % side) - static_cast<double>(side) / 2) * grid_step
+                    + jitter(generator)
+            };
+        }
+
+        // Случайное блуждание по решетке без немедленного возврата на предыдущий узел
+        std::vector<size_t> MakeWalk(const CityOptions &options, std::mt19937 &generator) {
+            const size_t side = GetGridSide(options);
+            std::uniform_int_distribution<size_t> start(0, options.stop_count - 1);
+            std::vector<size_t> walk{start(generator)};
+            while (walk.size() < std::max<size_t>(options.route_length, 2)) {
+                const size_t current = walk.back();
+                std::vector<size_t> neighbours;
+                if (current >= side) neighbours.push_back(current - side);
+                if (current + side < options.stop_count) neighbours.push_back(current + side);
+                if (current % side > 0) neighbours.push_back(current - 1);
+                if (current % side + 1 < side && current + 1 < options.stop_count) neighbours.push_back(current + 1);
+                if (walk.size() > 1 && neighbours.size() > 1) {
+                    neighbours.erase(std::remove(neighbours.begin(), neighbours.end(), walk[walk.size() - 2]),
+                                     neighbours.end());
+                }
+                std::uniform_int_distribution<size_t> pick(0, neighbours.size() - 1);
+                walk.push_back(neighbours[pick(generator)]);
+            }
+            return walk;
+        }
+
+        json::Dict MakeRenderSettings() {
+            return {
+                    {"width", 1200.}, {"height", 1200.}, {"padding", 50.},
+                    {"line_width", 14.}, {"stop_radius", 5.},
+                    {"bus_label_font_size", 20}, {"bus_label_offset", json::Array{7., 15.}},
+                    {"stop_label_font_size", 20}, {"stop_label_offset", json::Array{7., -3.}},
+                    {"underlayer_color", json::Array{255, 255, 255, 0.85}}, {"underlayer_width", 3.},
+                    {"color_palette", json::Array{"green"s, json::Array{255, 160, 0}, "red"s}}
+            };
+        }
+
+    } // namespace
+
+    json::Document GenerateCity(const CityOptions &options, const std::string &base_file) {
+        std::mt19937 generator(options.seed);
+
+        std::vector<geo::Coordinates> points;
+        points.reserve(options.stop_count);
+        for (size_t index = 0; index < options.stop_count; ++index) {
+            points.push_back(GetStopPoint(options, index, generator));
+        }
+
+        std::vector<json::Dict> road_distances(options.stop_count);
+        json::Array buses;
+        std::uniform_real_distribution<double> detour(1.1, 1.5);
+        std::bernoulli_distribution is_roundtrip(0.5);
+        for (size_t bus = 0; bus < options.bus_count; ++bus) {
+            std::vector<size_t> walk = MakeWalk(options, generator);
+            for (size_t i = 0; i + 1 < walk.size(); ++i) {
+                const double distance = geo::ComputeDistance(points[walk[i]], points[walk[i + 1]]) * detour(generator);
+                road_distances[walk[i]][GetStopName(walk[i + 1])] = static_cast<int>(std::lround(distance));
+            }
+            const bool roundtrip = is_roundtrip(generator);
+            if (roundtrip) {
+                // кольцевой маршрут возвращается тем же путем
+                for (size_t i = walk.size() - 1; i-- > 0;) {
+                    walk.push_back(walk[i]);
+                }
+            }
+            json::Array stops;
+            for (size_t index: walk) {
+                stops.emplace_back(GetStopName(index));
+            }
+            buses.emplace_back(json::Dict{
+                    {"type", "Bus"s}, {"name", "Bus "s + std::to_string(bus)},
+                    {"is_roundtrip", roundtrip}, {"stops", std::move(stops)}
+            });
+        }
+
+        json::Array base_requests;
+        for (size_t index = 0; index < options.stop_count; ++index) {
+            base_requests.emplace_back(json::Dict{
+                    {"type", "Stop"s}, {"name", GetStopName(index)},
+                    {"latitude", points[index].lat}, {"longitude", points[index].lng},
+                    {"road_distances", std::move(road_distances[index])}
+            });
+        }
+        for (auto &bus: buses) {
+            base_requests.push_back(std::move(bus));
+        }
+
+        return json::Document{json::Dict{
+                {"serialization_settings", json::Dict{{"file", base_file}}},
+                {"routing_settings", json::Dict{{"bus_wait_time", 6}, {"bus_velocity", 40.}}},
+                {"render_settings", MakeRenderSettings()},
+                {"base_requests", std::move(base_requests)}
+        }};
+    }
+
+    json::Document GenerateStatRequests(const CityOptions &options, query::StatRequestType type, size_t count,
+                                        const std::string &base_file) {
+        std::mt19937 generator(options.seed + 1);
+        std::uniform_int_distribution<size_t> stop(0, options.stop_count - 1);
+        std::uniform_int_distribution<size_t> bus(0, options.bus_count - 1);
+        std::uniform_real_distribution<double> offset(-0.01, 0.01);
+
+        // остановки SegmentTime берутся из маршрутов того же города
+        std::vector<json::Array> bus_routes;
+        if (type == query::StatRequestType::SegmentTime) {
+            const json::Document city = GenerateCity(options, base_file);
+            for (const auto &node: city.GetRoot().AsDict().at("base_requests"s).AsArray()) {
+                const json::Dict &base_request = node.AsDict();
+                if (base_request.at("type"s).AsString() == "Bus"s) {
+                    bus_routes.push_back(base_request.at("stops"s).AsArray());
+                }
+            }
+        }
+
+        json::Array requests;
+        for (int id = 1; static_cast<size_t>(id) <= count; ++id) {
+            json::Dict request{{"id", id}};
+            const geo::Coordinates point{city_center.lat + offset(generator), city_center.lng + offset(generator)};
+            switch (type) {
+                case query::StatRequestType::Bus:
+                    request["type"] = "Bus"s;
+                    request["name"] = "Bus "s + std::to_string(bus(generator));
+                    break;
+                case query::StatRequestType::Stop:
+                    request["type"] = "Stop"s;
+                    request["name"] = GetStopName(stop(generator));
+                    break;
+                case query::StatRequestType::Map:
+                    request["type"] = "Map"s;
+                    break;
+                case query::StatRequestType::Route:
+                    request["type"] = "Route"s;
+                    request["from"] = GetStopName(stop(generator));
+                    request["to"] = GetStopName(stop(generator));
+                    break;
+                case query::StatRequestType::NearestStops:
+                    request["type"] = "NearestStops"s;
+                    request["latitude"] = point.lat;
+                    request["longitude"] = point.lng;
+                    request["count"] = 5;
+                    break;
+                case query::StatRequestType::StopsInArea:
+                    request["type"] = "StopsInArea"s;
+                    request["bbox"] = json::Dict{
+                            {"min_lat", point.lat - grid_step * 2}, {"min_lon", point.lng - grid_step * 2},
+                            {"max_lat", point.lat + grid_step * 2}, {"max_lon", point.lng + grid_step * 2}
+                    };
+                    break;
+                case query::StatRequestType::Matrix: {
+                    request["type"] = "Matrix"s;
+                    json::Array origins;
+                    json::Array destinations;
+                    for (int i = 0; i < 4; ++i) {
+                        origins.emplace_back(GetStopName(stop(generator)));
+                        destinations.emplace_back(GetStopName(stop(generator)));
+                    }
+                    request["origins"] = std::move(origins);
+                    request["destinations"] = std::move(destinations);
+                    break;
+                }
+                case query::StatRequestType::Isochrone:
+                    request["type"] = "Isochrone"s;
+                    request["from"] = GetStopName(stop(generator));
+                    request["time"] = 15.;
+                    break;
+                case query::StatRequestType::SegmentTime: {
+                    const size_t bus_index = bus(generator);
+                    const json::Array &route = bus_routes[bus_index];
+                    std::uniform_int_distribution<size_t> position(0, route.size() - 1);
+                    size_t first = position(generator);
+                    size_t last = position(generator);
+                    if (first > last) {
+                        std::swap(first, last);
+                    }
+                    request["type"] = "SegmentTime"s;
+                    request["bus"] = "Bus "s + std::to_string(bus_index);
+                    request["from"] = route[first];
+                    request["to"] = route[last];
+                    break;
+                }
+            }
+            requests.emplace_back(std::move(request));
+        }
+
+        return json::Document{json::Dict{
+                {"serialization_settings", json::Dict{{"file", base_file}}},
+                {"stat_requests", std::move(requests)}
+        }};
+    }
+
+} // namespace transcat::bench
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "../json.h"
+#include "../json_reader.h"
+
+namespace transcat::bench {
+
+    // Параметры синтетического города. Один и тот же набор параметров всегда дает один и тот же город
+    struct CityOptions {
+        size_t stop_count = 400;
+        size_t bus_count = 40;
+        size_t route_length = 20;   // количество остановок, которые автобус проходит в одну сторону
+        uint32_t seed = 42;
+    };
+
+    // Документ make_base: остановки на решетке со случайным сдвигом, автобусы - случайные блуждания
+    // по соседним узлам решетки, дорожные расстояния - на 10-50% длиннее географических
+    json::Document GenerateCity(const CityOptions &options, const std::string &base_file);
+
+    // Документ process_requests из count запросов одного типа
+    json::Document GenerateStatRequests(const CityOptions &options, query::StatRequestType type, size_t count,
+                                        const std::string &base_file);
+
+} // namespace transcat::bench
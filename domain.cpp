@@ -1,7 +1,17 @@
+#include <cmath>
+
 #include "domain.h"
 
 namespace transcat {
 
+    bool Schedule::IsValid() const noexcept {
+        if (!std::isfinite(first_departure) || !std::isfinite(last_departure) || !std::isfinite(interval)) {
+            return false;
+        }
+        return interval >= MIN_INTERVAL && first_departure <= last_departure
+               && (last_departure - first_departure) / interval < MAX_TRIPS;
+    }
+
     StopPair StopPair::Reverse() const noexcept {
         return {to, from};
     }
@@ -1,7 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
-#include <list>
+#include <string_view>
+#include <vector>
 #include <optional>
 #include <map>
 
@@ -9,22 +11,45 @@
 
 namespace transcat {
 
+    // Названия остановок и автобусов справочника лежат в его пуле строк (TransportCatalogue::AddStop/AddBus).
+    // До добавления в справочник name может указывать на любую строку, живущую до вызова Add*
     struct Stop {
-        std::string name;
+        std::string_view name;
         double latitude = 0;
         double longitude = 0;
+        uint32_t id = 0;        // индекс в справочнике, назначается при добавлении
     };
 
     using StopPtr = const Stop *;
-    using Route = std::list<StopPtr>;
+    using Route = std::vector<StopPtr>;
+    using distance_t = int;
+
+    // Расписание автобуса: рейсы отправляются с конечных с first_departure по last_departure
+    // каждые interval минут (время - в минутах от начала суток)
+    struct Schedule {
+        static constexpr double MIN_INTERVAL = 1.;      // минута
+        static constexpr double MAX_TRIPS = 24. * 60.;  // рейсов за сутки при минимальном интервале
+
+        double first_departure = 0;
+        double last_departure = 0;
+        double interval = 0;
+
+        // Времена конечны, first_departure <= last_departure, interval >= MIN_INTERVAL
+        // и рейсов с каждой конечной не больше MAX_TRIPS
+        [[nodiscard]] bool IsValid() const noexcept;
+    };
 
     struct Bus {
-        std::string name;
+        std::string_view name;
         Route route;
         size_t unique_stops = 0;
         bool is_roundtrip = false;
         StopPtr start_stop = nullptr;
         StopPtr end_stop = nullptr;
+        std::optional<Schedule> schedule;
+        // route_distances[i] - дорожное расстояние от начала маршрута до i-й остановки.
+        // Заполняется справочником (TransportCatalogue::BuildRouteDistances)
+        std::vector<distance_t> route_distances;
     };
 
     struct StopPair {
@@ -42,9 +67,31 @@ namespace transcat {
         size_t operator()(const StopPair &stop_pair) const;
     };
 
+    // Как отвечать на запросы маршрутов: по таблице всех пар, построенной в make_base (быстрые ответы,
+    // но O(V^2) памяти и O(V^3) на построение), по той же таблице, построенной по строкам прямо в файл
+    // и читаемой по строкам из отображенного в память файла, или поиском Дейкстры по каждому запросу.
+    // Порядок - по убыванию памяти make_base (см. ChooseEngine)
+    enum class RoutingEngine {
+        AllPairs,
+        OutOfCore,
+        OnDemand
+    };
+
+    // Граф маршрутов: ребро на каждую пару остановок одного рейса (O(L^2) ребер на маршрут длины L)
+    // или вершина на каждую остановку маршрута с ребрами посадки, перегона и высадки (O(L) ребер)
+    enum class RouteGraphModel {
+        StopPairs,
+        RouteStops
+    };
+
     struct RoutingSettings {
         int bus_wait_time = 0;
         double bus_velocity = 0;
+        double walk_velocity = 5;           // скорость пешехода, км/ч
+        double max_walk_distance = 1000;    // наибольшее расстояние пешего подхода к остановке, м
+        RoutingEngine engine = RoutingEngine::AllPairs;
+        bool use_geo_heuristic = false;     // поиск по запросу - A* (дорожные расстояния проверены в make_base)
+        RouteGraphModel graph_model = RouteGraphModel::StopPairs;
     };
 
 } // namespace transcat
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <map>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <vector>
 
@@ -23,6 +24,11 @@ namespace json {
         using variant::variant;
         using Value = variant;
 
+        // Строка копируется: узел владеет своим значением
+        Node(std::string_view str)
+                : variant(std::string(str)) {
+        }
+
         bool IsInt() const {
             return std::holds_alternative<int>(*this);
         }
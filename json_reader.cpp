@@ -1,6 +1,13 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <mutex>
 #include <unordered_set>
 #include <sstream>
 #include <fstream>
+#include <stdexcept>
+#include <thread>
 
 #include "domain.h"
 #include "json_reader.h"
@@ -22,11 +29,45 @@ namespace transcat::query {
             return StatRequestType::Stop;
         } else if (type_name == "Map"s) {
             return StatRequestType::Map;
+        } else if (type_name == "NearestStops"s) {
+            return StatRequestType::NearestStops;
+        } else if (type_name == "StopsInArea"s) {
+            return StatRequestType::StopsInArea;
+        } else if (type_name == "Matrix"s) {
+            return StatRequestType::Matrix;
+        } else if (type_name == "Isochrone"s) {
+            return StatRequestType::Isochrone;
+        } else if (type_name == "SegmentTime"s) {
+            return StatRequestType::SegmentTime;
         } else { //if (type_name == "Route"s) {
             return StatRequestType::Route;
         }
     }
 
+    std::string_view StatRequestTypeToString(StatRequestType type) {
+        switch (type) {
+            case StatRequestType::Bus:
+                return "Bus";
+            case StatRequestType::Stop:
+                return "Stop";
+            case StatRequestType::Map:
+                return "Map";
+            case StatRequestType::Route:
+                return "Route";
+            case StatRequestType::NearestStops:
+                return "NearestStops";
+            case StatRequestType::StopsInArea:
+                return "StopsInArea";
+            case StatRequestType::Matrix:
+                return "Matrix";
+            case StatRequestType::Isochrone:
+                return "Isochrone";
+            case StatRequestType::SegmentTime:
+                return "SegmentTime";
+        }
+        return {};
+    }
+
     ///////////////////////// JsonReader /////////////////////////////////
 
     JsonReader::JsonReader(TransportCatalogue &db, renderer::MapRenderer &renderer)
@@ -41,40 +82,74 @@ namespace transcat::query {
         routing_settings_ = settings;
     }
 
+    void JsonReader::SetSlowRequestLog(SlowRequestLog log) {
+        slow_request_log_ = log;
+    }
+
+    void JsonReader::SetRoutePlannerThreads(size_t count) {
+        route_planner_threads_ = std::max<size_t>(1, count);
+    }
+
     void JsonReader::ReadData(const json::Document &document) {
+        PROFILE_SCOPE("read_data");
         ParseBaseRequests(document);
         ParseRenderSettings(document);
         ParseRoutingSettings(document);
+        db_.BuildTimetable((routing_settings_.bus_velocity * 1'000) / 60);    // км/ч -> м/мин
+        routing_settings_.use_geo_heuristic = db_.AreRoadDistancesAboveGreatCircle();
     }
 
     void JsonReader::WriteInfo(std::ostream &out, const std::vector<query::StatRequest> &requests,
                                graph::DirectedWeightedGraph<double> route_graph,
                                graph::Router<double>::RoutesInternalData routes_internal_data) const {
+        PROFILE_SCOPE("write_info");
         RequestHandler handler{db_,
                                renderer_,
                                routing_settings_,
                                db_.EvaluateVertexCount(),
-                               route_graph
+                               std::move(route_graph)
         };
         //graph::Router<double> router(handler.GetRouteGraph());
-        graph::Router<double> router(handler.GetRouteGraph(), routes_internal_data);
+        graph::Router<double> router(handler.GetRouteGraph(), std::move(routes_internal_data));
+        handler.SetupRouter(router);
+        WriteInfo(out, requests, handler, router);
+    }
+
+    void JsonReader::WriteInfo(std::ostream &out, const std::vector<query::StatRequest> &requests,
+                               const RequestHandler &handler, const graph::Router<double> &router) const {
         json::Array responses;
-        for (const auto &request: requests) {
-            switch (request.type) {
-                case StatRequestType::Bus:
-                    WriteBusInfo(handler, responses, request);
-                    break;
-                case StatRequestType::Stop:
-                    WriteStopInfo(handler, responses, request);
-                    break;
-                case StatRequestType::Map:
-                    WriteMapInfo(handler, responses, request);
-                    break;
-                case StatRequestType::Route:
-                    WriteRouteInfo(handler, router, responses, request);
-                    break;
+
+        const PlannedRoutes planned_routes = PlanRoutes(handler, router, requests);
+        auto write_request_info = [&](size_t index) {
+            if (const auto it = planned_routes.find(index); it != planned_routes.end()) {
+                WriteStopRouteInfo(handler, responses, requests[index], it->second);
+            } else {
+                WriteRequestInfo(handler, router, responses, requests[index]);
+            }
+        };
+
+        // время каждого запроса меряется, только если его есть куда записать (для запланированных
+        // маршрутов поиск уже выполнен в PlanRoutes - меряется только ответ)
+        const bool is_timed = profile::IsEnabled() || slow_request_log_.out;
+        for (size_t index = 0; index < requests.size(); ++index) {
+            const auto &request = requests[index];
+            if (!is_timed) {
+                write_request_info(index);
+                continue;
+            }
+            const auto start_time = profile::Clock::now();
+            write_request_info(index);
+            const auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    profile::Clock::now() - start_time);
+
+            profile::RecordLatency("request."s + std::string(StatRequestTypeToString(request.type)),
+                                   static_cast<uint64_t>(duration.count()));
+            if (slow_request_log_.out && duration >= slow_request_log_.threshold) {
+                LogSlowRequest(request, duration);
             }
         }
+        PROFILE_COUNT("stat_requests", requests.size());
+        PROFILE_SCOPE("print");
         json::Print(json::Document(std::move(responses)), out);
     }
 
@@ -116,6 +191,8 @@ namespace transcat::query {
 
             // отложенная обработка маршрутов
             UpdateRoutes(bus_queries);
+
+            db_.Freeze();
         }
     }
 
@@ -133,7 +210,8 @@ namespace transcat::query {
                 result.push_back({
                                          request.at("id"s).AsInt(),
                                          request_type,
-                                         std::nullopt
+                                         std::nullopt,
+                                         {}     // error
                                  });
                 switch (request_type) {
                     case StatRequestType::Bus:
@@ -141,12 +219,117 @@ namespace transcat::query {
                         result.back().data = request.at("name"s).AsString();
                         break;
                     case StatRequestType::Route:
+                        if (request.count("from_point"s)) {
+                            const json::Dict &from = request.at("from_point"s).AsDict();
+                            const json::Dict &to = request.at("to_point"s).AsDict();
+                            result.back().data = PointPair{
+                                    {from.at("latitude"s).AsDouble(), from.at("longitude"s).AsDouble()},
+                                    {to.at("latitude"s).AsDouble(), to.at("longitude"s).AsDouble()}
+                            };
+                            break;
+                        }
                         result.back().data = StopPair{
                                 db_.GetStop(request.at("from"s).AsString()),
                                 db_.GetStop(request.at("to"s).AsString())
                         };
+                        if (request.count("departure_time"s)) {
+                            const double departure_time = request.at("departure_time"s).AsDouble();
+                            if (!(departure_time >= 0)) {
+                                result.back().error = "invalid departure_time"s;
+                            }
+                            result.back().data = TimedStopPair{std::get<StopPair>(result.back().data), departure_time};
+                        } else if (request.count("pareto"s) && request.at("pareto"s).AsBool()) {
+                            ParetoStopPair pareto{std::get<StopPair>(result.back().data)};
+                            if (request.count("max_transfers"s)) {
+                                const int max_transfers = request.at("max_transfers"s).AsInt();
+                                if (max_transfers < 0) {
+                                    result.back().error = "invalid max_transfers"s;
+                                }
+                                pareto.max_transfers = static_cast<size_t>(
+                                        std::clamp(max_transfers, 0, ParetoStopPair::MAX_TRANSFERS));
+                            }
+                            result.back().data = pareto;
+                        } else if (request.count("alternatives"s)) {
+                            const int count = request.at("alternatives"s).AsInt();
+                            if (count < 1) {
+                                result.back().error = "invalid alternatives"s;
+                            }
+                            result.back().data = AlternativesStopPair{
+                                    std::get<StopPair>(result.back().data),
+                                    static_cast<size_t>(std::clamp(count, 1, AlternativesStopPair::MAX_COUNT))
+                            };
+                        }
                         break;
                     case StatRequestType::Map:
+                        if (request.count("bbox"s)) {
+                            const geo::Box box = ParseBox(request.at("bbox"s).AsDict());
+                            if (!box.IsValid()) {
+                                result.back().error = "invalid bbox"s;
+                            }
+                            result.back().data = box;
+                        } else if (request.count("tile"s)) {
+                            const json::Dict &tile_node = request.at("tile"s).AsDict();
+                            const renderer::Tile tile{
+                                    tile_node.at("z"s).AsInt(),
+                                    tile_node.at("x"s).AsInt(),
+                                    tile_node.at("y"s).AsInt()
+                            };
+                            if (!tile.IsValid()) {
+                                result.back().error = "invalid tile"s;
+                            }
+                            result.back().data = tile;
+                        }
+                        break;
+                    case StatRequestType::NearestStops: {
+                        const int count = request.at("count"s).AsInt();
+                        if (count < 0) {
+                            result.back().error = "invalid count"s;
+                        }
+                        result.back().data = NearestStopsQuery{
+                                {request.at("latitude"s).AsDouble(), request.at("longitude"s).AsDouble()},
+                                static_cast<size_t>(std::max(count, 0))
+                        };
+                        break;
+                    }
+                    case StatRequestType::StopsInArea: {
+                        const geo::Box box = ParseBox(request.at("bbox"s).AsDict());
+                        if (!box.IsValid()) {
+                            result.back().error = "invalid bbox"s;
+                        }
+                        result.back().data = box;
+                        break;
+                    }
+                    case StatRequestType::Matrix: {
+                        MatrixQuery query;
+                        for (const auto &name: request.at("origins"s).AsArray()) {
+                            query.origins.push_back(db_.GetStop(name.AsString()));
+                        }
+                        for (const auto &name: request.at("destinations"s).AsArray()) {
+                            query.destinations.push_back(db_.GetStop(name.AsString()));
+                        }
+                        result.back().data = std::move(query);
+                        break;
+                    }
+                    case StatRequestType::Isochrone: {
+                        const double time = request.at("time"s).AsDouble();
+                        if (!(time >= 0)) {
+                            result.back().error = "invalid time"s;
+                        }
+                        result.back().data = IsochroneQuery{
+                                db_.GetStop(request.at("from"s).AsString()),
+                                time,
+                                request.count("render"s) && request.at("render"s).AsBool()
+                        };
+                        break;
+                    }
+                    case StatRequestType::SegmentTime:
+                        result.back().data = SegmentQuery{
+                                db_.GetBus(request.at("bus"s).AsString()),
+                                {
+                                        db_.GetStop(request.at("from"s).AsString()),
+                                        db_.GetStop(request.at("to"s).AsString())
+                                }
+                        };
                         break;
                 }
             }
@@ -202,6 +385,41 @@ namespace transcat::query {
 
             routing_settings_.bus_wait_time = routing_settings.at("bus_wait_time"s).AsInt();
             routing_settings_.bus_velocity = routing_settings.at("bus_velocity"s).AsDouble();
+            if (routing_settings.count("walk_velocity"s)) {
+                routing_settings_.walk_velocity = routing_settings.at("walk_velocity"s).AsDouble();
+            }
+            if (routing_settings.count("max_walk_distance"s)) {
+                routing_settings_.max_walk_distance = routing_settings.at("max_walk_distance"s).AsDouble();
+            }
+            if (routing_settings.count("routing_engine"s)) {
+                const std::string &engine = routing_settings.at("routing_engine"s).AsString();
+                if (engine == "all_pairs"s) {
+                    routing_settings_.engine = RoutingEngine::AllPairs;
+                } else if (engine == "out_of_core"s) {
+                    routing_settings_.engine = RoutingEngine::OutOfCore;
+                } else if (engine == "on_demand"s) {
+                    routing_settings_.engine = RoutingEngine::OnDemand;
+                } else {
+                    throw std::invalid_argument("Unknown routing engine: "s + engine);
+                }
+            }
+            if (routing_settings.count("route_graph"s)) {
+                const std::string &model = routing_settings.at("route_graph"s).AsString();
+                if (model == "stop_pairs"s) {
+                    routing_settings_.graph_model = RouteGraphModel::StopPairs;
+                } else if (model == "route_stops"s) {
+                    // таблица всех пар по вершинам остановок маршрутов теряет смысл линейного графа:
+                    // без явно заданного движка маршруты ищутся по запросу, другой движок - ошибка
+                    if (routing_settings.count("routing_engine"s)
+                        && routing_settings_.engine != RoutingEngine::OnDemand) {
+                        throw std::invalid_argument("route_graph route_stops requires routing_engine on_demand"s);
+                    }
+                    routing_settings_.graph_model = RouteGraphModel::RouteStops;
+                    routing_settings_.engine = RoutingEngine::OnDemand;
+                } else {
+                    throw std::invalid_argument("Unknown route graph: "s + model);
+                }
+            }
         }
     }
 
@@ -214,6 +432,15 @@ namespace transcat::query {
         return {};
     }
 
+    SerializationSettings JsonReader::ParsePatchSettings(const json::Document &document) {
+        json::Dict data = document.GetRoot().AsDict();
+        if (data.count("patch_settings"s)) {
+            json::Dict patch_settings = data.at("patch_settings"s).AsDict();
+            return {patch_settings.at("file"s).AsString()};
+        }
+        return ParseSerializationSettings(document);
+    }
+
     void JsonReader::UpdateDistances(const std::unordered_map<StopPtr, json::Dict> &distances) const {
         for (const auto&[from, distances_to]: distances) {
             for (const auto&[stop_name, distance]: distances_to) {
@@ -263,8 +490,21 @@ namespace transcat::query {
                     unique_stops.size(),
                     is_roundtrip,
                     start_stop,
-                    end_stop
+                    end_stop,
+                    std::nullopt,   // schedule
+                    {}              // route_distances
             };
+            if (request.count("schedule"s)) {
+                const json::Dict &schedule = request.at("schedule"s).AsDict();
+                bus.schedule = Schedule{
+                        schedule.at("first_departure"s).AsDouble(),
+                        schedule.at("last_departure"s).AsDouble(),
+                        schedule.at("interval"s).AsDouble()
+                };
+                if (!bus.schedule->IsValid()) {
+                    throw std::invalid_argument("Invalid schedule of bus "s + request.at("name"s).AsString());
+                }
+            }
             db_.AddBus(bus);
         }
     }
@@ -284,6 +524,55 @@ namespace transcat::query {
         }
     }
 
+    geo::Box JsonReader::ParseBox(const json::Dict &box) {
+        return {
+                box.at("min_lat"s).AsDouble(),
+                box.at("min_lon"s).AsDouble(),
+                box.at("max_lat"s).AsDouble(),
+                box.at("max_lon"s).AsDouble()
+        };
+    }
+
+    void JsonReader::WriteRequestInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                      json::Array &responses, const StatRequest &request) const {
+        if (!request.error.empty()) {
+            responses.push_back(json::Builder().StartDict()
+                                        .Key("request_id"s).Value(request.id)
+                                        .Key("error_message"s).Value(request.error)
+                                        .EndDict().Build());
+            return;
+        }
+        switch (request.type) {
+            case StatRequestType::Bus:
+                WriteBusInfo(handler, responses, request);
+                break;
+            case StatRequestType::Stop:
+                WriteStopInfo(handler, responses, request);
+                break;
+            case StatRequestType::Map:
+                WriteMapInfo(handler, responses, request);
+                break;
+            case StatRequestType::Route:
+                WriteRouteInfo(handler, router, responses, request);
+                break;
+            case StatRequestType::NearestStops:
+                WriteNearestStopsInfo(handler, responses, request);
+                break;
+            case StatRequestType::StopsInArea:
+                WriteStopsInAreaInfo(handler, responses, request);
+                break;
+            case StatRequestType::Matrix:
+                WriteMatrixInfo(handler, router, responses, request);
+                break;
+            case StatRequestType::Isochrone:
+                WriteIsochroneInfo(handler, router, responses, request);
+                break;
+            case StatRequestType::SegmentTime:
+                WriteSegmentTimeInfo(handler, responses, request);
+                break;
+        }
+    }
+
     void
     JsonReader::WriteBusInfo(const RequestHandler &handler, json::Array &responses, const StatRequest &request) const {
         auto responce = json::Builder();
@@ -302,6 +591,23 @@ namespace transcat::query {
         responses.push_back(responce.Build());
     }
 
+    void JsonReader::WriteSegmentTimeInfo(const RequestHandler &handler, json::Array &responses,
+                                          const StatRequest &request) const {
+        const auto &query = std::get<SegmentQuery>(request.data);
+        auto responce = json::Builder();
+        responce.StartDict()
+                .Key("request_id"s).Value(request.id);
+        if (const auto stat = handler.GetSegmentStat(query.bus, query.stops)) {
+            responce.Key("route_length"s).Value(stat->route_length);
+            responce.Key("span_count"s).Value(stat->span_count);
+            responce.Key("time"s).Value(stat->time);
+        } else {
+            responce.Key("error_message"s).Value("not found"s);
+        }
+        responce.EndDict();
+        responses.push_back(responce.Build());
+    }
+
     void
     JsonReader::WriteStopInfo(const RequestHandler &handler, json::Array &responses, const StatRequest &request) const {
         auto responce = json::Builder();
@@ -312,10 +618,10 @@ namespace transcat::query {
         if (handler.IsStopExists(name)) {
             json::Array buses;
             if (handler.IsStopInRoutes(name)) {
-                auto buses_by_stop = handler.GetBusesByStop(name);
-                if (!buses_by_stop->empty()) {
-                    buses.reserve(buses_by_stop->size());
-                    for (const auto p_bus: *buses_by_stop) {
+                const auto buses_by_stop = handler.GetBusesByStop(name);
+                if (!buses_by_stop.empty()) {
+                    buses.reserve(buses_by_stop.size());
+                    for (const auto p_bus: buses_by_stop) {
                         buses.push_back(p_bus->name);
                     }
                 }
@@ -330,7 +636,14 @@ namespace transcat::query {
 
     void
     JsonReader::WriteMapInfo(const RequestHandler &handler, json::Array &responses, const StatRequest &request) const {
-        svg::Document doc = handler.RenderMap();
+        svg::Document doc;
+        if (std::holds_alternative<geo::Box>(request.data)) {
+            doc = handler.RenderMap(std::get<geo::Box>(request.data));
+        } else if (std::holds_alternative<renderer::Tile>(request.data)) {
+            doc = handler.RenderMap(std::get<renderer::Tile>(request.data));
+        } else {
+            doc = handler.RenderMap();
+        }
         std::stringstream map;
         doc.Render(map);
 
@@ -353,10 +666,30 @@ namespace transcat::query {
 
     void JsonReader::WriteRouteInfo(const RequestHandler &handler, const graph::Router<double> &router,
                                     json::Array &responses, const StatRequest &request) const {
+        if (std::holds_alternative<PointPair>(request.data)) {
+            WritePointRouteInfo(handler, router, responses, request);
+            return;
+        }
+        if (std::holds_alternative<TimedStopPair>(request.data)) {
+            WriteTimetableRouteInfo(handler, responses, request);
+            return;
+        }
+        if (std::holds_alternative<ParetoStopPair>(request.data)) {
+            WriteParetoRouteInfo(handler, responses, request);
+            return;
+        }
+        if (std::holds_alternative<AlternativesStopPair>(request.data)) {
+            WriteAlternativeRoutesInfo(handler, router, responses, request);
+            return;
+        }
         StopPair from_to = std::get<StopPair>(request.data);
-        auto opt_route_info = router.BuildRoute(handler.GetVertexForStop(from_to.from),
-                                                handler.GetVertexForStop(from_to.to));
+        WriteStopRouteInfo(handler, responses, request, router.BuildRoute(handler.GetVertexForStop(from_to.from),
+                                                                          handler.GetVertexForStop(from_to.to)));
+    }
 
+    void JsonReader::WriteStopRouteInfo(const RequestHandler &handler, json::Array &responses,
+                                        const StatRequest &request,
+                                        const std::optional<graph::Router<double>::RouteInfo> &opt_route_info) const {
         json::Dict resp;
         resp["request_id"] = request.id;
         if (opt_route_info) {
@@ -373,25 +706,444 @@ namespace transcat::query {
         responses.push_back(json::Builder().Value(resp).Build());
     }
 
+    JsonReader::PlannedRoutes JsonReader::PlanRoutes(const RequestHandler &handler,
+                                                     const graph::Router<double> &router,
+                                                     const std::vector<StatRequest> &requests) const {
+        std::map<graph::VertexId, std::vector<size_t>> groups;     // начальная вершина -> номера запросов
+        for (size_t index = 0; index < requests.size(); ++index) {
+            const auto &request = requests[index];
+            if (request.type != StatRequestType::Route || !std::holds_alternative<StopPair>(request.data)) {
+                continue;
+            }
+            const auto &from_to = std::get<StopPair>(request.data);
+            if (from_to.from && from_to.to) {
+                groups[handler.GetVertexForStop(from_to.from)].push_back(index);
+            }
+        }
+        std::vector<const std::pair<const graph::VertexId, std::vector<size_t>> *> shared_groups;
+        for (const auto &group: groups) {
+            if (group.second.size() > 1) {
+                shared_groups.push_back(&group);
+            }
+        }
+        PlannedRoutes planned_routes;
+        if (shared_groups.empty()) {
+            return planned_routes;
+        }
+
+        PROFILE_SCOPE("plan_routes");
+        PROFILE_COUNT("router.planned_groups", shared_groups.size());
+        std::vector<std::vector<std::optional<graph::Router<double>::RouteInfo>>> group_routes(shared_groups.size());
+        const size_t thread_count = std::min(route_planner_threads_, shared_groups.size());
+        std::atomic<size_t> next_group{0};
+        std::vector<std::exception_ptr> errors(thread_count);
+        auto worker = [&](size_t thread_index) {
+            try {
+                for (size_t i = next_group++; i < shared_groups.size(); i = next_group++) {
+                    // строка живет, пока из нее восстанавливаются маршруты группы
+                    const auto row = router.GetRoutesRow(shared_groups[i]->first);
+                    for (const size_t index: shared_groups[i]->second) {
+                        const StopPtr to = std::get<StopPair>(requests[index].data).to;
+                        group_routes[i].push_back(router.BuildRouteByRow(*row, handler.GetVertexForStop(to)));
+                    }
+                }
+            } catch (...) {
+                errors[thread_index] = std::current_exception();
+                next_group = shared_groups.size();  // остальные потоки не берут новых групп
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count - 1);
+        for (size_t i = 1; i < thread_count; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        for (const auto &error: errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+
+        for (size_t i = 0; i < shared_groups.size(); ++i) {
+            for (size_t j = 0; j < shared_groups[i]->second.size(); ++j) {
+                planned_routes.emplace(shared_groups[i]->second[j], std::move(group_routes[i][j]));
+            }
+        }
+        return planned_routes;
+    }
+
+    void JsonReader::WritePointRouteInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                         json::Array &responses, const StatRequest &request) const {
+        const auto &from_to = std::get<PointPair>(request.data);
+        const auto settings = handler.GetRoutingSettings();
+
+        // подход и отход пешком - дополнительные веса начальных и конечных вершин
+        const auto sources = handler.GetWalkTerminals(from_to.from);
+        const auto targets = handler.GetWalkTerminals(from_to.to);
+        auto route_info = router.BuildRoute(sources, targets);
+
+        // если точки рядом, можно дойти пешком без транспорта
+        std::optional<double> direct_walk_time;
+        const double direct_distance = geo::ComputeSafeDistance(from_to.from, from_to.to);
+        if (direct_distance <= settings.max_walk_distance) {
+            direct_walk_time = handler.GetWalkTime(direct_distance);
+        }
+
+        json::Dict resp;
+        resp["request_id"] = request.id;
+        if (direct_walk_time && (!route_info || *direct_walk_time <= route_info->weight)) {
+            resp["total_time"] = *direct_walk_time;
+            resp["items"] = json::Array{MakeWalkItem(nullptr, *direct_walk_time)};
+        } else if (route_info) {
+            json::Array items;
+            StopPtr from_stop = handler.GetStopForVertex(route_info->from);
+            StopPtr to_stop = handler.GetStopForVertex(route_info->to);
+            const auto walk_time = [&handler](const geo::Coordinates &point, StopPtr p_stop) {
+                return handler.GetWalkTime(geo::ComputeSafeDistance(point, {p_stop->latitude, p_stop->longitude}));
+            };
+
+            if (const double time = walk_time(from_to.from, from_stop); time > 0) {
+                items.push_back(MakeWalkItem(&from_stop->name, time));
+            }
+            if (!route_info->edges.empty()) {
+                MakeRouteItems(handler, {route_info->weight, route_info->edges}, items);
+            }
+            if (const double time = walk_time(from_to.to, to_stop); time > 0) {
+                items.push_back(MakeWalkItem(&to_stop->name, time));
+            }
+            resp["total_time"] = route_info->weight;
+            resp["items"] = items;
+        } else {
+            resp["error_message"] = "not found"s;
+        }
+
+        responses.push_back(json::Builder().Value(resp).Build());
+    }
+
+    void JsonReader::WriteMatrixInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                     json::Array &responses, const StatRequest &request) const {
+        const auto &query = std::get<MatrixQuery>(request.data);
+
+        // неизвестные остановки в поиск не попадают, их строки и столбцы - null
+        std::vector<graph::VertexId> sources;
+        std::vector<graph::VertexId> targets;
+        for (StopPtr p_stop: query.origins) {
+            if (p_stop) {
+                sources.push_back(handler.GetVertexForStop(p_stop));
+            }
+        }
+        for (StopPtr p_stop: query.destinations) {
+            if (p_stop) {
+                targets.push_back(handler.GetVertexForStop(p_stop));
+            }
+        }
+        const auto weights = router.BuildWeights(sources, targets, route_planner_threads_);
+
+        json::Array times;
+        size_t source = 0;
+        for (StopPtr p_origin: query.origins) {
+            json::Array row;
+            size_t target = 0;
+            for (StopPtr p_destination: query.destinations) {
+                if (p_origin && p_destination && weights[source][target]) {
+                    row.emplace_back(*weights[source][target]);
+                } else {
+                    row.emplace_back(nullptr);
+                }
+                target += p_destination ? 1 : 0;
+            }
+            source += p_origin ? 1 : 0;
+            times.push_back(std::move(row));
+        }
+        responses.push_back(json::Builder()
+                                    .StartDict()
+                                    .Key("request_id"s).Value(request.id)
+                                    .Key("times"s).Value(times)
+                                    .EndDict()
+                                    .Build());
+    }
+
+    void JsonReader::WriteIsochroneInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                        json::Array &responses, const StatRequest &request) const {
+        const auto &query = std::get<IsochroneQuery>(request.data);
+        json::Dict resp;
+        resp["request_id"] = request.id;
+        if (!query.from) {
+            resp["error_message"] = "not found"s;
+            responses.push_back(std::move(resp));
+            return;
+        }
+
+        std::vector<std::pair<StopPtr, double>> reachable;
+        json::Array stops;
+        for (const auto &[vertex, time]: router.BuildWeightsWithin(handler.GetVertexForStop(query.from), query.time)) {
+            if (!handler.IsStopVertex(vertex)) {
+                continue;   // вершина остановки маршрута (модель RouteStops)
+            }
+            StopPtr p_stop = handler.GetStopForVertex(vertex);
+            reachable.emplace_back(p_stop, time);
+            stops.push_back(json::Dict{{"stop_name"s, p_stop->name}, {"time"s, time}});
+        }
+        resp["stops"] = std::move(stops);
+        if (query.render) {
+            std::stringstream map;
+            handler.RenderMap(reachable, query.time).Render(map);
+            resp["map"] = map.str();
+        }
+        responses.push_back(std::move(resp));
+    }
+
+    void JsonReader::WriteNearestStopsInfo(const RequestHandler &handler, json::Array &responses,
+                                           const StatRequest &request) const {
+        const auto &query = std::get<NearestStopsQuery>(request.data);
+        json::Array stops;
+        for (const auto &[p_stop, distance]: handler.GetNearestStops(query.point, query.count)) {
+            stops.push_back(json::Builder()
+                                    .StartDict()
+                                    .Key("name"s).Value(p_stop->name)
+                                    .Key("distance"s).Value(distance)
+                                    .EndDict()
+                                    .Build());
+        }
+        responses.push_back(json::Builder()
+                                    .StartDict()
+                                    .Key("request_id"s).Value(request.id)
+                                    .Key("stops"s).Value(stops)
+                                    .EndDict()
+                                    .Build());
+    }
+
+    void JsonReader::WriteStopsInAreaInfo(const RequestHandler &handler, json::Array &responses,
+                                          const StatRequest &request) const {
+        json::Array stops;
+        for (StopPtr p_stop: handler.GetStopsInArea(std::get<geo::Box>(request.data))) {
+            stops.push_back(p_stop->name);
+        }
+        responses.push_back(json::Builder()
+                                    .StartDict()
+                                    .Key("request_id"s).Value(request.id)
+                                    .Key("stops"s).Value(stops)
+                                    .EndDict()
+                                    .Build());
+    }
+
     void JsonReader::MakeRouteItems(const RequestHandler &handler,
                                     const graph::Router<double>::RouteInfo &route_info, json::Array &items) const {
 
         auto settings = handler.GetRoutingSettings();
 
+        // поездка в модели RouteStops: посадка, перегоны одного автобуса и высадка сворачиваются в один Bus
+        int ride_span_count = 0;
+        double ride_time = 0;
         for (graph::EdgeId edge_id: route_info.edges) {
             auto edge = handler.GetRouteGraph().GetEdge(edge_id);
             //const Bus *p_bus = static_cast<const Bus *>(edge.p_bus);
             const Bus *p_bus = handler.GetBusByEdge(edge_id);
 
-            json::Dict item_wait = MakeWaitItem(handler.GetStopForVertex(edge.from)->name, settings.bus_wait_time);
-            items.push_back(std::move(item_wait));
+            if (handler.IsStopVertex(edge.from) && handler.IsStopVertex(edge.to)) {
+                json::Dict item_wait = MakeWaitItem(handler.GetStopForVertex(edge.from)->name, settings.bus_wait_time);
+                items.push_back(std::move(item_wait));
+
+                json::Dict item_bus = MakeBusItem(p_bus->name, edge.span_count, edge.weight - settings.bus_wait_time);
+                items.push_back(std::move(item_bus));
+            } else if (handler.IsStopVertex(edge.from)) {
+                items.push_back(MakeWaitItem(handler.GetStopForVertex(edge.from)->name, edge.weight));
+                ride_span_count = 0;
+                ride_time = 0;
+            } else if (handler.IsStopVertex(edge.to)) {
+                items.push_back(MakeBusItem(p_bus->name, ride_span_count, ride_time));
+            } else {
+                ride_span_count += edge.span_count;
+                ride_time += edge.weight;
+            }
+        }
+    }
+
+    void JsonReader::WriteTimetableRouteInfo(const RequestHandler &handler, json::Array &responses,
+                                             const StatRequest &request) const {
+        const auto &[from_to, departure_time] = std::get<TimedStopPair>(request.data);
+        const Timetable &timetable = db_.GetTimetable();
+
+        json::Dict resp;
+        resp["request_id"] = request.id;
+        std::optional<Timetable::Journey> journey;
+        if (from_to.from && from_to.to) {
+            journey = timetable.FindEarliestArrival(static_cast<uint32_t>(handler.GetVertexForStop(from_to.from)),
+                                                    static_cast<uint32_t>(handler.GetVertexForStop(from_to.to)),
+                                                    departure_time, db_.EvaluateVertexCount());
+        }
+        if (!journey) {
+            resp["error_message"] = "not found"s;
+            responses.push_back(std::move(resp));
+            return;
+        }
+
+        // ожидание - до отправления рейса, поездка - от посадки до высадки
+        json::Array items;
+        double time = journey->departure;
+        for (const auto &leg: journey->legs) {
+            const Connection &board = timetable.GetConnections()[leg.board];
+            const Connection &alight = timetable.GetConnections()[leg.alight];
+            items.push_back(MakeWaitItem(handler.GetStopForVertex(board.from)->name, board.departure - time));
+            items.push_back(MakeBusItem(timetable.GetTripBuses()[board.trip]->name,
+                                        static_cast<int>(alight.sequence - board.sequence) + 1,
+                                        alight.arrival - board.departure));
+            time = alight.arrival;
+        }
+        resp["total_time"] = journey->arrival - journey->departure;
+        resp["arrival_time"] = journey->arrival;
+        resp["items"] = std::move(items);
+        responses.push_back(std::move(resp));
+    }
+
+    void JsonReader::WriteAlternativeRoutesInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                                json::Array &responses, const StatRequest &request) const {
+        const auto &[from_to, count] = std::get<AlternativesStopPair>(request.data);
+
+        json::Dict resp;
+        resp["request_id"] = request.id;
+        std::vector<graph::Router<double>::RouteInfo> route_infos;
+        if (from_to.from && from_to.to) {
+            route_infos = router.BuildRoutes(handler.GetVertexForStop(from_to.from),
+                                             handler.GetVertexForStop(from_to.to), count);
+        }
+        if (route_infos.empty()) {
+            resp["error_message"] = "not found"s;
+            responses.push_back(std::move(resp));
+            return;
+        }
+
+        json::Array routes;
+        for (const auto &route_info: route_infos) {
+            json::Array items;
+            MakeRouteItems(handler, route_info, items);
+            routes.push_back(json::Dict{{"total_time"s, route_info.weight}, {"items"s, std::move(items)}});
+        }
+        resp["routes"] = std::move(routes);
+        responses.push_back(std::move(resp));
+    }
+
+    void JsonReader::WriteParetoRouteInfo(const RequestHandler &handler, json::Array &responses,
+                                          const StatRequest &request) const {
+        const auto &[from_to, max_transfers] = std::get<ParetoStopPair>(request.data);
 
-            json::Dict item_bus = MakeBusItem(p_bus->name, edge.span_count, edge.weight - settings.bus_wait_time);
-            items.push_back(std::move(item_bus));
+        json::Dict resp;
+        resp["request_id"] = request.id;
+        std::vector<ParetoRouter::Itinerary> itineraries;
+        if (from_to.from && from_to.to) {
+            itineraries = handler.GetParetoRouter().FindRoutes(from_to.from, from_to.to, max_transfers);
+        }
+        if (itineraries.empty()) {
+            resp["error_message"] = "not found"s;
+            responses.push_back(std::move(resp));
+            return;
+        }
+
+        const double wait_time = handler.GetRoutingSettings().bus_wait_time;
+        json::Array routes;
+        for (const auto &itinerary: itineraries) {
+            json::Array items;
+            for (const auto &leg: itinerary.legs) {
+                items.push_back(MakeWaitItem(leg.from->name, wait_time));
+                items.push_back(MakeBusItem(leg.bus->name, leg.span_count, leg.time));
+            }
+            routes.push_back(json::Dict{
+                    {"total_time"s, itinerary.total_time},
+                    {"transfers"s, static_cast<int>(itinerary.legs.empty() ? 0 : itinerary.legs.size() - 1)},
+                    {"items"s, std::move(items)}
+            });
+        }
+        resp["routes"] = std::move(routes);
+        responses.push_back(std::move(resp));
+    }
+
+    json::Dict JsonReader::DescribeRequest(const StatRequest &request) {
+        auto box_to_json = [](const geo::Box &box) {
+            return json::Dict{
+                    {"min_lat"s, box.min_lat}, {"min_lon"s, box.min_lng},
+                    {"max_lat"s, box.max_lat}, {"max_lon"s, box.max_lng}
+            };
+        };
+        auto point_to_json = [](geo::Coordinates point) {
+            return json::Dict{{"latitude"s, point.lat}, {"longitude"s, point.lng}};
+        };
+        auto stop_to_json = [](StopPtr p_stop) -> json::Node {
+            return p_stop ? json::Node{p_stop->name} : json::Node{nullptr};
+        };
+
+        json::Dict params;
+        if (const auto *name = std::get_if<std::string>(&request.data)) {
+            params["name"s] = *name;
+        } else if (const auto *stops = std::get_if<StopPair>(&request.data)) {
+            params["from"s] = stop_to_json(stops->from);
+            params["to"s] = stop_to_json(stops->to);
+        } else if (const auto *timed = std::get_if<TimedStopPair>(&request.data)) {
+            params["from"s] = stop_to_json(timed->stops.from);
+            params["to"s] = stop_to_json(timed->stops.to);
+            params["departure_time"s] = timed->departure_time;
+        } else if (const auto *pareto = std::get_if<ParetoStopPair>(&request.data)) {
+            params["from"s] = stop_to_json(pareto->stops.from);
+            params["to"s] = stop_to_json(pareto->stops.to);
+            params["pareto"s] = true;
+            params["max_transfers"s] = static_cast<int>(pareto->max_transfers);
+        } else if (const auto *points = std::get_if<PointPair>(&request.data)) {
+            params["from_point"s] = point_to_json(points->from);
+            params["to_point"s] = point_to_json(points->to);
+        } else if (const auto *box = std::get_if<geo::Box>(&request.data)) {
+            params["bbox"s] = box_to_json(*box);
+        } else if (const auto *tile = std::get_if<renderer::Tile>(&request.data)) {
+            params["tile"s] = json::Dict{{"z"s, tile->z}, {"x"s, tile->x}, {"y"s, tile->y}};
+        } else if (const auto *query = std::get_if<NearestStopsQuery>(&request.data)) {
+            params = point_to_json(query->point);
+            params["count"s] = static_cast<int>(query->count);
+        } else if (const auto *alternatives = std::get_if<AlternativesStopPair>(&request.data)) {
+            params["from"s] = stop_to_json(alternatives->stops.from);
+            params["to"s] = stop_to_json(alternatives->stops.to);
+            params["alternatives"s] = static_cast<int>(alternatives->count);
+        } else if (const auto *isochrone = std::get_if<IsochroneQuery>(&request.data)) {
+            params["from"s] = stop_to_json(isochrone->from);
+            params["time"s] = isochrone->time;
+            params["render"s] = isochrone->render;
+        } else if (const auto *segment = std::get_if<SegmentQuery>(&request.data)) {
+            params["bus"s] = segment->bus ? json::Node{segment->bus->name} : json::Node{nullptr};
+            params["from"s] = stop_to_json(segment->stops.from);
+            params["to"s] = stop_to_json(segment->stops.to);
+        } else if (const auto *matrix = std::get_if<MatrixQuery>(&request.data)) {
+            json::Array origins;
+            json::Array destinations;
+            for (StopPtr p_stop: matrix->origins) {
+                origins.push_back(stop_to_json(p_stop));
+            }
+            for (StopPtr p_stop: matrix->destinations) {
+                destinations.push_back(stop_to_json(p_stop));
+            }
+            params["origins"s] = std::move(origins);
+            params["destinations"s] = std::move(destinations);
         }
+        return params;
     }
 
-    json::Dict JsonReader::MakeWaitItem(const std::string &stop_name, int wait_time) const {
+    void JsonReader::LogSlowRequest(const StatRequest &request, std::chrono::nanoseconds duration) const {
+        std::ostringstream record;
+        json::Print(json::Document{json::Dict{
+                {"id"s, request.id},
+                {"type"s, std::string(StatRequestTypeToString(request.type))},
+                {"params"s, DescribeRequest(request)},
+                {"duration_ms"s, static_cast<double>(duration.count()) / 1e6}
+        }}, record);
+        record << '\n';
+
+        // журнал общий для всех обработчиков (и снимков базы), запросы которых идут параллельно,
+        // поэтому запись собирается заранее и выводится целиком под блокировкой
+        static std::mutex log_mutex;
+        const std::lock_guard lock(log_mutex);
+        *slow_request_log_.out << record.str() << std::flush;
+    }
+
+    json::Dict JsonReader::MakeWaitItem(std::string_view stop_name, double wait_time) const {
         json::Dict item_wait;
         item_wait["type"] = "Wait"s;
         item_wait["stop_name"] = stop_name;
@@ -399,7 +1151,17 @@ namespace transcat::query {
         return item_wait;
     }
 
-    json::Dict JsonReader::MakeBusItem(const std::string &bus_name, int span_count, double time) const {
+    json::Dict JsonReader::MakeWalkItem(const std::string_view *stop_name, double time) const {
+        json::Dict item_walk;
+        item_walk["type"] = "Walk"s;
+        if (stop_name) {
+            item_walk["stop_name"] = *stop_name;
+        }
+        item_walk["time"] = time;
+        return item_walk;
+    }
+
+    json::Dict JsonReader::MakeBusItem(std::string_view bus_name, int span_count, double time) const {
         json::Dict item_bus;
         item_bus["type"] = "Bus"s;
         item_bus["bus"] = bus_name;
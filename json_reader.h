@@ -1,6 +1,9 @@
 #pragma once
 
+#include <chrono>
 #include <iostream>
+#include <string_view>
+#include <unordered_map>
 #include <variant>
 
 #include "transport_catalogue.h"
@@ -15,21 +18,92 @@ namespace transcat::query {
         Bus,
         Stop,
         Map,
-        Route
+        Route,
+        NearestStops,
+        StopsInArea,
+        Matrix,
+        Isochrone,
+        SegmentTime
     };
 
     StatRequestType StatRequestTypeFromString(const std::string &type_name);
 
+    std::string_view StatRequestTypeToString(StatRequestType type);
+
+    // Параметры запроса NearestStops
+    struct NearestStopsQuery {
+        geo::Coordinates point;
+        size_t count = 0;
+    };
+
+    // Маршрут между произвольными точками (запрос Route с from_point / to_point)
+    struct PointPair {
+        geo::Coordinates from;
+        geo::Coordinates to;
+    };
+
+    // Маршрут по расписанию (запрос Route с departure_time, в минутах от начала суток)
+    struct TimedStopPair {
+        StopPair stops;
+        double departure_time = 0;
+    };
+
+    // Маршруты, оптимальные по времени и числу пересадок (запрос Route с "pareto": true)
+    struct ParetoStopPair {
+        static constexpr int MAX_TRANSFERS = 16;    // большее значение запроса урезается до этого
+
+        StopPair stops;
+        size_t max_transfers = 3;
+    };
+
+    // Несколько альтернативных маршрутов (запрос Route с "alternatives": count)
+    struct AlternativesStopPair {
+        static constexpr int MAX_COUNT = 16;        // большее значение запроса урезается до этого
+
+        StopPair stops;
+        size_t count = 1;
+    };
+
+    // Таблица времени в пути между остановками (запрос Matrix)
+    struct MatrixQuery {
+        std::vector<StopPtr> origins;
+        std::vector<StopPtr> destinations;
+    };
+
+    // Остановки, достижимые из from за time минут (запрос Isochrone); render - добавить карту в ответ
+    struct IsochroneQuery {
+        StopPtr from = nullptr;
+        double time = 0;
+        bool render = false;
+    };
+
+    // Поездка на автобусе bus между остановками его маршрута (запрос SegmentTime)
+    struct SegmentQuery {
+        const Bus *bus = nullptr;
+        StopPair stops;
+    };
+
     struct StatRequest {
         int id = 0;
         StatRequestType type;
-        std::variant<std::nullopt_t, std::string, StopPair> data;
+        std::variant<std::nullopt_t, std::string, StopPair, geo::Box, renderer::Tile, NearestStopsQuery,
+                     PointPair, TimedStopPair, ParetoStopPair, MatrixQuery,
+                     IsochroneQuery, AlternativesStopPair, SegmentQuery> data;
+        std::string error;      // непустая - запрос некорректен, в ответе будет error_message
     };
 
     struct SerializationSettings {
         std::string file;
     };
 
+    // Журнал медленных запросов: запрос, обработка которого заняла не меньше threshold,
+    // записывается в out (id, тип, параметры, длительность). Записи из параллельных WriteInfo
+    // не перемешиваются
+    struct SlowRequestLog {
+        std::ostream *out = nullptr;
+        std::chrono::nanoseconds threshold{0};
+    };
+
     class JsonReader {
     public:
         JsonReader(TransportCatalogue &db, renderer::MapRenderer &renderer);
@@ -40,14 +114,28 @@ namespace transcat::query {
                        graph::DirectedWeightedGraph<double> route_graph,
                        graph::Router<double>::RoutesInternalData routes_internal_data) const;
 
+        // То же с готовыми обработчиком и маршрутизатором (например, из снимка базы)
+        void WriteInfo(std::ostream &out, const std::vector<query::StatRequest> &requests,
+                       const RequestHandler &handler, const graph::Router<double> &router) const;
+
         [[nodiscard]] std::vector<StatRequest> ParseStatRequests(const json::Document &document) const;
 
         static SerializationSettings ParseSerializationSettings(const json::Document &document);
 
+        // Файл, в который patch_base сохраняет измененную базу (по умолчанию - исходный файл)
+        static SerializationSettings ParsePatchSettings(const json::Document &document);
+
         [[nodiscard]] const RoutingSettings &GetRoutingSettings() const;
 
         void SetRoutingSettings(const RoutingSettings &settings);
 
+        void SetSlowRequestLog(SlowRequestLog log);
+
+        // Потоки, которыми ищутся маршруты групп запросов Route (PlanRoutes). По умолчанию - один:
+        // WriteInfo может выполняться параллельно для разных документов, и потоки каждого вызова
+        // умножались бы на число вызовов
+        void SetRoutePlannerThreads(size_t count);
+
     private:
         void ParseBaseRequests(const json::Document &document) const;
 
@@ -59,8 +147,13 @@ namespace transcat::query {
 
         [[nodiscard]] svg::Color ParseColor(const json::Node &color) const;
 
+        static geo::Box ParseBox(const json::Dict &box);
+
         void ParseRoutingSettings(const json::Document &document);
 
+        void WriteRequestInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                              json::Array &responses, const StatRequest &request) const;
+
         void WriteBusInfo(const RequestHandler &handler, json::Array &responses, const StatRequest &request) const;
 
         void WriteStopInfo(const RequestHandler &handler, json::Array &responses, const StatRequest &request) const;
@@ -70,23 +163,76 @@ namespace transcat::query {
         void WriteRouteInfo(const RequestHandler &handler, const graph::Router<double> &router, json::Array &responses,
                             const StatRequest &request) const;
 
+        // Ответ на запрос Route между остановками по уже найденному маршруту
+        void WriteStopRouteInfo(const RequestHandler &handler, json::Array &responses, const StatRequest &request,
+                                const std::optional<graph::Router<double>::RouteInfo> &route_info) const;
+
+        // Маршруты запросов Route из одной остановки (номер запроса -> маршрут)
+        using PlannedRoutes = std::unordered_map<size_t, std::optional<graph::Router<double>::RouteInfo>>;
+
+        // Запросы Route между остановками группируются по начальной остановке: на группу из нескольких
+        // запросов - одна строка маршрутов (поиск Дейкстры по всему графу или строка таблицы), группы -
+        // параллельно. Одиночные запросы остаются встречному поиску или A*, которые дешевле полного дерева.
+        // С таблицей маршрутов ответ не зависит от группировки. При поиске по запросу (on_demand) время
+        // маршрута то же, но из нескольких равных по времени маршрутов дерево Дейкстры и встречный поиск
+        // могут выбрать разные - состав items запроса тогда зависит от того, попал ли он в группу.
+        // Исключение поиска в любом потоке передается вызывающему после завершения остальных
+        [[nodiscard]] PlannedRoutes PlanRoutes(const RequestHandler &handler, const graph::Router<double> &router,
+                                               const std::vector<StatRequest> &requests) const;
+
+        void WritePointRouteInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                 json::Array &responses, const StatRequest &request) const;
+
+        void WriteTimetableRouteInfo(const RequestHandler &handler, json::Array &responses,
+                                     const StatRequest &request) const;
+
+        void WriteAlternativeRoutesInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                        json::Array &responses, const StatRequest &request) const;
+
+        void WriteParetoRouteInfo(const RequestHandler &handler, json::Array &responses,
+                                  const StatRequest &request) const;
+
+        void WriteMatrixInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                             json::Array &responses, const StatRequest &request) const;
+
+        void WriteIsochroneInfo(const RequestHandler &handler, const graph::Router<double> &router,
+                                json::Array &responses, const StatRequest &request) const;
+
+        void WriteSegmentTimeInfo(const RequestHandler &handler, json::Array &responses,
+                                  const StatRequest &request) const;
+
+        void WriteNearestStopsInfo(const RequestHandler &handler, json::Array &responses,
+                                   const StatRequest &request) const;
+
+        void WriteStopsInAreaInfo(const RequestHandler &handler, json::Array &responses,
+                                  const StatRequest &request) const;
+
         struct BusItem {
             std::string name;
             int span_count = 0;
             double weight = 0;
         };
 
-        [[nodiscard]] json::Dict MakeBusItem(const std::string &bus_name, int span_count, double time) const;
+        [[nodiscard]] json::Dict MakeBusItem(std::string_view bus_name, int span_count, double time) const;
+
+        [[nodiscard]] json::Dict MakeWaitItem(std::string_view stop_name, double wait_time) const;
 
-        [[nodiscard]] json::Dict MakeWaitItem(const std::string &stop_name, int wait_time) const;
+        [[nodiscard]] json::Dict MakeWalkItem(const std::string_view *stop_name, double time) const;
 
         void MakeRouteItems(const RequestHandler &handler, const graph::Router<double>::RouteInfo &route_info,
                             json::Array &items) const;
 
+        // Параметры запроса для журнала медленных запросов
+        [[nodiscard]] static json::Dict DescribeRequest(const StatRequest &request);
+
+        void LogSlowRequest(const StatRequest &request, std::chrono::nanoseconds duration) const;
+
     private:
         TransportCatalogue &db_;
         renderer::MapRenderer &renderer_;
         RoutingSettings routing_settings_;
+        SlowRequestLog slow_request_log_;
+        size_t route_planner_threads_ = 1;
     };
 
 } // namespace transcat::query
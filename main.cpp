@@ -1,60 +1,144 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <cmath>
+#include <cstdlib>
+#include <optional>
+#include <stdexcept>
 #include <string_view>
+#include <thread>
 
 #include "transport_catalogue.h"
 #include "json_reader.h"
 #include "serialization.h"
+#include "base_patcher.h"
+#include "snapshot.h"
+#include "base_estimate.h"
+#include "profile.h"
 
 using namespace std::literals;
 using namespace transcat;
 
 void PrintUsage(std::ostream &stream = std::cerr) {
-    stream << "Usage: transport_catalogue [make_base|process_requests]\n"sv;
+    stream << "Usage: transport_catalogue [make_base|process_requests|patch_base] [options]\n"sv
+           << "  --stats                  print timers, counters and request latencies as JSON to stderr on exit\n"sv
+           << "  --slow-log=FILE          log stat requests slower than the threshold to FILE (- for stderr)\n"sv
+           << "  --slow-threshold-ms=N    slow request threshold, 100 ms by default\n"sv
+           << "  --dry-run                make_base: print graph size, peak memory and base size estimates and exit\n"sv
+           << "  --memory-budget-mb=N     make_base: switch to out_of_core or on_demand routing, or refuse to start above N MB\n"sv;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        PrintUsage();
-        return 1;
+// Неотрицательное число во всю строку; nullopt - строка не число или число отрицательное
+std::optional<double> ParseNonNegative(std::string_view text) {
+    const std::string str(text);
+    char *end = nullptr;
+    const double value = std::strtod(str.c_str(), &end);
+    if (str.empty() || end != str.c_str() + str.size() || !std::isfinite(value) || value < 0) {
+        return std::nullopt;
     }
+    return value;
+}
 
-    json::Document doc = json::Load(std::cin);
+struct Options {
+    bool print_stats = false;
+    std::string slow_log;
+    double slow_threshold_ms = 100;
+    bool dry_run = false;
+    std::optional<double> memory_budget_mb;
+};
+
+int Run(std::string_view mode, const Options &options) {
+    PROFILE_SCOPE(mode);
+
+    json::Document doc = [] {
+        PROFILE_SCOPE("json_load");
+        return json::Load(std::cin);
+    }();
     query::SerializationSettings settings = query::JsonReader::ParseSerializationSettings(doc);
 
     TransportCatalogue db;
     renderer::MapRenderer renderer;
 
-    const std::string_view mode(argv[1]);
-
     if (mode == "make_base"sv) {
 
         // Заполним БД
         query::JsonReader json_reader(db, renderer);
         json_reader.ReadData(doc);
 
-        // Построим граф маршрутов
-        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
-        graph::Router<double> router(handler.GetRouteGraph());
+        // Оценим граф и память до построения: таблица всех пар растет как V^2
+        RoutingSettings routing_settings = json_reader.GetRoutingSettings();
+        const BaseEstimate estimate = EstimateBase(db, routing_settings);
+        if (options.dry_run) {
+            WriteEstimate(std::cout, estimate);
+            return 0;
+        }
+        if (options.memory_budget_mb) {
+            const auto memory_budget = static_cast<size_t>(*options.memory_budget_mb * 1024 * 1024);
+            const auto engine = ChooseEngine(estimate, routing_settings.engine, memory_budget);
+            if (!engine) {
+                std::cerr << "make_base needs about "sv << estimate.on_demand.peak_memory / (1024 * 1024)
+                          << " MB, which exceeds the memory budget\n"sv;
+                return 1;
+            }
+            if (*engine != routing_settings.engine) {
+                std::cerr << "routing needs about "sv << estimate.For(routing_settings.engine).peak_memory / (1024 * 1024)
+                          << " MB, which exceeds the memory budget; using "sv
+                          << (*engine == RoutingEngine::OutOfCore ? "out_of_core"sv : "on_demand"sv) << '\n';
+                routing_settings.engine = *engine;
+            }
+        }
+
+        // Построим граф маршрутов и, если маршруты не ищутся по запросу, таблицу всех пар
+        RequestHandler handler{db, renderer, routing_settings, db.EvaluateVertexCount()};
+        graph::Router<double> router = routing_settings.engine == RoutingEngine::AllPairs
+                                       ? graph::Router<double>(handler.GetRouteGraph())
+                                       : graph::Router<double>(handler.GetRouteGraph(), {});
 
         // Сереализуем
-        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+        CatalogueSerializer serializer{db, renderer.GetSettings(), routing_settings,
                                        handler.GetRouteGraph(), router.GetRoutesInternalData()};
         serializer.SerializeTo(settings.file);
 
     } else if (mode == "process_requests"sv) {
 
-        // Десериализуем
-        CatalogueDeserializer deserializer{db};
-        deserializer.DeserializeFrom(settings.file);
-        renderer.UseSettings(deserializer.GetRenderSettings());
+        // журнал медленных запросов пишется отдельно от ответа
+        std::ofstream slow_log_file;
+        query::SlowRequestLog slow_log;
+        if (!options.slow_log.empty()) {
+            slow_log.out = &std::cerr;
+            if (options.slow_log != "-"s) {
+                slow_log_file.open(options.slow_log, std::ios::app);
+                if (!slow_log_file) {
+                    std::cerr << "cannot open slow log file "sv << options.slow_log << '\n';
+                    return 1;
+                }
+                slow_log.out = &slow_log_file;
+            }
+            slow_log.threshold = std::chrono::nanoseconds(static_cast<int64_t>(options.slow_threshold_ms * 1e6));
+        }
+
+        // Загрузим базу и обработаем запросы: документ один, так что группы маршрутов ищутся всеми ядрами
+        const auto snapshot = CatalogueSnapshot::Load(settings.file, slow_log,
+                                                      std::max(1u, std::thread::hardware_concurrency()));
+        snapshot->ProcessRequests(doc, std::cout);
+
+    } else if (mode == "patch_base"sv) {
+
+        // Загрузим исходную базу и применим изменения; некорректные изменения (неизвестная остановка,
+        // автобус через удаленную остановку) - ошибка, база не перезаписывается
+        BasePatcher patcher{db, renderer};
+        patcher.LoadBase(settings.file);
+        try {
+            patcher.Apply(doc);
+        } catch (const std::logic_error &e) {   // в том числе std::invalid_argument
+            std::cerr << "patch_base: "sv << e.what() << '\n';
+            return 1;
+        }
 
-        // Обработка запросов
-        query::JsonReader json_reader(db, renderer);
-        json_reader.SetRoutingSettings(deserializer.GetRoutingSettings());
-        auto stat_requests = json_reader.ParseStatRequests(doc);
-        json_reader.WriteInfo(std::cout, stat_requests, deserializer.GetRouteGraph(),
-                              deserializer.GetRoutesInternalData());
+        // Сереализуем
+        CatalogueSerializer serializer{db, renderer.GetSettings(), patcher.GetRoutingSettings(),
+                                       patcher.GetRouteGraph(), patcher.GetRoutesInternalData()};
+        serializer.SerializeTo(query::JsonReader::ParsePatchSettings(doc).file);
 
     } else {
         PrintUsage();
@@ -63,3 +147,46 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        PrintUsage();
+        return 1;
+    }
+
+    const std::string_view mode(argv[1]);
+    Options options;
+    for (int i = 2; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg == "--stats"sv) {
+            options.print_stats = true;
+        } else if (arg.substr(0, "--slow-log="sv.size()) == "--slow-log="sv) {
+            options.slow_log = std::string(arg.substr("--slow-log="sv.size()));
+        } else if (arg.substr(0, "--slow-threshold-ms="sv.size()) == "--slow-threshold-ms="sv) {
+            const auto threshold = ParseNonNegative(arg.substr("--slow-threshold-ms="sv.size()));
+            if (!threshold) {
+                PrintUsage();
+                return 1;
+            }
+            options.slow_threshold_ms = *threshold;
+        } else if (arg == "--dry-run"sv) {
+            options.dry_run = true;
+        } else if (arg.substr(0, "--memory-budget-mb="sv.size()) == "--memory-budget-mb="sv) {
+            options.memory_budget_mb = ParseNonNegative(arg.substr("--memory-budget-mb="sv.size()));
+            if (!options.memory_budget_mb) {
+                PrintUsage();
+                return 1;
+            }
+        } else {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    profile::SetEnabled(options.print_stats);
+    const int result = Run(mode, options);
+    if (options.print_stats) {
+        profile::WriteStats(std::cerr);
+    }
+    return result;
+}
@@ -1,10 +1,101 @@
 #include <sstream>
 #include <algorithm>
+#include <cmath>
 
 #include "map_renderer.h"
 
 namespace transcat::renderer {
 
+    bool IsZero(double value) {
+        return std::abs(value) < std::numeric_limits<double>::epsilon();
+    }
+
+    bool Tile::IsValid() const noexcept {
+        if (z < 0 || z > MAX_ZOOM) {
+            return false;
+        }
+        const int64_t tiles_per_side = int64_t{1} << z;
+        return x >= 0 && x < tiles_per_side && y >= 0 && y < tiles_per_side;
+    }
+
+    ///////////////////////// MapIndex /////////////////////////////////
+
+    MapIndex::MapIndex(std::vector<StopPtr> stops, std::vector<const Bus *> buses)
+            : stops_(std::move(stops)), buses_(std::move(buses)) {
+
+        if (!stops_.empty()) {
+            bounds_ = {stops_.front()->latitude, stops_.front()->longitude,
+                       stops_.front()->latitude, stops_.front()->longitude};
+        }
+        for (StopPtr p_stop: stops_) {
+            bounds_.Extend({p_stop->latitude, p_stop->longitude});
+        }
+
+        stops_index_ = geo::GridIndex(bounds_, stops_.size());
+        for (uint32_t id = 0; id < stops_.size(); ++id) {
+            const geo::Coordinates point{stops_[id]->latitude, stops_[id]->longitude};
+            stops_index_.Add(id, geo::Box::Of(point, point));
+        }
+        stops_index_.Build();
+
+        // цвета назначаются так же, как при отрисовке всей карты - пропуская пустые маршруты
+        int bus_counter = -1;
+        bus_colors_.reserve(buses_.size());
+        for (const Bus *p_bus: buses_) {
+            bus_colors_.push_back(p_bus->route.empty() ? bus_counter : ++bus_counter);
+        }
+
+        for (uint32_t bus = 0; bus < buses_.size(); ++bus) {
+            for (StopPtr p_stop: buses_[bus]->route) {
+                points_.push_back(p_stop);
+                point_bus_.push_back(bus);
+            }
+        }
+
+        segments_index_ = geo::GridIndex(bounds_, points_.size());
+        for (uint32_t point = 0; point + 1 < points_.size(); ++point) {
+            if (point_bus_[point] == point_bus_[point + 1]) {
+                segments_index_.Add(point, geo::Box::Of({points_[point]->latitude, points_[point]->longitude},
+                                                        {points_[point + 1]->latitude, points_[point + 1]->longitude}));
+            }
+        }
+        segments_index_.Build();
+    }
+
+    const std::vector<StopPtr> &MapIndex::GetStops() const noexcept {
+        return stops_;
+    }
+
+    const std::vector<const Bus *> &MapIndex::GetBuses() const noexcept {
+        return buses_;
+    }
+
+    const geo::Box &MapIndex::GetBounds() const noexcept {
+        return bounds_;
+    }
+
+    std::vector<uint32_t> MapIndex::QueryStops(const geo::Box &area) const {
+        return stops_index_.Query(area);
+    }
+
+    std::vector<uint32_t> MapIndex::QuerySegments(const geo::Box &area) const {
+        return segments_index_.Query(area);
+    }
+
+    StopPtr MapIndex::GetPoint(uint32_t point) const {
+        return points_.at(point);
+    }
+
+    uint32_t MapIndex::GetPointBus(uint32_t point) const {
+        return point_bus_.at(point);
+    }
+
+    int MapIndex::GetBusColorIndex(uint32_t bus) const {
+        return bus_colors_.at(bus);
+    }
+
+    ///////////////////////// MapRenderer /////////////////////////////////
+
     void MapRenderer::UseSettings(RenderSettings settings) {
         settings_ = std::move(settings);
     }
@@ -16,49 +107,164 @@ namespace transcat::renderer {
     svg::Document MapRenderer::Render(const std::vector<StopPtr> &stops, const std::vector<const Bus *> &buses) const {
 
         // Расчет размеров карты и коэффициента масштабирования
-        InitMap(stops);
+        return RenderLayers(MakeProjection(stops), stops, buses);
+    }
 
+    svg::Document MapRenderer::Render(const std::vector<StopPtr> &stops, const std::vector<const Bus *> &buses,
+                                      const geo::Box &bounds) const {
+        // размеры карты известны заранее - просмотр остановок не нужен
+        return RenderLayers(MakeProjection(bounds), stops, buses);
+    }
+
+    svg::Document MapRenderer::Render(const std::vector<StopPtr> &stops, const std::vector<const Bus *> &buses,
+                                      const geo::Box &bounds,
+                                      const std::vector<std::pair<StopPtr, double>> &reachable,
+                                      double budget) const {
+        const Projection projection = MakeProjection(bounds);
+        svg::Document doc = RenderLayers(projection, stops, buses);
+        // дальние остановки рисуются первыми, чтобы ближние были видны поверх
+        for (auto it = reachable.rbegin(); it != reachable.rend(); ++it) {
+            const double ratio = budget > 0 ? std::clamp(it->second / budget, 0., 1.) : 0.;
+            svg::Circle circle;
+            circle.SetCenter(GetPoint(projection, it->first->longitude, it->first->latitude));
+            circle.SetRadius(settings_.stop_radius * 2);
+            circle.SetFillColor(svg::Rgba{static_cast<uint8_t>(255 * ratio), static_cast<uint8_t>(255 * (1 - ratio)),
+                                          0, 0.6});
+            doc.Add(circle);
+        }
+        return doc;
+    }
+
+    svg::Document MapRenderer::RenderLayers(const Projection &projection, const std::vector<StopPtr> &stops,
+                                            const std::vector<const Bus *> &buses) const {
         svg::Document doc;
 
         auto palette = settings_.color_palette;
 
         // отрисовка линий маршрутов
-        RenderRoutes(buses, doc, palette);
+        RenderRoutes(projection, buses, doc, palette);
 
         // отрисовка названий маршрутов
-        RenderRoutesName(buses, doc, palette);
+        RenderRoutesName(projection, buses, doc, palette);
 
         // отрисовка остановок
-        RenderStops(stops, doc);
+        RenderStops(projection, stops, doc);
 
         // отрисовка названий остановок
-        RenderStopsName(stops, doc);
+        RenderStopsName(projection, stops, doc);
+
+        return doc;
+    }
+
+    svg::Document MapRenderer::Render(const MapIndex &index, const geo::Box &area) const {
+        return RenderArea(MakeProjection(area), index, area);
+    }
+
+    svg::Document MapRenderer::Render(const MapIndex &index, Tile tile) const {
+        // проекция полной карты, из которой вырезается и увеличивается тайл
+        Projection projection = MakeProjection(index.GetBounds());
+        const double tiles_per_side = std::pow(2., tile.z);
+        const double tile_width = settings_.width / tiles_per_side;
+        const double tile_height = settings_.height / tiles_per_side;
+        projection.tile_scale = tiles_per_side;
+        projection.tile_offset = {tile.x * tile_width, tile.y * tile_height};
+
+        geo::Box area = index.GetBounds();
+        if (!IsZero(projection.zoom_coef)) {
+            const double zoom_coef = projection.zoom_coef;
+            const svg::Point offset = projection.tile_offset;
+            area.min_lng = projection.min_lon + (offset.x - settings_.padding) / zoom_coef;
+            area.max_lng = projection.min_lon + (offset.x + tile_width - settings_.padding) / zoom_coef;
+            area.max_lat = projection.max_lat - (offset.y - settings_.padding) / zoom_coef;
+            area.min_lat = projection.max_lat - (offset.y + tile_height - settings_.padding) / zoom_coef;
+        }
+        return RenderArea(projection, index, area);
+    }
+
+    svg::Document MapRenderer::RenderArea(const Projection &projection, const MapIndex &index,
+                                          const geo::Box &area) const {
+        svg::Document doc;
+        const auto &palette = settings_.color_palette;
+        const auto &buses = index.GetBuses();
+
+        // отрисовка линий маршрутов: непрерывные цепочки видимых отрезков одного автобуса
+        const std::vector<uint32_t> segments = index.QuerySegments(area);
+        for (size_t i = 0; i < segments.size();) {
+            const uint32_t bus = index.GetPointBus(segments[i]);
+            size_t last = i;
+            while (last + 1 < segments.size() && segments[last + 1] == segments[last] + 1
+                   && index.GetPointBus(segments[last + 1]) == bus) {
+                ++last;
+            }
+
+            svg::Polyline route;
+            route.SetStrokeWidth(settings_.line_width);
+            route.SetStrokeLineCap(svg::StrokeLineCap::ROUND);
+            route.SetStrokeLineJoin(svg::StrokeLineJoin::ROUND);
+            route.SetFillColor(svg::NoneColor);
+            route.SetStrokeColor(palette[index.GetBusColorIndex(bus) % palette.size()]);
+            for (uint32_t point = segments[i]; point <= segments[last] + 1; ++point) {
+                StopPtr p_stop = index.GetPoint(point);
+                route.AddPoint(GetPoint(projection, p_stop->longitude, p_stop->latitude));
+            }
+            doc.Add(route);
+            i = last + 1;
+        }
+
+        // отрисовка названий маршрутов, конечные остановки которых попали в область
+        for (uint32_t bus = 0; bus < buses.size(); ++bus) {
+            const Bus *p_bus = buses[bus];
+            if (p_bus->route.empty()) continue;
+
+            auto fill_color = palette[index.GetBusColorIndex(bus) % palette.size()];
+            std::vector<StopPtr> terminals{p_bus->start_stop};
+            if (!p_bus->is_roundtrip && p_bus->start_stop != p_bus->end_stop) {
+                terminals.push_back(p_bus->end_stop);
+            }
+            for (StopPtr p_stop: terminals) {
+                if (area.Contains({p_stop->latitude, p_stop->longitude})) {
+                    doc.Add(GetBusLabel(projection, p_bus, p_stop, true));
+                    doc.Add(GetBusLabel(projection, p_bus, p_stop, false, fill_color));
+                }
+            }
+        }
+
+        // отрисовка остановок и их названий
+        std::vector<StopPtr> stops;
+        for (uint32_t id: index.QueryStops(area)) {
+            stops.push_back(index.GetStops()[id]);
+        }
+        RenderStops(projection, stops, doc);
+        RenderStopsName(projection, stops, doc);
 
         return doc;
     }
 
-    void MapRenderer::RenderStopsName(const std::vector<StopPtr> &stops, svg::Document &doc) const {
+    void MapRenderer::RenderStopsName(const Projection &projection, const std::vector<StopPtr> &stops,
+                                      svg::Document &doc) const {
         for (StopPtr p_stop: stops) {
             // подложка
-            svg::Text route_name_bg = GetStopLabel(p_stop, true);
+            svg::Text route_name_bg = GetStopLabel(projection, p_stop, true);
             doc.Add(route_name_bg);
             // надпись
-            svg::Text route_name = GetStopLabel(p_stop);
+            svg::Text route_name = GetStopLabel(projection, p_stop);
             doc.Add(route_name);
         }
     }
 
-    void MapRenderer::RenderStops(const std::vector<StopPtr> &stops, svg::Document &doc) const {
+    void MapRenderer::RenderStops(const Projection &projection, const std::vector<StopPtr> &stops,
+                                  svg::Document &doc) const {
         for (StopPtr p_stop: stops) {
             svg::Circle stop_circle;
-            stop_circle.SetCenter(GetPoint(p_stop->longitude, p_stop->latitude));
+            stop_circle.SetCenter(GetPoint(projection, p_stop->longitude, p_stop->latitude));
             stop_circle.SetRadius(settings_.stop_radius);
             stop_circle.SetFillColor("white");
             doc.Add(stop_circle);
         }
     }
 
-    void MapRenderer::RenderRoutesName(const std::vector<const Bus *> &buses, svg::Document &doc,
+    void MapRenderer::RenderRoutesName(const Projection &projection, const std::vector<const Bus *> &buses,
+                                       svg::Document &doc,
                                        const std::vector<svg::Color> &palette) const {
         int bus_counter = -1;
         for (const Bus *p_bus: buses) {
@@ -68,39 +274,52 @@ namespace transcat::renderer {
             auto fill_color = palette[++bus_counter % palette.size()];
 
             // подложка
-            svg::Text route_name_bg = GetBusLabel(p_bus, p_bus->start_stop, true);
+            svg::Text route_name_bg = GetBusLabel(projection, p_bus, p_bus->start_stop, true);
             doc.Add(route_name_bg);
             // надпись
-            svg::Text route_name = GetBusLabel(p_bus, p_bus->start_stop, false, fill_color);
+            svg::Text route_name = GetBusLabel(projection, p_bus, p_bus->start_stop, false, fill_color);
             doc.Add(route_name);
 
             if (!p_bus->is_roundtrip && p_bus->start_stop != p_bus->end_stop) {
                 // подложка
-                svg::Text route_name_bg = GetBusLabel(p_bus, p_bus->end_stop, true);
+                svg::Text route_name_bg = GetBusLabel(projection, p_bus, p_bus->end_stop, true);
                 doc.Add(route_name_bg);
 
                 // надпись
-                svg::Text route_name = GetBusLabel(p_bus, p_bus->end_stop, false, fill_color);
+                svg::Text route_name = GetBusLabel(projection, p_bus, p_bus->end_stop, false, fill_color);
                 doc.Add(route_name);
             }
         }
     }
 
-    void MapRenderer::InitMap(const std::vector<StopPtr> &stops) const {
-        min_lat_ = std::numeric_limits<double>::max();
-        min_lon_ = std::numeric_limits<double>::max();
-        max_lat_ = std::numeric_limits<double>::min();
-        max_lon_ = std::numeric_limits<double>::min();
+    MapRenderer::Projection MapRenderer::MakeProjection(const std::vector<StopPtr> &stops) const noexcept {
+        Projection projection;
+        projection.min_lat = std::numeric_limits<double>::max();
+        projection.min_lon = std::numeric_limits<double>::max();
+        projection.max_lat = std::numeric_limits<double>::min();
+        projection.max_lon = std::numeric_limits<double>::min();
         for (StopPtr p_stop: stops) {
-            if (p_stop->latitude < min_lat_) min_lat_ = p_stop->latitude;
-            if (p_stop->longitude < min_lon_) min_lon_ = p_stop->longitude;
-            if (p_stop->latitude > max_lat_) max_lat_ = p_stop->latitude;
-            if (p_stop->longitude > max_lon_) max_lon_ = p_stop->longitude;
+            if (p_stop->latitude < projection.min_lat) projection.min_lat = p_stop->latitude;
+            if (p_stop->longitude < projection.min_lon) projection.min_lon = p_stop->longitude;
+            if (p_stop->latitude > projection.max_lat) projection.max_lat = p_stop->latitude;
+            if (p_stop->longitude > projection.max_lon) projection.max_lon = p_stop->longitude;
         }
-        zoom_coef_ = GetZoomCoef();
+        projection.zoom_coef = GetZoomCoef(projection);
+        return projection;
+    }
+
+    MapRenderer::Projection MapRenderer::MakeProjection(const geo::Box &bounds) const noexcept {
+        Projection projection;
+        projection.min_lat = bounds.min_lat;
+        projection.min_lon = bounds.min_lng;
+        projection.max_lat = bounds.max_lat;
+        projection.max_lon = bounds.max_lng;
+        projection.zoom_coef = GetZoomCoef(projection);
+        return projection;
     }
 
-    void MapRenderer::RenderRoutes(const std::vector<const Bus *> &buses, svg::Document &doc,
+    void MapRenderer::RenderRoutes(const Projection &projection, const std::vector<const Bus *> &buses,
+                                   svg::Document &doc,
                                    const std::vector<svg::Color> &palette) const {
         int bus_counter = -1;
         for (const Bus *p_bus: buses) {
@@ -115,17 +334,18 @@ namespace transcat::renderer {
             route.SetFillColor(svg::NoneColor);
             route.SetStrokeColor(fill_color);
             for (StopPtr p_stop: p_bus->route) {
-                route.AddPoint(GetPoint(p_stop->longitude, p_stop->latitude));
+                route.AddPoint(GetPoint(projection, p_stop->longitude, p_stop->latitude));
             }
             doc.Add(route);
         }
     }
 
     svg::Text
-    MapRenderer::GetBusLabel(const Bus *p_bus, StopPtr p_stop, bool is_background, svg::Color fill_color) const noexcept {
+    MapRenderer::GetBusLabel(const Projection &projection, const Bus *p_bus, StopPtr p_stop, bool is_background,
+                             svg::Color fill_color) const noexcept {
         svg::Text label;
-        label.SetData(p_bus->name);
-        label.SetPosition(GetPoint(p_stop->longitude, p_stop->latitude));
+        label.SetData(std::string(p_bus->name));
+        label.SetPosition(GetPoint(projection, p_stop->longitude, p_stop->latitude));
         label.SetOffset(svg::Point(settings_.bus_label_offset[0], settings_.bus_label_offset[1]));
         label.SetFontSize(settings_.bus_label_font_size);
         label.SetFontFamily("Verdana");
@@ -143,10 +363,10 @@ namespace transcat::renderer {
     }
 
     svg::Text
-    MapRenderer::GetStopLabel(StopPtr p_stop, bool is_background) const noexcept {
+    MapRenderer::GetStopLabel(const Projection &projection, StopPtr p_stop, bool is_background) const noexcept {
         svg::Text label;
-        label.SetData(p_stop->name);
-        label.SetPosition(GetPoint(p_stop->longitude, p_stop->latitude));
+        label.SetData(std::string(p_stop->name));
+        label.SetPosition(GetPoint(projection, p_stop->longitude, p_stop->latitude));
         label.SetOffset(svg::Point(settings_.stop_label_offset[0], settings_.stop_label_offset[1]));
         label.SetFontSize(settings_.stop_label_font_size);
         label.SetFontFamily("Verdana");
@@ -162,18 +382,16 @@ namespace transcat::renderer {
         return label;
     }
 
-    bool IsZero(double value) {
-        return std::abs(value) < std::numeric_limits<double>::epsilon();
-    }
-
-    double MapRenderer::GetZoomCoef() const noexcept {
+    double MapRenderer::GetZoomCoef(const Projection &projection) const noexcept {
+        const double width = projection.max_lon - projection.min_lon;
+        const double height = projection.max_lat - projection.min_lat;
         std::optional<double> width_zoom_coef;
-        if (!IsZero(max_lon_ - min_lon_)) {
-            width_zoom_coef = (settings_.width - 2 * settings_.padding) / (max_lon_ - min_lon_);
+        if (!IsZero(width)) {
+            width_zoom_coef = (settings_.width - 2 * settings_.padding) / width;
         }
         std::optional<double> height_zoom_coef;
-        if (!IsZero(max_lat_ - min_lat_)) {
-            height_zoom_coef = (settings_.height - 2 * settings_.padding) / (max_lat_ - min_lat_);
+        if (!IsZero(height)) {
+            height_zoom_coef = (settings_.height - 2 * settings_.padding) / height;
         }
         if (width_zoom_coef && height_zoom_coef) {
             return std::min(*width_zoom_coef, *height_zoom_coef);
@@ -186,10 +404,12 @@ namespace transcat::renderer {
     }
 
     svg::Point
-    MapRenderer::GetPoint(double lon, double lat) const noexcept {
+    MapRenderer::GetPoint(const Projection &projection, double lon, double lat) const noexcept {
         return svg::Point(
-                (lon - min_lon_) * zoom_coef_ + settings_.padding,
-                (max_lat_ - lat) * zoom_coef_ + settings_.padding
+                ((lon - projection.min_lon) * projection.zoom_coef + settings_.padding - projection.tile_offset.x)
+                * projection.tile_scale,
+                ((projection.max_lat - lat) * projection.zoom_coef + settings_.padding - projection.tile_offset.y)
+                * projection.tile_scale
         );
     }
 
@@ -2,10 +2,12 @@
 
 #include <cstdint>
 #include <limits>
+#include <utility>
 
 #include "svg.h"
 #include "geo.h"
 #include "domain.h"
+#include "spatial_index.h"
 
 
 namespace transcat::renderer {
@@ -31,6 +33,56 @@ namespace transcat::renderer {
         std::vector<svg::Color> color_palette;
     };
 
+    // Тайл карты: при масштабе z холст делится на 2^z x 2^z равных частей, (x, y) - номер части
+    struct Tile {
+        static constexpr int MAX_ZOOM = 30;
+
+        int z = 0;
+        int x = 0;
+        int y = 0;
+
+        // 0 <= z <= MAX_ZOOM, x и y - в пределах [0, 2^z)
+        [[nodiscard]] bool IsValid() const noexcept;
+    };
+
+    // Пространственный индекс остановок и отрезков маршрутов.
+    // Строится один раз и позволяет отрисовывать только видимую часть карты.
+    class MapIndex {
+    public:
+        MapIndex(std::vector<StopPtr> stops, std::vector<const Bus *> buses);
+
+        [[nodiscard]] const std::vector<StopPtr> &GetStops() const noexcept;
+
+        [[nodiscard]] const std::vector<const Bus *> &GetBuses() const noexcept;
+
+        // Границы карты (по остановкам, через которые проходят маршруты)
+        [[nodiscard]] const geo::Box &GetBounds() const noexcept;
+
+        // Индексы остановок (в GetStops()), попадающих в область
+        [[nodiscard]] std::vector<uint32_t> QueryStops(const geo::Box &area) const;
+
+        // Отрезки маршрутов, пересекающие область. Отрезок задается индексом своей начальной точки
+        [[nodiscard]] std::vector<uint32_t> QuerySegments(const geo::Box &area) const;
+
+        [[nodiscard]] StopPtr GetPoint(uint32_t point) const;
+
+        // Номер автобуса (в GetBuses()), которому принадлежит точка маршрута
+        [[nodiscard]] uint32_t GetPointBus(uint32_t point) const;
+
+        // Порядковый номер цвета автобуса в палитре (как при отрисовке всей карты)
+        [[nodiscard]] int GetBusColorIndex(uint32_t bus) const;
+
+    private:
+        std::vector<StopPtr> stops_;
+        std::vector<const Bus *> buses_;
+        std::vector<int> bus_colors_;
+        std::vector<StopPtr> points_;       // точки всех маршрутов подряд
+        std::vector<uint32_t> point_bus_;   // автобус для каждой точки
+        geo::Box bounds_;
+        geo::GridIndex stops_index_;
+        geo::GridIndex segments_index_;
+    };
+
     class MapRenderer {
     public:
         explicit MapRenderer() = default;
@@ -41,35 +93,68 @@ namespace transcat::renderer {
 
         [[nodiscard]] svg::Document Render(const std::vector<StopPtr> &stops, const std::vector<const Bus *> &buses) const;
 
+        // То же, но с заранее известными границами карты
+        [[nodiscard]] svg::Document Render(const std::vector<StopPtr> &stops, const std::vector<const Bus *> &buses,
+                                           const geo::Box &bounds) const;
+
+        // Отрисовка произвольной области: область растягивается на весь холст
+        [[nodiscard]] svg::Document Render(const MapIndex &index, const geo::Box &area) const;
+
+        // Отрисовка тайла полной карты, увеличенного до размеров холста
+        [[nodiscard]] svg::Document Render(const MapIndex &index, Tile tile) const;
+
+        // Полная карта с изохроной поверх: достижимые остановки закрашены от зеленого (time = 0)
+        // до красного (time = budget)
+        [[nodiscard]] svg::Document Render(const std::vector<StopPtr> &stops, const std::vector<const Bus *> &buses,
+                                           const geo::Box &bounds,
+                                           const std::vector<std::pair<StopPtr, double>> &reachable,
+                                           double budget) const;
+
     private:
-        void InitMap(const std::vector<StopPtr> &stops) const;
+        // Проекция координат на холст: границы карты, масштаб и, для тайла, его сдвиг и увеличение.
+        // Считается заново на каждую отрисовку, так что одновременные отрисовки не мешают друг другу
+        struct Projection {
+            double min_lat = 0;
+            double min_lon = 0;
+            double max_lat = 0;
+            double max_lon = 0;
+            double zoom_coef = 0;
+            double tile_scale = 1;
+            svg::Point tile_offset;
+        };
+
+        [[nodiscard]] Projection MakeProjection(const std::vector<StopPtr> &stops) const noexcept;
+
+        [[nodiscard]] Projection MakeProjection(const geo::Box &bounds) const noexcept;
+
+        [[nodiscard]] svg::Document RenderLayers(const Projection &projection, const std::vector<StopPtr> &stops,
+                                                 const std::vector<const Bus *> &buses) const;
+
+        [[nodiscard]] svg::Document RenderArea(const Projection &projection, const MapIndex &index,
+                                               const geo::Box &area) const;
 
-        void RenderRoutes(const std::vector<const Bus *> &buses, svg::Document &doc,
+        void RenderRoutes(const Projection &projection, const std::vector<const Bus *> &buses, svg::Document &doc,
                           const std::vector<svg::Color> &palette) const;
 
-        void RenderRoutesName(const std::vector<const Bus *> &buses, svg::Document &doc,
+        void RenderRoutesName(const Projection &projection, const std::vector<const Bus *> &buses, svg::Document &doc,
                               const std::vector<svg::Color> &palette) const;
 
-        void RenderStops(const std::vector<StopPtr> &stops, svg::Document &doc) const;
+        void RenderStops(const Projection &projection, const std::vector<StopPtr> &stops, svg::Document &doc) const;
 
-        void RenderStopsName(const std::vector<StopPtr> &stops, svg::Document &doc) const;
+        void RenderStopsName(const Projection &projection, const std::vector<StopPtr> &stops, svg::Document &doc) const;
 
-        double GetZoomCoef() const noexcept;
+        double GetZoomCoef(const Projection &projection) const noexcept;
 
-        svg::Point GetPoint(double lon, double lat) const noexcept;
+        svg::Point GetPoint(const Projection &projection, double lon, double lat) const noexcept;
 
         svg::Text
-        GetBusLabel(const Bus *p_bus, StopPtr p_stop, bool is_background , svg::Color fill_color = svg::NoneColor) const noexcept;
+        GetBusLabel(const Projection &projection, const Bus *p_bus, StopPtr p_stop, bool is_background,
+                    svg::Color fill_color = svg::NoneColor) const noexcept;
 
         svg::Text
-        GetStopLabel(StopPtr p_stop, bool is_background = false) const noexcept;
+        GetStopLabel(const Projection &projection, StopPtr p_stop, bool is_background = false) const noexcept;
 
         RenderSettings settings_;
-        mutable double min_lat_ = std::numeric_limits<double>::max();
-        mutable double min_lon_ = std::numeric_limits<double>::max();
-        mutable double max_lat_ = std::numeric_limits<double>::min();
-        mutable double max_lon_ = std::numeric_limits<double>::min();
-        mutable double zoom_coef_ = 0;
     };
 
 } // namespace transcat::renderer
\ No newline at end of file
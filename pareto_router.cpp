@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <limits>
+
+#include "pareto_router.h"
+#include "profile.h"
+
+namespace transcat {
+
+    ParetoRouter::ParetoRouter(const TransportCatalogue &db, const RoutingSettings &settings)
+            : db_(db), wait_time_(settings.bus_wait_time), velocity_((settings.bus_velocity * 1'000) / 60),
+              stops_(db.GetAllStops()) {
+        for (StopPtr p_stop: stops_) {
+            stop_ids_.emplace(p_stop, static_cast<uint32_t>(stop_ids_.size()));
+        }
+
+        for (const Bus *p_bus: db_.GetAllBuses()) {
+            const Route &route = p_bus->route;
+            if (route.size() < 2) {
+                continue;
+            }
+            if (p_bus->is_roundtrip) {
+                AddPattern(p_bus, route, 0, route.size() - 1);
+            } else {
+                AddPattern(p_bus, route, 0, route.size() / 2);
+                AddPattern(p_bus, route, route.size() / 2, route.size() - 1);
+            }
+        }
+
+        // линии через каждую остановку - плоским списком
+        std::vector<uint32_t> counts(stops_.size() + 1, 0);
+        for (uint32_t stop: pattern_stops_) {
+            ++counts[stop + 1];
+        }
+        for (size_t i = 1; i < counts.size(); ++i) {
+            counts[i] += counts[i - 1];
+        }
+        stop_pattern_offsets_ = counts;
+        stop_patterns_.resize(pattern_stops_.size());
+        for (uint32_t pattern = 0; pattern < patterns_.size(); ++pattern) {
+            for (uint32_t position = 0; position < patterns_[pattern].size; ++position) {
+                const uint32_t stop = pattern_stops_[patterns_[pattern].offset + position];
+                stop_patterns_[counts[stop]++] = {pattern, position};
+            }
+        }
+    }
+
+    void ParetoRouter::AddPattern(const Bus *bus, const std::vector<StopPtr> &route, size_t first, size_t last) {
+        patterns_.push_back({bus, static_cast<uint32_t>(pattern_stops_.size()), static_cast<uint32_t>(last - first + 1)});
+        for (size_t i = first; i <= last; ++i) {
+            pattern_stops_.push_back(stop_ids_.at(route[i]));
+            ride_times_.push_back(db_.GetRouteDistance(bus, first, i) / velocity_);
+        }
+    }
+
+    std::vector<ParetoRouter::Itinerary> ParetoRouter::FindRoutes(StopPtr from, StopPtr to,
+                                                                  size_t max_transfers) const {
+        PROFILE_SCOPE("pareto_search");
+        std::vector<Itinerary> result;
+        if (!stop_ids_.count(from) || !stop_ids_.count(to)) {
+            return result;
+        }
+        const uint32_t source = stop_ids_.at(from);
+        const uint32_t target = stop_ids_.at(to);
+        if (source == target) {
+            result.push_back({0, {}});
+            return result;
+        }
+
+        static constexpr double INF = std::numeric_limits<double>::infinity();
+        const size_t stop_count = stops_.size();
+        const size_t max_rounds = max_transfers + 1;
+
+        // arrivals[k][s] - лучшее время до s не более чем на k автобусах, labels[k][s] - как оно получено в раунде k
+        std::vector<std::vector<double>> arrivals(1, std::vector<double>(stop_count, INF));
+        std::vector<std::vector<Label>> labels(1, std::vector<Label>(stop_count));
+        arrivals[0][source] = 0;
+        std::vector<uint32_t> marked{source};
+        std::vector<uint32_t> first_position(patterns_.size(), NONE);
+        std::vector<uint32_t> touched;
+        std::vector<bool> is_marked(stop_count, false);
+
+        for (size_t round = 1; round <= max_rounds && !marked.empty(); ++round) {
+            arrivals.push_back(arrivals.back());
+            labels.emplace_back(stop_count);
+            const std::vector<double> &previous = arrivals[round - 1];
+            std::vector<double> &current = arrivals[round];
+            std::vector<Label> &round_labels = labels[round];
+
+            // линии через улучшенные остановки, с самой ранней позиции посадки
+            for (uint32_t stop: marked) {
+                for (uint32_t i = stop_pattern_offsets_[stop]; i < stop_pattern_offsets_[stop + 1]; ++i) {
+                    const auto [pattern, position] = stop_patterns_[i];
+                    if (first_position[pattern] == NONE) {
+                        touched.push_back(pattern);
+                        first_position[pattern] = position;
+                    } else {
+                        first_position[pattern] = std::min(first_position[pattern], position);
+                    }
+                }
+            }
+            marked.clear();
+
+            for (uint32_t pattern_id: touched) {
+                const Pattern &pattern = patterns_[pattern_id];
+                const uint32_t *stops = &pattern_stops_[pattern.offset];
+                const double *times = &ride_times_[pattern.offset];
+                double board_time = INF;    // время отправления с остановки посадки
+                uint32_t board = 0;
+                for (uint32_t position = first_position[pattern_id]; position < pattern.size; ++position) {
+                    const uint32_t stop = stops[position];
+                    if (board_time < INF) {
+                        const double arrival = board_time + (times[position] - times[board]);
+                        // прибытие позже уже найденного до цели ничего не даст
+                        if (arrival < current[stop] && arrival < current[target]) {
+                            current[stop] = arrival;
+                            round_labels[stop] = {pattern_id, board, position};
+                            if (!is_marked[stop]) {
+                                is_marked[stop] = true;
+                                marked.push_back(stop);
+                            }
+                        }
+                    }
+                    const double candidate = previous[stop] + wait_time_;
+                    if (candidate < INF && (board_time == INF
+                                            || candidate < board_time + (times[position] - times[board]))) {
+                        board_time = candidate;
+                        board = position;
+                    }
+                }
+                first_position[pattern_id] = NONE;
+            }
+            touched.clear();
+            for (uint32_t stop: marked) {
+                is_marked[stop] = false;
+            }
+
+            // новое время до цели - еще одна точка множества Парето
+            if (current[target] < previous[target]) {
+                Itinerary itinerary{current[target], {}};
+                uint32_t stop = target;
+                for (size_t k = round; k > 0 && stop != source; --k) {
+                    const Label &label = labels[k][stop];
+                    if (label.pattern == NONE) {
+                        continue;   // время получено в одном из прошлых раундов
+                    }
+                    const Pattern &pattern = patterns_[label.pattern];
+                    const uint32_t board_stop = pattern_stops_[pattern.offset + label.board];
+                    itinerary.legs.push_back({
+                            pattern.bus, stops_[board_stop], stops_[stop],
+                            static_cast<int>(label.alight - label.board),
+                            ride_times_[pattern.offset + label.alight] - ride_times_[pattern.offset + label.board]
+                    });
+                    stop = board_stop;
+                }
+                std::reverse(itinerary.legs.begin(), itinerary.legs.end());
+                result.push_back(std::move(itinerary));
+            }
+        }
+        return result;
+    }
+
+} // namespace transcat
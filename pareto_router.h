@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "transport_catalogue.h"
+
+namespace transcat {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Pareto Router
+    //
+    //   Маршруты, оптимальные по Парето по паре (время в пути, количество пересадок).
+    //   Поиск идет раундами по линиям (как в RAPTOR): раунд k улучшает время прибытия на остановки
+    //   поездками ровно на k автобусах, просматривая только линии через остановки, улучшенные
+    //   в раунде k - 1. Модель времени та же, что у графа маршрутов: каждая посадка стоит
+    //   bus_wait_time, поездка - расстояние / bus_velocity.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    class ParetoRouter {
+    public:
+        // Поездка на одной линии: автобус, остановки посадки и высадки, число перегонов и время в автобусе
+        struct Leg {
+            const Bus *bus = nullptr;
+            StopPtr from = nullptr;
+            StopPtr to = nullptr;
+            int span_count = 0;
+            double time = 0;
+        };
+
+        struct Itinerary {
+            double total_time = 0;
+            std::vector<Leg> legs;
+        };
+
+        ParetoRouter(const TransportCatalogue &db, const RoutingSettings &settings);
+
+        // Оптимальные по Парето маршруты не более чем с max_transfers пересадками,
+        // по возрастанию числа пересадок (и убыванию времени)
+        [[nodiscard]] std::vector<Itinerary> FindRoutes(StopPtr from, StopPtr to, size_t max_transfers) const;
+
+    private:
+        // Линия - последовательность остановок, по которой автобус едет без разворота:
+        // кольцевой маршрут целиком, некольцевой - две половины
+        struct Pattern {
+            const Bus *bus = nullptr;
+            uint32_t offset = 0;    // начало в pattern_stops_ / ride_times_
+            uint32_t size = 0;
+        };
+
+        // Позиция остановки на линии
+        struct PatternStop {
+            uint32_t pattern = 0;
+            uint32_t position = 0;
+        };
+
+        // Как остановка достигнута в раунде: линия, позиции посадки и высадки
+        struct Label {
+            uint32_t pattern = NONE;
+            uint32_t board = 0;
+            uint32_t alight = 0;
+        };
+
+        static constexpr uint32_t NONE = static_cast<uint32_t>(-1);
+
+        void AddPattern(const Bus *bus, const std::vector<StopPtr> &route, size_t first, size_t last);
+
+        const TransportCatalogue &db_;
+        double wait_time_ = 0;
+        double velocity_ = 0;                               // м/мин
+        std::vector<StopPtr> stops_;                        // индекс - идентификатор остановки
+        std::unordered_map<StopPtr, uint32_t> stop_ids_;
+
+        std::vector<Pattern> patterns_;
+        std::vector<uint32_t> pattern_stops_;
+        std::vector<double> ride_times_;                    // время от начала линии до остановки
+        std::vector<uint32_t> stop_pattern_offsets_;        // CSR: линии через остановку
+        std::vector<PatternStop> stop_patterns_;
+    };
+
+} // namespace transcat
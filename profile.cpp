@@ -0,0 +1,281 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <unordered_set>
+
+#include "profile.h"
+#include "json.h"
+
+namespace profile {
+
+    using namespace std::string_literals;
+
+    ///////////////////////// Histogram /////////////////////////////////
+
+    void Histogram::Record(uint64_t value) noexcept {
+        ++buckets_[GetBucket(value)];
+        ++count_;
+        max_ = std::max(max_, value);
+    }
+
+    void Histogram::Merge(const Histogram &other) noexcept {
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            buckets_[bucket] += other.buckets_[bucket];
+        }
+        count_ += other.count_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    uint64_t Histogram::GetPercentile(double p) const noexcept {
+        if (count_ == 0) {
+            return 0;
+        }
+        const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100 * static_cast<double>(count_))));
+        uint64_t seen = 0;
+        for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+            seen += buckets_[bucket];
+            if (seen >= rank) {
+                return std::min(GetBucketUpperBound(bucket), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t Histogram::GetCount() const noexcept {
+        return count_;
+    }
+
+    uint64_t Histogram::GetMax() const noexcept {
+        return max_;
+    }
+
+    size_t Histogram::GetBucket(uint64_t value) noexcept {
+        if (value < SUB_BUCKETS) {
+            return static_cast<size_t>(value);
+        }
+        size_t msb = 0;
+        while ((value >> (msb + 1)) != 0) {
+            ++msb;
+        }
+        // 4 старших бита после старшего - номер линейного интервала
+        const size_t shift = msb - 4;
+        return (msb - 3) * SUB_BUCKETS + static_cast<size_t>((value >> shift) & (SUB_BUCKETS - 1));
+    }
+
+    uint64_t Histogram::GetBucketUpperBound(size_t bucket) noexcept {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        const size_t shift = bucket / SUB_BUCKETS - 1;
+        const uint64_t lower = (SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+        return lower + ((uint64_t{1} << shift) - 1);
+    }
+
+    ///////////////////////// Stats /////////////////////////////////////
+
+    size_t Stats::GetChild(size_t parent, std::string_view name) {
+        for (size_t child: timers[parent].children) {
+            if (timers[child].name == name) {
+                return child;
+            }
+        }
+        timers.push_back({std::string(name), parent, {}, 0, 0});
+        timers[parent].children.push_back(timers.size() - 1);
+        return timers.size() - 1;
+    }
+
+    void Stats::Merge(const Stats &other) {
+        MergeTimer(0, other, 0);
+        for (const auto &[name, value]: other.counters) {
+            counters[name] += value;
+        }
+        for (const auto &[name, histogram]: other.histograms) {
+            histograms[name].Merge(histogram);
+        }
+    }
+
+    void Stats::MergeTimer(size_t node, const Stats &other, size_t other_node) {
+        timers[node].calls += other.timers[other_node].calls;
+        timers[node].total_ns += other.timers[other_node].total_ns;
+        for (size_t other_child: other.timers[other_node].children) {
+            MergeTimer(GetChild(node, other.timers[other_child].name), other, other_child);
+        }
+    }
+
+    ///////////////////////// накопление по потокам ///////////////////////
+
+    namespace {
+
+        std::atomic<bool> is_enabled{false};
+
+        struct ThreadStats;
+
+        // Данные завершившихся потоков и список живых
+        struct Registry {
+            std::mutex mutex;
+            Stats retired;
+            std::unordered_set<ThreadStats *> alive;
+        };
+
+        Registry &GetRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        struct ThreadStats {
+            Stats stats;
+            size_t current = 0;     // узел активного таймера
+            std::mutex mutex;       // захватывается владельцем только при изменении структуры и при сборе
+
+            ThreadStats() {
+                Registry &registry = GetRegistry();
+                std::lock_guard guard(registry.mutex);
+                registry.alive.insert(this);
+            }
+
+            ~ThreadStats() {
+                Registry &registry = GetRegistry();
+                std::lock_guard guard(registry.mutex);
+                registry.alive.erase(this);
+                registry.retired.Merge(stats);
+            }
+        };
+
+        ThreadStats &GetThreadStats() {
+            thread_local ThreadStats thread_stats;
+            return thread_stats;
+        }
+
+        // Узел json хранит int или double, а double выводится с 6 значащими цифрами
+        json::Node CountToJson(int64_t value) {
+            if (value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max()) {
+                return static_cast<int>(value);
+            }
+            return static_cast<double>(value);
+        }
+
+        double ToMicroseconds(uint64_t ns) {
+            return static_cast<double>(ns) / 1e3;
+        }
+
+        json::Dict TimerToJson(const Stats &stats, size_t node) {
+            json::Dict children;
+            for (size_t child: stats.timers[node].children) {
+                children[stats.timers[child].name] = TimerToJson(stats, child);
+            }
+            json::Dict result{
+                    {"calls"s, CountToJson(static_cast<int64_t>(stats.timers[node].calls))},
+                    {"total_ms"s, static_cast<double>(stats.timers[node].total_ns) / 1e6}
+            };
+            if (!children.empty()) {
+                result["children"s] = std::move(children);
+            }
+            return result;
+        }
+
+    } // namespace
+
+    void SetEnabled(bool enabled) noexcept {
+        is_enabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    bool IsEnabled() noexcept {
+        return is_enabled.load(std::memory_order_relaxed);
+    }
+
+    Stats GetStats() {
+        Registry &registry = GetRegistry();
+        std::lock_guard guard(registry.mutex);
+        Stats result = registry.retired;
+        for (ThreadStats *thread_stats: registry.alive) {
+            std::lock_guard thread_guard(thread_stats->mutex);
+            result.Merge(thread_stats->stats);
+        }
+        return result;
+    }
+
+    void WriteStats(std::ostream &out) {
+        const Stats stats = GetStats();
+
+        json::Dict timers;
+        for (size_t child: stats.timers[0].children) {
+            timers[stats.timers[child].name] = TimerToJson(stats, child);
+        }
+        json::Dict counters;
+        for (const auto &[name, value]: stats.counters) {
+            counters[name] = CountToJson(value);
+        }
+        json::Dict histograms;
+        for (const auto &[name, histogram]: stats.histograms) {
+            histograms[name] = json::Dict{
+                    {"count"s, CountToJson(static_cast<int64_t>(histogram.GetCount()))},
+                    {"p50_us"s, ToMicroseconds(histogram.GetPercentile(50))},
+                    {"p99_us"s, ToMicroseconds(histogram.GetPercentile(99))},
+                    {"max_us"s, ToMicroseconds(histogram.GetMax())}
+            };
+        }
+        json::Print(json::Document{json::Dict{
+                {"timers"s, std::move(timers)},
+                {"counters"s, std::move(counters)},
+                {"histograms"s, std::move(histograms)}
+        }}, out);
+        out << std::endl;
+    }
+
+    void AddCount(std::string_view name, int64_t delta) {
+        if (!IsEnabled()) {
+            return;
+        }
+        ThreadStats &thread_stats = GetThreadStats();
+        std::lock_guard guard(thread_stats.mutex);
+        auto it = thread_stats.stats.counters.find(name);
+        if (it == thread_stats.stats.counters.end()) {
+            it = thread_stats.stats.counters.emplace(std::string(name), 0).first;
+        }
+        it->second += delta;
+    }
+
+    void RecordLatency(std::string_view name, uint64_t value) {
+        if (!IsEnabled()) {
+            return;
+        }
+        ThreadStats &thread_stats = GetThreadStats();
+        std::lock_guard guard(thread_stats.mutex);
+        auto it = thread_stats.stats.histograms.find(name);
+        if (it == thread_stats.stats.histograms.end()) {
+            it = thread_stats.stats.histograms.emplace(std::string(name), Histogram{}).first;
+        }
+        it->second.Record(value);
+    }
+
+    ///////////////////////// ScopedTimer ///////////////////////////////
+
+    ScopedTimer::ScopedTimer(std::string_view name) {
+        if (!IsEnabled()) {
+            return;
+        }
+        ThreadStats &thread_stats = GetThreadStats();
+        {
+            std::lock_guard guard(thread_stats.mutex);
+            node_ = thread_stats.stats.GetChild(thread_stats.current, name);
+        }
+        thread_stats.current = node_;
+        start_time_ = Clock::now();
+    }
+
+    ScopedTimer::~ScopedTimer() {
+        if (node_ == NO_NODE) {
+            return;
+        }
+        const auto duration = Clock::now() - start_time_;
+        ThreadStats &thread_stats = GetThreadStats();
+        std::lock_guard guard(thread_stats.mutex);
+        TimerNode &node = thread_stats.stats.timers[node_];
+        ++node.calls;
+        node.total_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+        thread_stats.current = node.parent;
+    }
+
+} // namespace profile
@@ -1,35 +1,118 @@
 #pragma once
 
+#include <array>
 #include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////
+//
+//   Profile
+//
+//   Вложенные таймеры, счетчики и гистограммы задержек. Каждый поток накапливает данные
+//   у себя (его мьютекс конкурирует только со сбором), общая картина собирается по запросу GetStats().
+//   Пока сбор выключен (SetEnabled(false), по умолчанию), таймер стоит одну проверку флага.
+//
+//   PROFILE_SCOPE("read_data");              - время до конца блока, вложенное в объемлющий таймер
+//   PROFILE_COUNT("graph.edges", count);     - счетчик
+//
+///////////////////////////////////////////////////////////////////////////////////////////////
 
 #define PROFILE_CONCAT_INTERNAL(X, Y) X##Y
 #define PROFILE_CONCAT(X, Y) PROFILE_CONCAT_INTERNAL(X, Y)
 #define UNIQUE_VAR_NAME_PROFILE PROFILE_CONCAT(profileGuard, __LINE__)
-#define LOG_DURATION(x) LogDuration UNIQUE_VAR_NAME_PROFILE(x)
-#define LOG_DURATION_STREAM(prefix, stream) LogDuration UNIQUE_VAR_NAME_PROFILE(prefix, stream)
+#define PROFILE_SCOPE(name) profile::ScopedTimer UNIQUE_VAR_NAME_PROFILE(name)
+#define PROFILE_COUNT(name, delta) profile::AddCount(name, static_cast<int64_t>(delta))
+
+namespace profile {
 
-class LogDuration {
-public:
-    // заменим имя типа std::chrono::steady_clock
-    // с помощью using для удобства
     using Clock = std::chrono::steady_clock;
 
-    LogDuration(const std::string_view id, std::ostream& out = std::cerr)
-            : id_(id), out_(out) {
-    }
+    // Гистограмма в духе HDR: на каждую степень двойки 16 линейных интервалов,
+    // т.е. относительная погрешность перцентилей не больше 1/16. Максимум хранится точно.
+    class Histogram {
+    public:
+        void Record(uint64_t value) noexcept;
+
+        void Merge(const Histogram &other) noexcept;
+
+        // Верхняя граница интервала, в который попадает перцентиль p (0..100)
+        [[nodiscard]] uint64_t GetPercentile(double p) const noexcept;
+
+        [[nodiscard]] uint64_t GetCount() const noexcept;
+
+        [[nodiscard]] uint64_t GetMax() const noexcept;
+
+    private:
+        static constexpr size_t SUB_BUCKETS = 16;
+        static constexpr size_t BUCKET_COUNT = SUB_BUCKETS * 61;
+
+        static size_t GetBucket(uint64_t value) noexcept;
+
+        static uint64_t GetBucketUpperBound(size_t bucket) noexcept;
+
+        std::array<uint64_t, BUCKET_COUNT> buckets_{};
+        uint64_t count_ = 0;
+        uint64_t max_ = 0;
+    };
+
+    struct TimerNode {
+        std::string name;
+        size_t parent = 0;
+        std::vector<size_t> children;
+        uint64_t calls = 0;
+        uint64_t total_ns = 0;
+    };
+
+    // Накопленные данные. timers[0] - безымянный корень дерева таймеров
+    struct Stats {
+        std::vector<TimerNode> timers{TimerNode{}};
+        std::map<std::string, int64_t, std::less<>> counters;
+        std::map<std::string, Histogram, std::less<>> histograms;
+
+        // Находит или создает дочерний таймер с таким именем
+        size_t GetChild(size_t parent, std::string_view name);
+
+        void Merge(const Stats &other);
+
+    private:
+        void MergeTimer(size_t node, const Stats &other, size_t other_node);
+    };
+
+    void SetEnabled(bool enabled) noexcept;
+
+    [[nodiscard]] bool IsEnabled() noexcept;
+
+    // Данные всех потоков, включая завершившиеся
+    [[nodiscard]] Stats GetStats();
+
+    // Выводит GetStats() в формате JSON: время таймеров - в мс, гистограммы (длительности в нс) - в мкс
+    void WriteStats(std::ostream &out);
+
+    void AddCount(std::string_view name, int64_t delta = 1);
+
+    // Добавляет значение (обычно - длительность в нс) в гистограмму name
+    void RecordLatency(std::string_view name, uint64_t value);
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(std::string_view name);
+
+        ~ScopedTimer();
+
+        ScopedTimer(const ScopedTimer &) = delete;
+
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
 
-    ~LogDuration() {
-        using namespace std::chrono;
-        using namespace std::literals;
+    private:
+        static constexpr size_t NO_NODE = static_cast<size_t>(-1);
 
-        const auto end_time = Clock::now();
-        const auto dur = end_time - start_time_;
-        out_ << id_ << ": "s << duration_cast<milliseconds>(dur).count() << " ms"s << std::endl;
-    }
+        size_t node_ = NO_NODE;
+        Clock::time_point start_time_;
+    };
 
-private:
-    const std::string id_;
-    const Clock::time_point start_time_ = Clock::now();
-    std::ostream& out_;
-};
+} // namespace profile
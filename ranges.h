@@ -22,6 +22,12 @@ namespace ranges {
         It end() const {
             return end_;
         }
+        bool empty() const {
+            return begin_ == end_;
+        }
+        size_t size() const {
+            return static_cast<size_t>(std::distance(begin_, end_));
+        }
 
     private:
         It begin_;
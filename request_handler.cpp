@@ -1,53 +1,82 @@
 #include "request_handler.h"
+#include "profile.h"
 
 #include <utility>
 
 namespace transcat {
 
+    namespace {
+
+        // Отрезки маршрута, которые проезжают без разворота: кольцевой маршрут целиком, некольцевой -
+        // туда и обратно (конечная входит в оба отрезка)
+        template <typename Callback>
+        void ForEachRouteRun(const TransportCatalogue &db, Callback callback) {
+            for (const Bus *p_bus: db.GetAllBuses()) {
+                const size_t size = p_bus->route.size();
+                if (size < 2) {
+                    continue;
+                }
+                if (p_bus->is_roundtrip) {
+                    callback(p_bus, 0, size - 1);
+                } else {
+                    callback(p_bus, 0, size / 2);
+                    callback(p_bus, size / 2, size - 1);
+                }
+            }
+        }
+
+        // Сколько вершин остановок маршрутов добавляет модель графа
+        size_t CountRouteStopVertices(const TransportCatalogue &db, const RoutingSettings &settings) {
+            size_t count = 0;
+            if (settings.graph_model == RouteGraphModel::RouteStops) {
+                ForEachRouteRun(db, [&count](const Bus *, size_t first, size_t last) {
+                    count += last - first + 1;
+                });
+            }
+            return count;
+        }
+
+    } // namespace
+
     // Этот конструктор строит граф "с нуля"
     RequestHandler::RequestHandler(const TransportCatalogue &db, const renderer::MapRenderer &renderer,
                                    RoutingSettings settings, size_t vertex_count)
-            : db_(db), renderer_(renderer), settings_(settings), route_graph_(vertex_count),
+            : db_(db), renderer_(renderer), settings_(settings),
+              route_graph_(vertex_count + CountRouteStopVertices(db, settings)),
               stops_to_vrtx_(vertex_count) {
+        PROFILE_SCOPE("build_graph");
 
-        vrtx_to_stops_.resize(vertex_count);
-
-        // индексация остановок
-        graph::VertexId vrtx = 0;
-        for (const auto p_stop: db_.GetAllStops()) {
-            stops_to_vrtx_.emplace(p_stop, vrtx);
-            vrtx_to_stops_[vrtx] = p_stop;
-            ++vrtx;
-        }
+        IndexVertices();
 
         const double normal_velocity = GetNormalBusVelocity();  // переводим скорость из км/ч -> м/мин
 
-        // заполнение графа маршрутов
-        for (const Bus *p_bus: db_.GetAllBuses()) {
+        if (settings_.graph_model == RouteGraphModel::RouteStops) {
+            BuildRouteStopEdges(normal_velocity);
+            PROFILE_COUNT("graph.edges", route_graph_.GetEdgeCount());
+            return;
+        }
 
-            for (auto from_it = p_bus->route.begin(); from_it != p_bus->route.end(); ++from_it) {
-                auto current_it = from_it;
-                double weight = 0;
-                int span_count = 0;
-                for (auto to_it = next(from_it, 1); to_it != p_bus->route.end(); ++to_it, ++current_it) {
-                    if (from_it != to_it) {
-                        weight += db_.GetDistance({*current_it, *to_it}) / normal_velocity;
-                        graph::EdgeId edge_id = route_graph_.AddEdge({
-                                                                             GetVertexForStop(*from_it),
-                                                                             GetVertexForStop(*to_it),
-                                                                             weight + settings_.bus_wait_time,
-                                                                             //p_bus,
-                                                                             ++span_count
-                                                                     });
-                        SetBusForEdge(edge_id, p_bus);
-                    }
-                    //if (*to_it == p_bus->end_stop && !p_bus->is_roundtrip) {
-                    if (!p_bus->is_roundtrip && to_it == next(p_bus->route.begin(), p_bus->route.size() / 2)) {
+        // заполнение графа маршрутов: длина перегона from -> to - разность префиксных сумм маршрута
+        for (const Bus *p_bus: db_.GetAllBuses()) {
+            const Route &route = p_bus->route;
+            for (size_t from = 0; from < route.size(); ++from) {
+                for (size_t to = from + 1; to < route.size(); ++to) {
+                    const double weight = db_.GetRouteDistance(p_bus, from, to) / normal_velocity;
+                    graph::EdgeId edge_id = route_graph_.AddEdge({
+                                                                         GetVertexForStop(route[from]),
+                                                                         GetVertexForStop(route[to]),
+                                                                         weight + settings_.bus_wait_time,
+                                                                         static_cast<int>(to - from)
+                                                                 });
+                    SetBusForEdge(edge_id, p_bus);
+                    // некольцевой маршрут: поездка не продолжается за конечную
+                    if (!p_bus->is_roundtrip && to == route.size() / 2) {
                         break;
                     }
                 }
             }
         }
+        PROFILE_COUNT("graph.edges", route_graph_.GetEdgeCount());
     }
 
     // Этот конструктор принимает готовый граф
@@ -56,18 +85,74 @@ namespace transcat {
                                    graph::DirectedWeightedGraph<double> route_graph)
             : db_(db), renderer_(renderer), settings_(settings), route_graph_(std::move(route_graph)),
               stops_to_vrtx_(vertex_count) {
+        IndexVertices();
+    }
 
-        vrtx_to_stops_.resize(vertex_count);
+    GraphSize RequestHandler::EvaluateGraphSize(const TransportCatalogue &db, const RoutingSettings &settings) {
+        GraphSize size{db.EvaluateVertexCount() + CountRouteStopVertices(db, settings), 0};
+        if (settings.graph_model == RouteGraphModel::RouteStops) {
+            // на каждом перегоне отрезка - посадка, поездка и высадка
+            ForEachRouteRun(db, [&size](const Bus *, size_t first, size_t last) {
+                size.edge_count += 3 * (last - first);
+            });
+            return size;
+        }
+        // ребро на каждую пару остановок поездки: некольцевой маршрут разворачивается на конечной
+        auto pair_count = [](size_t stop_count) {
+            return stop_count * (stop_count - 1) / 2;
+        };
+        for (const Bus *p_bus: db.GetAllBuses()) {
+            const size_t route_size = p_bus->route.size();
+            if (route_size < 2) {
+                continue;
+            }
+            if (p_bus->is_roundtrip) {
+                size.edge_count += pair_count(route_size);
+            } else {
+                size.edge_count += pair_count(route_size / 2 + 1) + pair_count(route_size - route_size / 2);
+            }
+        }
+        return size;
+    }
 
-        // индексация остановок
-        graph::VertexId vrtx = 0;
+    void RequestHandler::IndexVertices() {
+        // сначала вершины остановок (по названию), затем - остановок маршрутов в порядке их ребер
+        vrtx_to_stops_.reserve(route_graph_.GetVertexCount());
         for (const auto p_stop: db_.GetAllStops()) {
-            stops_to_vrtx_.emplace(p_stop, vrtx);
-            vrtx_to_stops_[vrtx] = p_stop;
-            ++vrtx;
+            stops_to_vrtx_.emplace(p_stop, vrtx_to_stops_.size());
+            vrtx_to_stops_.push_back(p_stop);
+        }
+        if (settings_.graph_model == RouteGraphModel::RouteStops) {
+            ForEachRouteRun(db_, [this](const Bus *p_bus, size_t first, size_t last) {
+                for (size_t i = first; i <= last; ++i) {
+                    vrtx_to_stops_.push_back(p_bus->route[i]);
+                }
+            });
         }
     }
 
+    void RequestHandler::BuildRouteStopEdges(double normal_velocity) {
+        graph::VertexId vertex = stops_to_vrtx_.size();
+        ForEachRouteRun(db_, [&](const Bus *p_bus, size_t first, size_t last) {
+            const Route &route = p_bus->route;
+            for (size_t i = first; i <= last; ++i, ++vertex) {
+                const graph::VertexId stop_vertex = GetVertexForStop(route[i]);
+                if (i > first) {
+                    // высадка
+                    SetBusForEdge(route_graph_.AddEdge({vertex, stop_vertex, 0, 0}), p_bus);
+                }
+                if (i < last) {
+                    // посадка с ожиданием и перегон до следующей остановки
+                    SetBusForEdge(route_graph_.AddEdge({stop_vertex, vertex,
+                                                        static_cast<double>(settings_.bus_wait_time), 0}), p_bus);
+                    SetBusForEdge(route_graph_.AddEdge({vertex, vertex + 1,
+                                                        db_.GetRouteDistance(p_bus, i, i + 1) / normal_velocity,
+                                                        1}), p_bus);
+                }
+            }
+        });
+    }
+
     std::optional<BusStat> RequestHandler::GetBusStat(const std::string_view &bus_name) const {
         const Bus *p_bus = db_.GetBus(bus_name);
         if (p_bus) {
@@ -84,21 +169,86 @@ namespace transcat {
         return std::nullopt;
     }
 
-    const std::set<const Bus *, TransportCatalogue::BusPtrComparator> *
-    RequestHandler::GetBusesByStop(const std::string_view &stop_name) const {
+    std::optional<SegmentStat> RequestHandler::GetSegmentStat(const Bus *p_bus, StopPair from_to) const {
+        if (!p_bus || !from_to.from || !from_to.to) {
+            return std::nullopt;
+        }
+        // префиксные суммы не убывают, так что для каждого вхождения to кратчайший отрезок
+        // начинается с последнего предшествующего вхождения from
+        const Route &route = p_bus->route;
+        std::optional<SegmentStat> result;
+        std::optional<size_t> from;
+        for (size_t i = 0; i < route.size(); ++i) {
+            if (from && route[i] == from_to.to) {
+                const distance_t length = db_.GetRouteDistance(p_bus, *from, i);
+                if (!result || length < result->route_length) {
+                    result = SegmentStat{length, length / GetNormalBusVelocity(), static_cast<int>(i - *from)};
+                }
+            }
+            if (route[i] == from_to.from) {
+                from = i;
+            }
+        }
+        return result;
+    }
+
+    TransportCatalogue::BusesRange RequestHandler::GetBusesByStop(const std::string_view &stop_name) const {
         return db_.GetBusesForStop(db_.GetStop(stop_name));
     }
 
     svg::Document RequestHandler::RenderMap() const {
+        std::vector<const Bus *> routes = db_.GetAllBuses();
+        return renderer_.Render(GetRoutedStops(), routes, db_.GetRoutedStopsBounds());
+    }
+
+    svg::Document RequestHandler::RenderMap(const geo::Box &area) const {
+        return renderer_.Render(GetMapIndex(), area);
+    }
+
+    svg::Document RequestHandler::RenderMap(renderer::Tile tile) const {
+        return renderer_.Render(GetMapIndex(), tile);
+    }
+
+    svg::Document RequestHandler::RenderMap(const std::vector<std::pair<StopPtr, double>> &reachable,
+                                            double budget) const {
+        return renderer_.Render(GetRoutedStops(), db_.GetAllBuses(), db_.GetRoutedStopsBounds(), reachable, budget);
+    }
+
+    std::vector<StopPtr> RequestHandler::GetRoutedStops() const {
         std::vector<StopPtr> routed_stops;
         for (StopPtr p_stop: db_.GetAllStops()) {
             if (db_.IsStopInRoutes(p_stop)) {
                 routed_stops.push_back(p_stop);
             }
         }
-        std::vector<const Bus *> routes = db_.GetAllBuses();
+        return routed_stops;
+    }
+
+    const renderer::MapIndex &RequestHandler::GetMapIndex() const {
+        bool is_built = false;
+        std::call_once(map_index_flag_, [this, &is_built]() {
+            PROFILE_SCOPE("build_map_index");
+            map_index_.emplace(GetRoutedStops(), db_.GetAllBuses());
+            is_built = true;
+        });
+        PROFILE_COUNT(is_built ? "map_index.cache_misses" : "map_index.cache_hits", 1);
+        return *map_index_;
+    }
 
-        return renderer_.Render(routed_stops, routes);
+    const ParetoRouter &RequestHandler::GetParetoRouter() const {
+        std::call_once(pareto_router_flag_, [this]() {
+            PROFILE_SCOPE("build_pareto_router");
+            pareto_router_.emplace(db_, settings_);
+        });
+        return *pareto_router_;
+    }
+
+    void RequestHandler::SetupRouter(graph::Router<double> &router) const {
+        if (!router.HasRoutesInternalData() && settings_.use_geo_heuristic) {
+            router.SetHeuristic([this](graph::VertexId vertex, graph::VertexId to) {
+                return GetLowerBoundTime(vertex, to);
+            });
+        }
     }
 
     bool RequestHandler::IsStopExists(const std::string_view &stop_name) const {
@@ -109,6 +259,34 @@ namespace transcat {
         return db_.IsStopInRoutes(db_.GetStop(stop_name));
     }
 
+    std::vector<StopPtr> RequestHandler::GetStopsInArea(const geo::Box &area) const {
+        return db_.GetStopsInArea(area);
+    }
+
+    std::vector<std::pair<StopPtr, double>> RequestHandler::GetNearestStops(geo::Coordinates point,
+                                                                           size_t count) const {
+        return db_.GetNearestStops(point, count);
+    }
+
+    std::vector<graph::Router<double>::Terminal> RequestHandler::GetWalkTerminals(geo::Coordinates point) const {
+        std::vector<graph::Router<double>::Terminal> terminals;
+        for (const auto &[p_stop, distance]: db_.GetStopsInRadius(point, settings_.max_walk_distance)) {
+            terminals.push_back({GetVertexForStop(p_stop), GetWalkTime(distance)});
+        }
+        return terminals;
+    }
+
+    double RequestHandler::GetLowerBoundTime(graph::VertexId from, graph::VertexId to) const {
+        StopPtr p_from = vrtx_to_stops_[from];
+        StopPtr p_to = vrtx_to_stops_[to];
+        return geo::ComputeSafeDistance({p_from->latitude, p_from->longitude}, {p_to->latitude, p_to->longitude})
+               / GetNormalBusVelocity();
+    }
+
+    double RequestHandler::GetWalkTime(double meters) const noexcept {
+        return meters / ((settings_.walk_velocity * 1'000) / 60);  // скорость пешехода в м/мин
+    }
+
     distance_t RequestHandler::GetDistance(StopPair from_to) const noexcept {
         return db_.GetDistance(from_to);
     }
@@ -133,6 +311,10 @@ namespace transcat {
         return stops_to_vrtx_.at(p_stop);
     }
 
+    bool RequestHandler::IsStopVertex(graph::VertexId vertex_id) const noexcept {
+        return vertex_id < stops_to_vrtx_.size();
+    }
+
     StopPtr RequestHandler::GetStopForVertex(graph::VertexId vertex_id) const {
         return vrtx_to_stops_.at(vertex_id);
     }
@@ -1,11 +1,13 @@
 #pragma once
 
+#include <mutex>
 #include <optional>
 #include <vector>
 #include <unordered_map>
 
 #include "transport_catalogue.h"
 #include "map_renderer.h"
+#include "pareto_router.h"
 
 #include "router.h"
 
@@ -18,6 +20,19 @@ namespace transcat {
         int unique_stop_count = 0;
     };
 
+    // Поездка на одном автобусе между двумя остановками его маршрута (запрос SegmentTime)
+    struct SegmentStat {
+        distance_t route_length = 0;
+        double time = 0;            // мин, без ожидания
+        int span_count = 0;
+    };
+
+    // Размер графа маршрутов
+    struct GraphSize {
+        size_t vertex_count = 0;
+        size_t edge_count = 0;
+    };
+
     // Класс RequestHandler играет роль Фасада, упрощающего взаимодействие JSON reader-а
     // с другими подсистемами приложения.
     // См. паттерн проектирования Фасад: https://ru.wikipedia.org/wiki/Фасад_(шаблон_проектирования)
@@ -37,16 +52,43 @@ namespace transcat {
         // Возвращает информацию о маршруте (запрос Bus)
         [[nodiscard]] std::optional<BusStat> GetBusStat(const std::string_view &bus_name) const;
 
+        // Кратчайший отрезок маршрута автобуса от from до следующего за ней to
+        [[nodiscard]] std::optional<SegmentStat> GetSegmentStat(const Bus *p_bus, StopPair from_to) const;
+
         // Проверяет есть ли автобусы, проходящие через остановку
         bool IsStopInRoutes(const std::string_view &stop_name) const;
 
         // Возвращает маршруты, проходящие через
-        [[nodiscard]] const std::set<const Bus *, TransportCatalogue::BusPtrComparator> *
-        GetBusesByStop(const std::string_view &stop_name) const;
+        [[nodiscard]] TransportCatalogue::BusesRange GetBusesByStop(const std::string_view &stop_name) const;
 
         // Этот метод будет нужен в следующей части итогового проекта
         [[nodiscard]] svg::Document RenderMap() const;
 
+        // Отрисовка фрагмента карты по географической области или по тайлу
+        [[nodiscard]] svg::Document RenderMap(const geo::Box &area) const;
+
+        [[nodiscard]] svg::Document RenderMap(renderer::Tile tile) const;
+
+        // Полная карта с изохроной: остановки, достижимые за budget минут, с временем в пути
+        [[nodiscard]] svg::Document RenderMap(const std::vector<std::pair<StopPtr, double>> &reachable,
+                                              double budget) const;
+
+        // Остановки внутри области
+        [[nodiscard]] std::vector<StopPtr> GetStopsInArea(const geo::Box &area) const;
+
+        // Ближайшие к точке остановки с расстояниями
+        [[nodiscard]] std::vector<std::pair<StopPtr, double>> GetNearestStops(geo::Coordinates point,
+                                                                              size_t count) const;
+
+        // Вершины остановок в пешей доступности от точки с временем подхода (мин)
+        [[nodiscard]] std::vector<graph::Router<double>::Terminal> GetWalkTerminals(geo::Coordinates point) const;
+
+        // Оценка снизу времени в пути между вершинами остановок (мин): расстояние по прямой на скорости автобуса
+        [[nodiscard]] double GetLowerBoundTime(graph::VertexId from, graph::VertexId to) const;
+
+        // Время пешком между точками (мин)
+        [[nodiscard]] double GetWalkTime(double meters) const noexcept;
+
         [[nodiscard]] distance_t GetDistance(StopPair from_to) const noexcept;
 
         RoutingSettings GetRoutingSettings() const noexcept;
@@ -59,20 +101,49 @@ namespace transcat {
 
         graph::VertexId GetVertexForStop(StopPtr p_stop) const;
 
+        // Размер графа, который построит первый конструктор, - без построения (для оценки make_base)
+        [[nodiscard]] static GraphSize EvaluateGraphSize(const TransportCatalogue &db, const RoutingSettings &settings);
+
+        // Собственная вершина остановки (в модели RouteStops есть еще вершины остановок маршрутов)
+        [[nodiscard]] bool IsStopVertex(graph::VertexId vertex_id) const noexcept;
+
+        // Остановка вершины, в том числе вершины остановки маршрута
         StopPtr GetStopForVertex(graph::VertexId vertex_id) const;
 
         const Bus *GetBusByEdge(graph::EdgeId edge_id) const;
 
         void SetBusForEdge(graph::EdgeId edge_id, const Bus *p_bus) const;
 
+        // Поиск маршрутов по времени и числу пересадок строится при первом запросе
+        [[nodiscard]] const ParetoRouter &GetParetoRouter() const;
+
+        // Без таблицы маршрутов включает в router A*, если make_base подтвердил допустимость оценки по прямой
+        void SetupRouter(graph::Router<double> &router) const;
+
     private:
+        // Нумерует вершины: сначала остановки, затем (в модели RouteStops) остановки маршрутов
+        void IndexVertices();
+
+        // Ребра модели RouteStops: посадка (вес - ожидание), перегон (span_count = 1) и высадка (0)
+        void BuildRouteStopEdges(double normal_velocity);
+
+        std::vector<StopPtr> GetRoutedStops() const;
+
+        // Индекс строится при первом запросе фрагмента карты. Ленивые индексы строятся под std::call_once,
+        // а проекция карты - локальная для каждой отрисовки: запросы можно выполнять из нескольких потоков
+        const renderer::MapIndex &GetMapIndex() const;
+
         // RequestHandler использует агрегацию объектов "Транспортный Справочник" и "Визуализатор Карты"
         const TransportCatalogue &db_;
         const renderer::MapRenderer &renderer_;
         RoutingSettings settings_;
         graph::DirectedWeightedGraph<double> route_graph_;
         std::unordered_map<StopPtr, graph::VertexId> stops_to_vrtx_;    // собственные вершины остановки (wait): 1 <-> 1
-        std::vector<StopPtr> vrtx_to_stops_;                            // вершины автобусов этой остановки: 1 <-> 1
+        std::vector<StopPtr> vrtx_to_stops_;                            // остановка каждой вершины графа
+        mutable std::once_flag map_index_flag_;
+        mutable std::optional<renderer::MapIndex> map_index_;
+        mutable std::once_flag pareto_router_flag_;
+        mutable std::optional<ParetoRouter> pareto_router_;
     };
 
 } // namespace transcat
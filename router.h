@@ -1,13 +1,22 @@
 #pragma once
 
 #include "graph.h"
+#include "profile.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <exception>
 #include <iterator>
+#include <memory>
+#include <functional>
+#include <mutex>
 #include <optional>
+#include <queue>
+#include <set>
 #include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -23,14 +32,30 @@ namespace graph {
             Weight weight;
             std::optional<EdgeId> prev_edge;
         };
-        using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+        using RoutesRow = std::vector<std::optional<RouteInternalData>>;
+        using RoutesInternalData = std::vector<RoutesRow>;
 
         explicit Router(const Graph &graph);
 
+        // Пустая routes_internal_data - таблица не построена, маршруты ищутся по запросу
         Router(const Graph &graph, RoutesInternalData routes_internal_data);
 
         const RoutesInternalData &GetRoutesInternalData();
 
+        [[nodiscard]] bool HasRoutesInternalData() const noexcept;
+
+        // Оценка снизу веса маршрута из vertex в to. Должна быть согласованной: не больше веса ребра
+        // vertex -> u плюс оценки из u. С ней маршруты без таблицы ищутся A*, а не Дейкстрой
+        using Heuristic = std::function<Weight(VertexId vertex, VertexId to)>;
+
+        void SetHeuristic(Heuristic heuristic);
+
+        // Строки таблицы по требованию (например, из файла базы) вместо таблицы в памяти.
+        // Вызывается из любого потока; маршрут из from читает только строку from
+        using RoutesRowLoader = std::function<RoutesRow(VertexId from)>;
+
+        void SetRoutesRowLoader(RoutesRowLoader loader);
+
         struct RouteInfo {
             Weight weight;
             std::vector<EdgeId> edges;
@@ -38,7 +63,67 @@ namespace graph {
 
         std::optional<RouteInfo> BuildRoute(VertexId from, VertexId to) const;
 
+        // Строка маршрутов из from: из таблицы (в памяти - без копирования) или, без таблицы, поиском Дейкстры.
+        // По ней маршруты из from во все вершины восстанавливаются без новых поисков
+        std::shared_ptr<const RoutesRow> GetRoutesRow(VertexId from) const;
+
+        // Маршрут в to по строке маршрутов из его начала
+        std::optional<RouteInfo> BuildRouteByRow(const RoutesRow &row, VertexId to) const;
+
+        // До count маршрутов без повторных вершин по возрастанию веса (алгоритм Йена). Первый - кратчайший;
+        // каждый следующий - лучший из кандидатов, накопленных при поиске всех предыдущих
+        std::vector<RouteInfo> BuildRoutes(VertexId from, VertexId to, size_t count) const;
+
+        // Поиски без таблицы считают в профиле запуски и извлеченные из очереди вершины: router.dijkstra_*
+        // (все поиски Дейкстры из одной вершины или из нескольких), router.astar_* и router.bidirectional_*
+
+        // Кратчайшие маршруты из одной вершины во все (строка RoutesInternalData) - поиск Дейкстры
+        std::vector<std::optional<RouteInternalData>> BuildRoutesFrom(VertexId from) const;
+
+        // Веса кратчайших маршрутов из from в каждую из targets: из таблицы, а без нее - поиском Дейкстры,
+        // который останавливается, как только все targets достигнуты
+        std::vector<std::optional<Weight>> BuildWeights(VertexId from, const std::vector<VertexId> &targets) const;
+
+        // Вершины, достижимые из from с весом не больше budget, по возрастанию веса. Без таблицы - поиск Дейкстры,
+        // остановленный на границе budget; память пропорциональна числу просмотренных вершин
+        std::vector<std::pair<VertexId, Weight>> BuildWeightsWithin(VertexId from, Weight budget) const;
+
+        // Матрица весов sources x targets. Без таблицы строки считаются независимыми поисками в thread_count потоках
+        std::vector<std::vector<std::optional<Weight>>> BuildWeights(const std::vector<VertexId> &sources,
+                                                                     const std::vector<VertexId> &targets,
+                                                                     size_t thread_count) const;
+
+        // Начальная или конечная вершина маршрута с дополнительным весом (например, временем пешего подхода)
+        struct Terminal {
+            VertexId vertex;
+            Weight weight;
+        };
+
+        struct TerminalRouteInfo {
+            Weight weight;      // включая веса начальной и конечной вершин
+            VertexId from;
+            VertexId to;
+            std::vector<EdgeId> edges;
+        };
+
+        // Лучший маршрут от любой из sources до любой из targets - один поиск Дейкстры из всех sources сразу
+        std::optional<TerminalRouteInfo> BuildRoute(const std::vector<Terminal> &sources,
+                                                    const std::vector<Terminal> &targets) const;
+
     private:
+        std::optional<RouteInfo> BuildRouteAStar(VertexId from, VertexId to) const;
+
+        // Встречный поиск Дейкстры: от from по ребрам и от to по обратным ребрам до встречи
+        std::optional<RouteInfo> BuildRouteBidirectional(VertexId from, VertexId to) const;
+
+        // Входящие ребра вершин (обратный граф) строятся один раз, при первом встречном поиске
+        void BuildReverseEdges() const;
+
+        // Кратчайший маршрут, не проходящий через запрещенные вершины и ребра - поиск Дейкстры
+        std::optional<RouteInfo> BuildRouteAvoiding(VertexId from, VertexId to,
+                                                    const std::vector<bool> &banned_vertices,
+                                                    const std::set<EdgeId> &banned_edges) const;
+
         void InitializeRoutesInternalData(const Graph &graph) {
             const size_t vertex_count = graph.GetVertexCount();
             for (VertexId vertex = 0; vertex < vertex_count; ++vertex) {
@@ -81,6 +166,11 @@ namespace graph {
         static constexpr Weight ZERO_WEIGHT{};
         const Graph &graph_;
         RoutesInternalData routes_internal_data_;
+        Heuristic heuristic_;
+        RoutesRowLoader routes_row_loader_;
+        mutable std::once_flag reverse_edges_flag_;
+        mutable std::vector<size_t> reverse_offsets_;     // входящие ребра вершины v: [offsets[v], offsets[v + 1])
+        mutable std::vector<EdgeId> reverse_edges_;
     };
 
     template<typename Weight>
@@ -88,12 +178,21 @@ namespace graph {
             : graph_(graph), routes_internal_data_(graph.GetVertexCount(),
                                                    std::vector<std::optional<RouteInternalData>>(
                                                            graph.GetVertexCount())) {
+        PROFILE_SCOPE("build_router");
         InitializeRoutesInternalData(graph);
 
         const size_t vertex_count = graph.GetVertexCount();
         for (VertexId vertex_through = 0; vertex_through < vertex_count; ++vertex_through) {
             RelaxRoutesInternalDataThroughVertex(vertex_count, vertex_through);
         }
+
+        if (profile::IsEnabled()) {
+            size_t filled_cells = 0;
+            for (const auto &row: routes_internal_data_) {
+                filled_cells += std::count_if(row.begin(), row.end(), [](const auto &data) { return data.has_value(); });
+            }
+            PROFILE_COUNT("router.cells_filled", filled_cells);
+        }
     }
 
     template<typename Weight>
@@ -106,10 +205,49 @@ namespace graph {
         return routes_internal_data_;
     }
 
+    template<typename Weight>
+    bool Router<Weight>::HasRoutesInternalData() const noexcept {
+        return !routes_internal_data_.empty() || routes_row_loader_;
+    }
+
+    template<typename Weight>
+    void Router<Weight>::SetRoutesRowLoader(RoutesRowLoader loader) {
+        routes_row_loader_ = std::move(loader);
+    }
+
+    template<typename Weight>
+    std::shared_ptr<const typename Router<Weight>::RoutesRow> Router<Weight>::GetRoutesRow(VertexId from) const {
+        if (routes_row_loader_) {
+            return std::make_shared<const RoutesRow>(routes_row_loader_(from));
+        }
+        if (routes_internal_data_.empty()) {
+            return std::make_shared<const RoutesRow>(BuildRoutesFrom(from));
+        }
+        // строка принадлежит таблице - указатель без владения
+        return std::shared_ptr<const RoutesRow>(std::shared_ptr<const RoutesRow>(), &routes_internal_data_.at(from));
+    }
+
+    template<typename Weight>
+    void Router<Weight>::SetHeuristic(Heuristic heuristic) {
+        heuristic_ = std::move(heuristic);
+    }
+
     template<typename Weight>
     std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexId from,
                                                                                  VertexId to) const {
-        const auto &route_internal_data = routes_internal_data_.at(from).at(to);
+        if (!HasRoutesInternalData() && heuristic_) {
+            return BuildRouteAStar(from, to);
+        }
+        if (!HasRoutesInternalData()) {
+            return BuildRouteBidirectional(from, to);
+        }
+        return BuildRouteByRow(*GetRoutesRow(from), to);
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRouteByRow(const RoutesRow &row,
+                                                                                      VertexId to) const {
+        const auto &route_internal_data = row.at(to);
         if (!route_internal_data) {
             return std::nullopt;
         }
@@ -117,7 +255,7 @@ namespace graph {
         std::vector<EdgeId> edges;
         for (std::optional<EdgeId> edge_id = route_internal_data->prev_edge;
              edge_id;
-             edge_id = routes_internal_data_[from][graph_.GetEdge(*edge_id).from]->prev_edge) {
+             edge_id = row[graph_.GetEdge(*edge_id).from]->prev_edge) {
             edges.push_back(*edge_id);
         }
         std::reverse(edges.begin(), edges.end());
@@ -125,4 +263,518 @@ namespace graph {
         return RouteInfo{weight, std::move(edges)};
     }
 
+    template<typename Weight>
+    std::vector<std::optional<typename Router<Weight>::RouteInternalData>>
+    Router<Weight>::BuildRoutesFrom(VertexId from) const {
+        PROFILE_COUNT("router.dijkstra_runs", 1);
+        std::vector<std::optional<RouteInternalData>> routes(graph_.GetVertexCount());
+        routes.at(from) = RouteInternalData{ZERO_WEIGHT, std::nullopt};
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        queue.push({ZERO_WEIGHT, from});
+        size_t settled = 0;
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (routes[vertex]->weight < weight) {
+                continue;
+            }
+            ++settled;
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                if (edge.weight < ZERO_WEIGHT) {
+                    throw std::domain_error("Edges' weights should be non-negative");
+                }
+                const Weight candidate = weight + edge.weight;
+                auto &route = routes[edge.to];
+                if (!route || candidate < route->weight) {
+                    route = RouteInternalData{candidate, edge_id};
+                    queue.push({candidate, edge.to});
+                }
+            }
+        }
+        PROFILE_COUNT("router.dijkstra_settled", settled);
+        return routes;
+    }
+
+    template<typename Weight>
+    std::vector<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoutes(VertexId from, VertexId to,
+                                                                                size_t count) const {
+        std::vector<RouteInfo> routes;
+        if (count == 0) {
+            return routes;
+        }
+        if (auto route = BuildRoute(from, to)) {
+            routes.push_back(std::move(*route));
+        }
+
+        // кандидаты упорядочены по весу, затем по ребрам - одинаковые не повторяются
+        auto less = [](const RouteInfo &lhs, const RouteInfo &rhs) {
+            return lhs.weight < rhs.weight || (!(rhs.weight < lhs.weight) && lhs.edges < rhs.edges);
+        };
+        std::set<RouteInfo, decltype(less)> candidates(less);
+        std::vector<bool> banned_vertices(graph_.GetVertexCount(), false);
+
+        while (!routes.empty() && routes.size() < count) {
+            const std::vector<EdgeId> &previous = routes.back().edges;
+            Weight root_weight = ZERO_WEIGHT;
+            VertexId spur = from;
+            // маршрут - общее с previous начало из i ребер и новое продолжение из вершины spur
+            for (size_t i = 0; i < previous.size(); ++i) {
+                std::set<EdgeId> banned_edges;
+                for (const RouteInfo &route: routes) {
+                    if (route.edges.size() > i && std::equal(previous.begin(), previous.begin() + i,
+                                                             route.edges.begin())) {
+                        banned_edges.insert(route.edges[i]);
+                    }
+                }
+                if (auto spur_route = BuildRouteAvoiding(spur, to, banned_vertices, banned_edges)) {
+                    RouteInfo candidate{root_weight + spur_route->weight,
+                                        std::vector<EdgeId>(previous.begin(), previous.begin() + i)};
+                    candidate.edges.insert(candidate.edges.end(), spur_route->edges.begin(), spur_route->edges.end());
+                    candidates.insert(std::move(candidate));
+                }
+
+                banned_vertices[spur] = true;   // начало маршрута не повторяется в продолжении
+                const auto &edge = graph_.GetEdge(previous[i]);
+                root_weight += edge.weight;
+                spur = edge.to;
+            }
+            std::fill(banned_vertices.begin(), banned_vertices.end(), false);
+
+            if (candidates.empty()) {
+                break;
+            }
+            routes.push_back(std::move(candidates.extract(candidates.begin()).value()));
+        }
+        return routes;
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRouteAStar(VertexId from,
+                                                                                      VertexId to) const {
+        PROFILE_COUNT("router.astar_runs", 1);
+        const size_t vertex_count = graph_.GetVertexCount();
+        std::vector<std::optional<Weight>> weights(vertex_count);
+        std::vector<std::optional<EdgeId>> prev_edges(vertex_count);
+
+        // в очереди - вес до вершины плюс оценка остатка
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        weights.at(from) = ZERO_WEIGHT;
+        queue.push({heuristic_(from, to), from});
+        size_t settled = 0;
+        while (!queue.empty()) {
+            const auto [estimate, vertex] = queue.top();
+            queue.pop();
+            const Weight weight = *weights[vertex];
+            if (weight + heuristic_(vertex, to) < estimate) {
+                continue;
+            }
+            ++settled;
+            if (vertex == to) {
+                break;
+            }
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                const Weight candidate = weight + edge.weight;
+                if (!weights[edge.to] || candidate < *weights[edge.to]) {
+                    weights[edge.to] = candidate;
+                    prev_edges[edge.to] = edge_id;
+                    queue.push({candidate + heuristic_(edge.to, to), edge.to});
+                }
+            }
+        }
+        PROFILE_COUNT("router.astar_settled", settled);
+
+        if (!weights.at(to)) {
+            return std::nullopt;
+        }
+        std::vector<EdgeId> edges;
+        for (std::optional<EdgeId> edge_id = prev_edges[to]; edge_id;
+             edge_id = prev_edges[graph_.GetEdge(*edge_id).from]) {
+            edges.push_back(*edge_id);
+        }
+        std::reverse(edges.begin(), edges.end());
+        return RouteInfo{*weights[to], std::move(edges)};
+    }
+
+    template<typename Weight>
+    void Router<Weight>::BuildReverseEdges() const {
+        std::call_once(reverse_edges_flag_, [this]() {
+            PROFILE_SCOPE("build_reverse_graph");
+            const size_t vertex_count = graph_.GetVertexCount();
+            const size_t edge_count = graph_.GetEdgeCount();
+            std::vector<size_t> offsets(vertex_count + 1, 0);
+            for (EdgeId edge_id = 0; edge_id < edge_count; ++edge_id) {
+                ++offsets[graph_.GetEdge(edge_id).to + 1];
+            }
+            for (size_t vertex = 0; vertex < vertex_count; ++vertex) {
+                offsets[vertex + 1] += offsets[vertex];
+            }
+            reverse_edges_.resize(edge_count);
+            std::vector<size_t> positions(offsets.begin(), offsets.end() - 1);
+            for (EdgeId edge_id = 0; edge_id < edge_count; ++edge_id) {
+                reverse_edges_[positions[graph_.GetEdge(edge_id).to]++] = edge_id;
+            }
+            reverse_offsets_ = std::move(offsets);
+        });
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRouteBidirectional(VertexId from,
+                                                                                              VertexId to) const {
+        BuildReverseEdges();
+        PROFILE_COUNT("router.bidirectional_runs", 1);
+        const size_t vertex_count = graph_.GetVertexCount();
+        // [0] - прямой поиск от from, [1] - обратный от to
+        std::vector<std::optional<Weight>> weights[2]{std::vector<std::optional<Weight>>(vertex_count),
+                                                      std::vector<std::optional<Weight>>(vertex_count)};
+        std::vector<std::optional<EdgeId>> edges_to[2]{std::vector<std::optional<EdgeId>>(vertex_count),
+                                                       std::vector<std::optional<EdgeId>>(vertex_count)};
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        using Queue = std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>>;
+        Queue queues[2];
+        weights[0].at(from) = ZERO_WEIGHT;
+        weights[1].at(to) = ZERO_WEIGHT;
+        queues[0].push({ZERO_WEIGHT, from});
+        queues[1].push({ZERO_WEIGHT, to});
+
+        // лучший найденный маршрут: вес и вершина встречи
+        std::optional<Weight> best_weight;
+        VertexId meeting = from;
+        if (from == to) {
+            best_weight = ZERO_WEIGHT;
+        }
+
+        size_t settled = 0;
+        while (!queues[0].empty() && !queues[1].empty()) {
+            // маршрут короче найденного должен был бы пройти через вершины обеих очередей
+            if (best_weight && !(queues[0].top().first + queues[1].top().first < *best_weight)) {
+                break;
+            }
+            const size_t side = queues[1].top().first < queues[0].top().first ? 1 : 0;
+            const auto [weight, vertex] = queues[side].top();
+            queues[side].pop();
+            if (*weights[side][vertex] < weight) {
+                continue;
+            }
+            ++settled;
+
+            auto relax = [&](EdgeId edge_id, VertexId next) {
+                const Weight candidate = weight + graph_.GetEdge(edge_id).weight;
+                auto &next_weight = weights[side][next];
+                if (!next_weight || candidate < *next_weight) {
+                    next_weight = candidate;
+                    edges_to[side][next] = edge_id;
+                    queues[side].push({candidate, next});
+                }
+                if (const auto &other_weight = weights[1 - side][next]) {
+                    const Weight total = *next_weight + *other_weight;
+                    if (!best_weight || total < *best_weight) {
+                        best_weight = total;
+                        meeting = next;
+                    }
+                }
+            };
+            if (side == 0) {
+                for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                    relax(edge_id, graph_.GetEdge(edge_id).to);
+                }
+            } else {
+                for (size_t i = reverse_offsets_[vertex]; i < reverse_offsets_[vertex + 1]; ++i) {
+                    relax(reverse_edges_[i], graph_.GetEdge(reverse_edges_[i]).from);
+                }
+            }
+        }
+        PROFILE_COUNT("router.bidirectional_settled", settled);
+
+        if (!best_weight) {
+            return std::nullopt;
+        }
+        // ребра исходного графа: от from до встречи, затем от встречи до to
+        std::vector<EdgeId> edges;
+        for (VertexId vertex = meeting; edges_to[0][vertex]; vertex = graph_.GetEdge(*edges_to[0][vertex]).from) {
+            edges.push_back(*edges_to[0][vertex]);
+        }
+        std::reverse(edges.begin(), edges.end());
+        for (VertexId vertex = meeting; edges_to[1][vertex]; vertex = graph_.GetEdge(*edges_to[1][vertex]).to) {
+            edges.push_back(*edges_to[1][vertex]);
+        }
+        return RouteInfo{*best_weight, std::move(edges)};
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo>
+    Router<Weight>::BuildRouteAvoiding(VertexId from, VertexId to, const std::vector<bool> &banned_vertices,
+                                       const std::set<EdgeId> &banned_edges) const {
+        PROFILE_COUNT("router.dijkstra_runs", 1);
+        const size_t vertex_count = graph_.GetVertexCount();
+        std::vector<std::optional<Weight>> weights(vertex_count);
+        std::vector<std::optional<EdgeId>> prev_edges(vertex_count);
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        weights.at(from) = ZERO_WEIGHT;
+        queue.push({ZERO_WEIGHT, from});
+        size_t settled = 0;
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (*weights[vertex] < weight) {
+                continue;
+            }
+            ++settled;
+            if (vertex == to) {
+                break;
+            }
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                if (banned_vertices[edge.to] || banned_edges.count(edge_id)) {
+                    continue;
+                }
+                const Weight candidate = weight + edge.weight;
+                if (!weights[edge.to] || candidate < *weights[edge.to]) {
+                    weights[edge.to] = candidate;
+                    prev_edges[edge.to] = edge_id;
+                    queue.push({candidate, edge.to});
+                }
+            }
+        }
+        PROFILE_COUNT("router.dijkstra_settled", settled);
+
+        if (!weights.at(to)) {
+            return std::nullopt;
+        }
+        std::vector<EdgeId> edges;
+        for (std::optional<EdgeId> edge_id = prev_edges[to]; edge_id;
+             edge_id = prev_edges[graph_.GetEdge(*edge_id).from]) {
+            edges.push_back(*edge_id);
+        }
+        std::reverse(edges.begin(), edges.end());
+        return RouteInfo{*weights[to], std::move(edges)};
+    }
+
+    template<typename Weight>
+    std::vector<std::optional<Weight>> Router<Weight>::BuildWeights(VertexId from,
+                                                                    const std::vector<VertexId> &targets) const {
+        std::vector<std::optional<Weight>> result(targets.size());
+        if (HasRoutesInternalData()) {
+            const auto row_ptr = GetRoutesRow(from);
+            const auto &row = *row_ptr;
+            for (size_t i = 0; i < targets.size(); ++i) {
+                if (const auto &route = row.at(targets[i])) {
+                    result[i] = route->weight;
+                }
+            }
+            return result;
+        }
+
+        PROFILE_COUNT("router.dijkstra_runs", 1);
+        const size_t vertex_count = graph_.GetVertexCount();
+        std::vector<std::optional<Weight>> weights(vertex_count);
+        std::vector<bool> is_target(vertex_count, false);
+        size_t targets_left = 0;
+        for (const VertexId target: targets) {
+            if (!is_target.at(target)) {
+                is_target[target] = true;
+                ++targets_left;
+            }
+        }
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        weights.at(from) = ZERO_WEIGHT;
+        queue.push({ZERO_WEIGHT, from});
+        size_t settled = 0;
+        while (!queue.empty() && targets_left > 0) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (*weights[vertex] < weight) {
+                continue;
+            }
+            ++settled;
+            if (is_target[vertex]) {
+                is_target[vertex] = false;
+                --targets_left;
+            }
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                const Weight candidate = weight + edge.weight;
+                if (!weights[edge.to] || candidate < *weights[edge.to]) {
+                    weights[edge.to] = candidate;
+                    queue.push({candidate, edge.to});
+                }
+            }
+        }
+        PROFILE_COUNT("router.dijkstra_settled", settled);
+        // поиск остановлен, когда все достижимые targets уже извлечены из очереди - их веса окончательные
+        for (size_t i = 0; i < targets.size(); ++i) {
+            result[i] = weights[targets[i]];
+        }
+        return result;
+    }
+
+    template<typename Weight>
+    std::vector<std::pair<VertexId, Weight>> Router<Weight>::BuildWeightsWithin(VertexId from, Weight budget) const {
+        std::vector<std::pair<VertexId, Weight>> result;
+        if (HasRoutesInternalData()) {
+            const auto row_ptr = GetRoutesRow(from);
+            const auto &row = *row_ptr;
+            for (VertexId vertex = 0; vertex < row.size(); ++vertex) {
+                if (row[vertex] && !(budget < row[vertex]->weight)) {
+                    result.emplace_back(vertex, row[vertex]->weight);
+                }
+            }
+            std::stable_sort(result.begin(), result.end(), [](const auto &lhs, const auto &rhs) {
+                return lhs.second < rhs.second;
+            });
+            return result;
+        }
+
+        PROFILE_COUNT("router.dijkstra_runs", 1);
+        std::unordered_map<VertexId, Weight> weights;
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        weights.emplace(from, ZERO_WEIGHT);
+        queue.push({ZERO_WEIGHT, from});
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (weights.at(vertex) < weight) {
+                continue;
+            }
+            // вершины извлекаются по возрастанию веса - порядок результата готов
+            result.emplace_back(vertex, weight);
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                const Weight candidate = weight + edge.weight;
+                if (budget < candidate) {
+                    continue;
+                }
+                const auto [it, is_inserted] = weights.emplace(edge.to, candidate);
+                if (is_inserted || candidate < it->second) {
+                    it->second = candidate;
+                    queue.push({candidate, edge.to});
+                }
+            }
+        }
+        PROFILE_COUNT("router.dijkstra_settled", result.size());    // каждая извлеченная вершина - в результате
+        return result;
+    }
+
+    template<typename Weight>
+    std::vector<std::vector<std::optional<Weight>>>
+    Router<Weight>::BuildWeights(const std::vector<VertexId> &sources, const std::vector<VertexId> &targets,
+                                 size_t thread_count) const {
+        std::vector<std::vector<std::optional<Weight>>> result(sources.size());
+        // по таблице в памяти строка - это выборка, потоки не окупятся
+        if (!routes_internal_data_.empty()) {
+            thread_count = 1;
+        }
+        thread_count = std::max<size_t>(1, std::min(thread_count, sources.size()));
+
+        std::atomic<size_t> next_source{0};
+        std::vector<std::exception_ptr> errors(thread_count);
+        auto worker = [&](size_t thread_index) {
+            try {
+                for (size_t i = next_source++; i < sources.size(); i = next_source++) {
+                    result[i] = BuildWeights(sources[i], targets);
+                }
+            } catch (...) {
+                errors[thread_index] = std::current_exception();
+                next_source = sources.size();   // остальные потоки не берут новых строк
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(thread_count - 1);
+        for (size_t i = 1; i < thread_count; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        for (const auto &error: errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        return result;
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::TerminalRouteInfo>
+    Router<Weight>::BuildRoute(const std::vector<Terminal> &sources, const std::vector<Terminal> &targets) const {
+        PROFILE_COUNT("router.dijkstra_runs", 1);
+        const size_t vertex_count = graph_.GetVertexCount();
+        std::vector<std::optional<Weight>> weights(vertex_count);
+        std::vector<std::optional<EdgeId>> prev_edges(vertex_count);
+        std::vector<std::optional<Weight>> target_weights(vertex_count);
+        for (const Terminal &target: targets) {
+            auto &target_weight = target_weights.at(target.vertex);
+            if (!target_weight || target.weight < *target_weight) {
+                target_weight = target.weight;
+            }
+        }
+
+        using QueueItem = std::pair<Weight, VertexId>;
+        std::priority_queue<QueueItem, std::vector<QueueItem>, std::greater<>> queue;
+        for (const Terminal &source: sources) {
+            auto &weight = weights.at(source.vertex);
+            if (!weight || source.weight < *weight) {
+                weight = source.weight;
+                queue.push({source.weight, source.vertex});
+            }
+        }
+
+        std::optional<Weight> best_weight;
+        VertexId best_target = 0;
+        size_t settled = 0;
+        while (!queue.empty()) {
+            const auto [weight, vertex] = queue.top();
+            queue.pop();
+            if (best_weight && !(weight < *best_weight)) {
+                break;  // оставшиеся вершины не улучшат найденный маршрут
+            }
+            if (*weights[vertex] < weight) {
+                continue;
+            }
+            ++settled;
+            if (const auto &target_weight = target_weights[vertex]) {
+                const Weight candidate = weight + *target_weight;
+                if (!best_weight || candidate < *best_weight) {
+                    best_weight = candidate;
+                    best_target = vertex;
+                }
+            }
+            for (const EdgeId edge_id: graph_.GetIncidentEdges(vertex)) {
+                const auto &edge = graph_.GetEdge(edge_id);
+                const Weight candidate = weight + edge.weight;
+                if (!weights[edge.to] || candidate < *weights[edge.to]) {
+                    weights[edge.to] = candidate;
+                    prev_edges[edge.to] = edge_id;
+                    queue.push({candidate, edge.to});
+                }
+            }
+        }
+
+        PROFILE_COUNT("router.dijkstra_settled", settled);
+
+        if (!best_weight) {
+            return std::nullopt;
+        }
+        std::vector<EdgeId> edges;
+        VertexId vertex = best_target;
+        for (std::optional<EdgeId> edge_id = prev_edges[vertex]; edge_id; edge_id = prev_edges[vertex]) {
+            edges.push_back(*edge_id);
+            vertex = graph_.GetEdge(*edge_id).from;
+        }
+        std::reverse(edges.begin(), edges.end());
+
+        return TerminalRouteInfo{*best_weight, vertex, best_target, std::move(edges)};
+    }
+
 }  // namespace graph
\ No newline at end of file
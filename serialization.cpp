@@ -1,7 +1,23 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <climits>
 #include <fstream>
 #include <map>
+#include <stdexcept>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/wire_format_lite.h>
 
 #include "serialization.h"
+#include "profile.h"
 
 namespace transcat {
 
@@ -24,14 +40,93 @@ namespace transcat {
     }
 
     void CatalogueSerializer::SerializeTo(const std::filesystem::path &path) {
-        SerializeDb();
-        SerializeGraph();
-        SerializeRoutesInternalData();
+        PROFILE_SCOPE("serialize");
+        {
+            PROFILE_SCOPE("db");
+            SerializeDb();
+            SerializeGraph();
+        }
+        {
+            PROFILE_SCOPE("routes");
+            SerializeRoutesInternalData();
+        }
         SerializeRenderSettings();
         SerializeRoutingSettings();
-        std::ofstream out_file(path, std::ios::binary);
-        proto_db_.SerializeToOstream(&out_file);
+        SerializeStopIndex();
+        PROFILE_SCOPE("write");
+        // база пишется во временный файл и подменяет прежнюю целиком: прежний файл может быть
+        // отображен в память загруженным снимком, и перезапись на месте обрезала бы его отображение
+        std::filesystem::path temp_path = path;
+        temp_path += ".tmp";
+        std::ofstream out_file(temp_path, std::ios::binary);
+        if (routing_settings_.engine == RoutingEngine::OutOfCore) {
+            WriteWithRoutesSection(out_file);
+        } else {
+            proto_db_.SerializeToOstream(&out_file);
+        }
         out_file.close();
+        if (!out_file) {
+            std::filesystem::remove(temp_path);
+            throw std::runtime_error("Cannot write the base file " + path.string());
+        }
+        std::filesystem::rename(temp_path, path);
+    }
+
+    void CatalogueSerializer::WriteWithRoutesSection(std::ostream &out) const {
+        using google::protobuf::internal::WireFormatLite;
+        constexpr size_t rows_per_thread = 16;
+
+        google::protobuf::io::OstreamOutputStream stream(&out);
+        google::protobuf::io::CodedOutputStream coded(&stream);
+        RoutesOffsetCounter offsets(proto_db_.ByteSizeLong());
+        proto_db_.SerializeWithCachedSizes(&coded);
+
+        const graph::Router<double> router(graph_, {});
+        const size_t vertex_count = graph_.GetVertexCount();
+        const size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+        std::vector<google::protobuf::uint64> row_offsets;
+        row_offsets.reserve(vertex_count + 1);
+        std::vector<std::string> batch(thread_count * rows_per_thread);
+
+        for (graph::VertexId first = 0; first < vertex_count; first += batch.size()) {
+            // строки пачки считаются параллельно, а пишутся по порядку
+            const size_t count = std::min(batch.size(), vertex_count - first);
+            std::atomic<size_t> next_row{0};
+            auto worker = [&]() {
+                for (size_t i = next_row++; i < count; i = next_row++) {
+                    batch[i] = RoutesRowToProto(router.BuildRoutesFrom(first + i), graph_).SerializeAsString();
+                }
+            };
+            std::vector<std::thread> threads;
+            for (size_t i = 1; i < std::min(thread_count, count); ++i) {
+                threads.emplace_back(worker);
+            }
+            worker();
+            for (auto &thread: threads) {
+                thread.join();
+            }
+            for (size_t i = 0; i < count; ++i) {
+                row_offsets.push_back(offsets.AddRow(batch[i].size()));
+                coded.WriteTag(WireFormatLite::MakeTag(pb3::TransportCatalogue::kCompactRouterFieldNumber,
+                                                       WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+                coded.WriteVarint32(static_cast<google::protobuf::uint32>(batch[i].size()));
+                coded.WriteString(batch[i]);
+            }
+        }
+        PROFILE_COUNT("serialize.streamed_rows", vertex_count);
+
+        const google::protobuf::uint64 index_offset = offsets.GetOffset();
+        assert(index_offset > INT_MAX || index_offset == static_cast<google::protobuf::uint64>(coded.ByteCount()));
+        row_offsets.push_back(index_offset);
+        coded.WriteTag(WireFormatLite::MakeTag(pb3::TransportCatalogue::kRoutesRowOffsetsFieldNumber,
+                                               WireFormatLite::WIRETYPE_LENGTH_DELIMITED));
+        coded.WriteVarint32(static_cast<google::protobuf::uint32>(row_offsets.size() * sizeof(google::protobuf::uint64)));
+        for (const auto offset: row_offsets) {
+            coded.WriteLittleEndian64(offset);
+        }
+        coded.WriteTag(WireFormatLite::MakeTag(pb3::TransportCatalogue::kRoutesIndexOffsetFieldNumber,
+                                               WireFormatLite::WIRETYPE_FIXED64));
+        coded.WriteLittleEndian64(index_offset);
     }
 
     void CatalogueSerializer::SerializeDb() {
@@ -41,14 +136,21 @@ namespace transcat {
 
         // выгрузим stops_
         size_t stop_id = 0;
+        proto_db_.mutable_names()->reserve(db_.names_.GetSize());
         for (const Stop &stop: db_.stops_) {
-            proto_db_.mutable_stops()->Add(StopToProto(&stop));
+            pb3::Stop proto_stop = StopToProto(&stop);
+            proto_stop.set_name_offset(AddName(stop.name));
+            proto_stop.set_name_size(static_cast<google::protobuf::uint32>(stop.name.size()));
+            proto_db_.mutable_stops()->Add(std::move(proto_stop));
             stops_id[&stop] = stop_id++;
         }
         // выгрузим buses_
         size_t bus_id = 0;
         for (const Bus &bus: db_.buses_) {
-            proto_db_.mutable_buses()->Add(BusToProto(&bus, stops_id));
+            pb3::Bus proto_bus = BusToProto(&bus, stops_id);
+            proto_bus.set_name_offset(AddName(bus.name));
+            proto_bus.set_name_size(static_cast<google::protobuf::uint32>(bus.name.size()));
+            proto_db_.mutable_buses()->Add(std::move(proto_bus));
             buses_id[&bus] = bus_id++;
         }
         // выгрузим distances_
@@ -59,13 +161,36 @@ namespace transcat {
             proto_distance.set_distance(distance);
             proto_db_.mutable_distances()->Add(std::move(proto_distance));
         }
+        // выгрузим индекс автобусов по остановкам, если он построен
+        if (!db_.stop_bus_offsets_.empty()) {
+            pb3::StopBuses *proto_stop_buses = proto_db_.mutable_stop_buses();
+            proto_stop_buses->mutable_offsets()->Add(db_.stop_bus_offsets_.begin(), db_.stop_bus_offsets_.end());
+            proto_stop_buses->mutable_buses()->Reserve(static_cast<int>(db_.stop_buses_.size()));
+            for (const Bus *p_bus: db_.stop_buses_) {
+                proto_stop_buses->add_buses(static_cast<google::protobuf::uint32>(buses_id.at(p_bus)));
+            }
+        }
         // выгрузим edges_to_buses_
         for (const Bus *p_bus: db_.edges_to_buses_) {
             proto_db_.mutable_edges_to_buses()->Add(buses_id.at(p_bus));
         }
+        // выгрузим timetable_
+        pb3::Timetable *proto_timetable = proto_db_.mutable_timetable();
+        for (const Connection &connection: db_.timetable_.GetConnections()) {
+            proto_timetable->add_departures(connection.departure);
+            proto_timetable->add_arrivals(connection.arrival);
+            proto_timetable->add_from_stops(connection.from);
+            proto_timetable->add_to_stops(connection.to);
+            proto_timetable->add_trips(connection.trip);
+            proto_timetable->add_sequences(connection.sequence);
+        }
+        for (const Bus *p_bus: db_.timetable_.GetTripBuses()) {
+            proto_timetable->add_trip_buses(static_cast<google::protobuf::uint32>(buses_id.at(p_bus)));
+        }
     }
 
     void CatalogueSerializer::SerializeGraph() {
+        proto_db_.set_vertex_count(static_cast<google::protobuf::uint32>(graph_.GetVertexCount()));
         for (graph::EdgeId edge_id = 0; edge_id < graph_.GetEdgeCount(); ++edge_id) {
             const auto &edge = graph_.GetEdge(edge_id);
             pb3::Edge proto_edge;
@@ -78,22 +203,8 @@ namespace transcat {
     }
 
     void CatalogueSerializer::SerializeRoutesInternalData() {
-        for (const auto &v: routes_internal_data_) {
-            pb3::RoutesInternalData proto_list;
-            for (const auto &data: v) {
-                pb3::OptionalData proto_data;
-                proto_data.set_has_value(data.has_value());
-                if (data.has_value()) {
-                    proto_data.set_weight(data->weight);
-                    if (data->prev_edge.has_value()) {
-                        proto_data.set_prev_edge(static_cast<google::protobuf::int32>(data->prev_edge.value()));
-                    } else {
-                        proto_data.set_prev_edge(-1);   // -1  - признак отсутствия значения
-                    }
-                }
-                proto_list.mutable_list()->Add(std::move(proto_data));
-            }
-            proto_db_.mutable_router()->Add(std::move(proto_list));
+        for (const auto &row: routes_internal_data_) {
+            proto_db_.mutable_compact_router()->Add(RoutesRowToProto(row, graph_));
         }
     }
 
@@ -121,6 +232,58 @@ namespace transcat {
         pb3::RoutingSettings *proto_settings = proto_db_.mutable_routing_settings();
         proto_settings->set_bus_wait_time(routing_settings_.bus_wait_time);
         proto_settings->set_bus_velocity(routing_settings_.bus_velocity);
+        proto_settings->set_walk_velocity(routing_settings_.walk_velocity);
+        proto_settings->set_max_walk_distance(routing_settings_.max_walk_distance);
+        proto_settings->set_on_demand(routing_settings_.engine == RoutingEngine::OnDemand);
+        proto_settings->set_out_of_core(routing_settings_.engine == RoutingEngine::OutOfCore);
+        proto_settings->set_geo_heuristic(routing_settings_.use_geo_heuristic);
+        proto_settings->set_route_stops(routing_settings_.graph_model == RouteGraphModel::RouteStops);
+    }
+
+    void CatalogueSerializer::SerializeStopIndex() {
+        const geo::GridIndex &index = db_.stop_index_;
+        pb3::StopIndex *proto_index = proto_db_.mutable_stop_index();
+        *proto_index->mutable_bounds() = BoxToProto(index.GetBounds());
+        proto_index->set_rows(static_cast<google::protobuf::uint32>(index.GetRows()));
+        proto_index->set_cols(static_cast<google::protobuf::uint32>(index.GetColumns()));
+        proto_index->mutable_cell_offsets()->Add(index.GetCellOffsets().begin(), index.GetCellOffsets().end());
+        proto_index->mutable_cell_items()->Add(index.GetCellItems().begin(), index.GetCellItems().end());
+        *proto_index->mutable_routed_bounds() = BoxToProto(db_.routed_stops_bounds_);
+    }
+
+    pb3::CompactRoutesRow CatalogueSerializer::RoutesRowToProto(const RoutesRow &row,
+                                                               const graph::DirectedWeightedGraph<double> &graph) {
+        pb3::CompactRoutesRow proto_row;
+        proto_row.mutable_code_deltas()->Reserve(static_cast<int>(row.size()));
+        int64_t prev_code = 0;
+        for (const auto &data: row) {
+            int64_t code = 0;
+            if (data.has_value() && data->prev_edge.has_value()) {
+                // вес, который получается из веса предыдущей вершины, не храним
+                const auto &edge = graph.GetEdge(*data->prev_edge);
+                const auto &prev = row[edge.from];
+                const bool is_derived = prev.has_value() && prev->weight + edge.weight == data->weight;
+                code = (static_cast<int64_t>(*data->prev_edge) + 1) * 2 + (is_derived ? 0 : 1);
+                if (!is_derived) {
+                    proto_row.mutable_weights()->Add(data->weight);
+                }
+            } else if (data.has_value()) {
+                code = 1;
+                proto_row.mutable_weights()->Add(data->weight);
+            }
+            proto_row.mutable_code_deltas()->Add(static_cast<google::protobuf::int32>(code - prev_code));
+            prev_code = code;
+        }
+        return proto_row;
+    }
+
+    pb3::GeoBox CatalogueSerializer::BoxToProto(const geo::Box &box) {
+        pb3::GeoBox proto_box;
+        proto_box.set_min_lat(box.min_lat);
+        proto_box.set_min_lng(box.min_lng);
+        proto_box.set_max_lat(box.max_lat);
+        proto_box.set_max_lng(box.max_lng);
+        return proto_box;
     }
 
     pb3::Color CatalogueSerializer::ColorToProto(const svg::Color &color) {
@@ -148,9 +311,18 @@ namespace transcat {
         return proto_color;
     }
 
+    google::protobuf::uint32 CatalogueSerializer::AddName(std::string_view name) {
+        // названия справочника лежат в его пуле по одному разу, так что одинаковые совпадают и по адресу
+        auto [it, is_new] = name_offsets_.emplace(name.data(), 0);
+        if (is_new) {
+            it->second = static_cast<google::protobuf::uint32>(proto_db_.names().size());
+            proto_db_.mutable_names()->append(name.data(), name.size());
+        }
+        return it->second;
+    }
+
     pb3::Stop CatalogueSerializer::StopToProto(const Stop* p_stop) {
         pb3::Stop proto_stop;
-        proto_stop.set_name(p_stop->name);
         proto_stop.set_latitude(p_stop->latitude);
         proto_stop.set_longitude(p_stop->longitude);
         return proto_stop;
@@ -158,7 +330,6 @@ namespace transcat {
 
     pb3::Bus CatalogueSerializer::BusToProto(const Bus *p_bus, const std::map<const Stop*, size_t> &stops_id) {
         pb3::Bus proto_bus;
-        proto_bus.set_name(p_bus->name);
         proto_bus.set_unique_stops(static_cast<google::protobuf::uint32>(p_bus->unique_stops));
         proto_bus.set_is_roundtrip(p_bus->is_roundtrip);
         for (StopPtr stop: p_bus->route) {
@@ -166,10 +337,182 @@ namespace transcat {
         }
         proto_bus.set_start_stop(static_cast<google::protobuf::uint32>(stops_id.at(p_bus->start_stop)));
         proto_bus.set_end_stop(static_cast<google::protobuf::uint32>(stops_id.at(p_bus->end_stop)));
+        if (p_bus->schedule) {
+            pb3::BusSchedule *proto_schedule = proto_bus.mutable_schedule();
+            proto_schedule->set_first_departure(p_bus->schedule->first_departure);
+            proto_schedule->set_last_departure(p_bus->schedule->last_departure);
+            proto_schedule->set_interval(p_bus->schedule->interval);
+        }
         return proto_bus;
     }
 
 
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Routes Section
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    namespace {
+
+        using google::protobuf::internal::WireFormatLite;
+
+        // Последнее поле файла: тег routes_index_offset и fixed64
+        const uint32_t ROUTES_INDEX_TAG = WireFormatLite::MakeTag(pb3::TransportCatalogue::kRoutesIndexOffsetFieldNumber,
+                                                                  WireFormatLite::WIRETYPE_FIXED64);
+        const uint32_t ROUTES_OFFSETS_TAG = WireFormatLite::MakeTag(pb3::TransportCatalogue::kRoutesRowOffsetsFieldNumber,
+                                                                    WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+        const uint32_t ROUTES_ROW_TAG = WireFormatLite::MakeTag(pb3::TransportCatalogue::kCompactRouterFieldNumber,
+                                                                WireFormatLite::WIRETYPE_LENGTH_DELIMITED);
+        const size_t ROUTES_INDEX_TAG_SIZE = google::protobuf::io::CodedOutputStream::VarintSize32(ROUTES_INDEX_TAG);
+
+        uint64_t ReadLittleEndian64(const char *data) {
+            google::protobuf::uint64 value = 0;
+            google::protobuf::io::CodedInputStream::ReadLittleEndian64FromArray(
+                    reinterpret_cast<const google::protobuf::uint8 *>(data), &value);
+            return value;
+        }
+
+        google::protobuf::io::CodedInputStream MakeCodedStream(const char *data, size_t size) {
+            return google::protobuf::io::CodedInputStream(reinterpret_cast<const google::protobuf::uint8 *>(data),
+                                                          static_cast<int>(size));
+        }
+
+        // Файл заканчивается тегом routes_index_offset. Проверяется обычным чтением хвоста,
+        // чтобы не отображать в память файлы без раздела маршрутов
+        bool HasRoutesTrailer(const std::filesystem::path &path) {
+            std::ifstream in(path, std::ios::binary);
+            const auto trailer_size = static_cast<std::streamoff>(ROUTES_INDEX_TAG_SIZE + sizeof(uint64_t));
+            if (!in.seekg(-trailer_size, std::ios::end)) {
+                return false;
+            }
+            char tag[sizeof(uint32_t) + 1] = {};
+            if (!in.read(tag, static_cast<std::streamsize>(ROUTES_INDEX_TAG_SIZE))) {
+                return false;
+            }
+            auto stream = MakeCodedStream(tag, ROUTES_INDEX_TAG_SIZE);
+            return stream.ReadTag() == ROUTES_INDEX_TAG;
+        }
+
+    } // namespace
+
+    RoutesOffsetCounter::RoutesOffsetCounter(uint64_t head_size) noexcept
+            : offset_(head_size) {
+    }
+
+    uint64_t RoutesOffsetCounter::AddRow(size_t row_size) noexcept {
+        const uint64_t row_offset = offset_;
+        offset_ += google::protobuf::io::CodedOutputStream::VarintSize32(ROUTES_ROW_TAG)
+                   + google::protobuf::io::CodedOutputStream::VarintSize32(static_cast<uint32_t>(row_size))
+                   + row_size;
+        return row_offset;
+    }
+
+    uint64_t RoutesOffsetCounter::GetOffset() const noexcept {
+        return offset_;
+    }
+
+    std::shared_ptr<const RoutesSection> RoutesSection::Open(const std::filesystem::path &path) {
+        if (!HasRoutesTrailer(path)) {
+            return nullptr;
+        }
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat file_stat{};
+        void *data = MAP_FAILED;
+        if (::fstat(fd, &file_stat) == 0 && file_stat.st_size > 0) {
+            data = ::mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);    // отображение остается действительным
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        // конструктор закрыт - make_shared недоступен
+        std::shared_ptr<RoutesSection> section(new RoutesSection(static_cast<const char *>(data),
+                                                                 static_cast<size_t>(file_stat.st_size)));
+        if (!section->row_offsets_) {
+            return nullptr;
+        }
+        // строки будут читаться вразброс
+        ::madvise(data, section->size_, MADV_RANDOM);
+        return section;
+    }
+
+    RoutesSection::RoutesSection(const char *data, size_t size)
+            : data_(data), size_(size) {
+        // хвост файла: тег и смещение списка смещений строк
+        constexpr size_t index_offset_size = sizeof(uint64_t);
+        const size_t tag_size = ROUTES_INDEX_TAG_SIZE;
+        if (size_ < tag_size + index_offset_size) {
+            return;
+        }
+        const size_t trailer = size_ - tag_size - index_offset_size;
+        auto trailer_stream = MakeCodedStream(data_ + trailer, tag_size);
+        if (trailer_stream.ReadTag() != ROUTES_INDEX_TAG) {
+            return;
+        }
+        const uint64_t index_offset = ReadLittleEndian64(data_ + trailer + tag_size);
+        if (index_offset >= trailer) {
+            return;
+        }
+        auto index_stream = MakeCodedStream(data_ + index_offset, trailer - index_offset);
+        uint32_t index_size = 0;
+        if (index_stream.ReadTag() != ROUTES_OFFSETS_TAG || !index_stream.ReadVarint32(&index_size)
+            || index_size % sizeof(uint64_t) != 0 || index_size == 0
+            || index_offset + index_stream.CurrentPosition() + index_size != trailer) {
+            return;
+        }
+        const char *row_offsets = data_ + index_offset + index_stream.CurrentPosition();
+        const size_t row_count = index_size / sizeof(uint64_t) - 1;
+        // смещения строк не убывают и заканчиваются началом списка смещений
+        for (size_t i = 0; i < row_count; ++i) {
+            if (ReadLittleEndian64(row_offsets + i * sizeof(uint64_t))
+                > ReadLittleEndian64(row_offsets + (i + 1) * sizeof(uint64_t))) {
+                return;
+            }
+        }
+        if (ReadLittleEndian64(row_offsets + row_count * sizeof(uint64_t)) != index_offset) {
+            return;
+        }
+        row_offsets_ = row_offsets;
+        row_count_ = row_count;
+    }
+
+    RoutesSection::~RoutesSection() {
+        ::munmap(const_cast<char *>(data_), size_);
+    }
+
+    std::string_view RoutesSection::GetHead() const noexcept {
+        return {data_, GetRowOffset(0)};
+    }
+
+    size_t RoutesSection::GetRowCount() const noexcept {
+        return row_count_;
+    }
+
+    pb3::CompactRoutesRow RoutesSection::GetRow(graph::VertexId vertex) const {
+        if (vertex >= row_count_) {
+            throw std::out_of_range("No routes row for the vertex in the base file");
+        }
+        const size_t begin = GetRowOffset(vertex);
+        const size_t end = GetRowOffset(vertex + 1);
+        auto stream = MakeCodedStream(data_ + begin, end - begin);
+        uint32_t row_size = 0;
+        pb3::CompactRoutesRow proto_row;
+        if (stream.ReadTag() != ROUTES_ROW_TAG || !stream.ReadVarint32(&row_size)
+            || stream.CurrentPosition() + row_size != end - begin
+            || !proto_row.ParseFromArray(data_ + begin + stream.CurrentPosition(), static_cast<int>(row_size))) {
+            throw std::runtime_error("Corrupted routes row in the base file");
+        }
+        return proto_row;
+    }
+
+    size_t RoutesSection::GetRowOffset(graph::VertexId vertex) const noexcept {
+        return static_cast<size_t>(ReadLittleEndian64(row_offsets_ + vertex * sizeof(uint64_t)));
+    }
+
     ///////////////////////////////////////////////////////////////////////////////////////////////
     //
     //   Catalog Deserializer
@@ -196,30 +539,80 @@ namespace transcat {
         return routes_internal_data_;
     }
 
+    graph::Router<double>::RoutesRowLoader
+    CatalogueDeserializer::GetRoutesRowLoader(const graph::DirectedWeightedGraph<double> &graph) const {
+        if (!routes_section_) {
+            return {};
+        }
+        return [section = routes_section_, &graph](graph::VertexId from) {
+            return RoutesRowFromProto(section->GetRow(from), graph);
+        };
+    }
+
     void CatalogueDeserializer::DeserializeFrom(const std::filesystem::path &path) {
+        PROFILE_SCOPE("deserialize");
         std::ifstream in_file(path, std::ios::binary);
-        proto_db_.ParseFromIstream(&in_file);
-        DeserializeDb();
-        DeserializeGraph();
-        DeserializeRoutesInternalData();
+        {
+            PROFILE_SCOPE("parse");
+            // таблица, записанная потоком, остается в файле: разбираются только остальные поля.
+            // Файл отображается в память, только если в нем есть раздел маршрутов и база записана
+            // движком out_of_core, остальные базы читаются целиком
+            routes_section_ = RoutesSection::Open(path);
+            if (routes_section_) {
+                const std::string_view head = routes_section_->GetHead();
+                proto_db_.ParseFromArray(head.data(), static_cast<int>(head.size()));
+                if (!proto_db_.routing_settings().out_of_core()) {
+                    routes_section_.reset();
+                    proto_db_.Clear();
+                }
+            }
+            if (!routes_section_) {
+                proto_db_.ParseFromIstream(&in_file);
+            }
+        }
+        {
+            PROFILE_SCOPE("db");
+            DeserializeDb();
+            DeserializeGraph();
+        }
+        {
+            PROFILE_SCOPE("routes");
+            DeserializeRoutesInternalData();
+        }
         DeserializeRenderSettings();
         DeserializeRoutingSettings();
+        DeserializeStopIndex();
         in_file.close();
     }
 
     void CatalogueDeserializer::DeserializeDb() const {
+        // все названия базы попадут в один блок пула
+        const std::string_view names = proto_db_.names();
+        db_.names_.Reserve(names.size());
         // заполним stops_ и stops_by_name_
         for (const auto &proto_stop: proto_db_.stops()) {
-            auto &ref_stop = db_.stops_.emplace_back(StopFromProto(proto_stop));
+            auto &ref_stop = db_.stops_.emplace_back(StopFromProto(proto_stop, names));
+            ref_stop.name = db_.names_.Intern(ref_stop.name);
+            ref_stop.id = static_cast<uint32_t>(db_.stops_.size() - 1);
             db_.stops_by_name_[ref_stop.name] = &ref_stop;
         }
         // заполним buses_ и buses_by_name_
         for (const auto &proto_bus: proto_db_.buses()) {
-            auto &ref_bus = db_.buses_.emplace_back(BusFromProto(proto_bus, db_.stops_));
+            auto &ref_bus = db_.buses_.emplace_back(BusFromProto(proto_bus, names, db_.stops_));
+            ref_bus.name = db_.names_.Intern(ref_bus.name);
             db_.buses_by_name_[ref_bus.name] = &ref_bus;
-            for (StopPtr p_stop: ref_bus.route) {
-                db_.buses_for_stop_[p_stop].insert(&ref_bus);
+        }
+        // заполним индекс автобусов по остановкам (в базе - уже упорядоченный)
+        if (proto_db_.has_stop_buses()) {
+            const pb3::StopBuses &proto_stop_buses = proto_db_.stop_buses();
+            db_.stop_bus_offsets_.assign(proto_stop_buses.offsets().begin(), proto_stop_buses.offsets().end());
+            db_.stop_buses_.reserve(proto_stop_buses.buses_size());
+            for (const auto bus_id: proto_stop_buses.buses()) {
+                db_.stop_buses_.push_back(&db_.buses_.at(bus_id));
             }
+        } else {
+            // база, сохраненная без индекса
+            db_.BuildBusIndex();
         }
         // заполним distances_
         for (const auto &proto_distance: proto_db_.distances()) {
@@ -229,14 +622,36 @@ namespace transcat {
             };
             db_.distances_[from_to] = static_cast<distance_t>(proto_distance.distance());
         }
+        db_.BuildDistanceIndex();
+        db_.BuildRouteDistances();
         // заполним edges_to_buses_
         for (const auto bus_id: proto_db_.edges_to_buses()) {
             db_.edges_to_buses_.push_back(&db_.buses_.at(bus_id));
         }
+        // заполним timetable_
+        const pb3::Timetable &proto_timetable = proto_db_.timetable();
+        std::vector<Connection> connections(proto_timetable.departures_size());
+        for (int i = 0; i < proto_timetable.departures_size(); ++i) {
+            connections[i] = {
+                    proto_timetable.departures(i),
+                    proto_timetable.arrivals(i),
+                    proto_timetable.from_stops(i),
+                    proto_timetable.to_stops(i),
+                    proto_timetable.trips(i),
+                    proto_timetable.sequences(i)
+            };
+        }
+        std::vector<const Bus *> trip_buses;
+        trip_buses.reserve(proto_timetable.trip_buses_size());
+        for (const auto bus_id: proto_timetable.trip_buses()) {
+            trip_buses.push_back(&db_.buses_.at(bus_id));
+        }
+        db_.timetable_ = Timetable(std::move(connections), std::move(trip_buses));
     }
 
     void CatalogueDeserializer::DeserializeGraph() {
-        graph::DirectedWeightedGraph<double> g(db_.EvaluateVertexCount());
+        graph::DirectedWeightedGraph<double> g(proto_db_.vertex_count() ? proto_db_.vertex_count()
+                                                                         : db_.EvaluateVertexCount());
         graph_ = g;
         for (const auto &proto_edge: proto_db_.edges()) {
             graph::Edge<double> edge{
@@ -250,6 +665,11 @@ namespace transcat {
     }
 
     void CatalogueDeserializer::DeserializeRoutesInternalData() {
+        routes_internal_data_.reserve(proto_db_.compact_router_size() + proto_db_.router_size());
+        for (const auto &proto_row: proto_db_.compact_router()) {
+            routes_internal_data_.push_back(RoutesRowFromProto(proto_row, graph_));
+        }
+        // базы старого формата
         for (const auto& proto_list: proto_db_.router()) {
             std::vector<std::optional<graph::Router<double>::RouteInternalData>> v;
             for (const auto& proto_data: proto_list.list()) {
@@ -294,6 +714,86 @@ namespace transcat {
         const pb3::RoutingSettings &proto_settings = proto_db_.routing_settings();
         routing_settings_.bus_wait_time = proto_settings.bus_wait_time();
         routing_settings_.bus_velocity = proto_settings.bus_velocity();
+        // в базах старого формата пешеходных настроек нет - остаются значения по умолчанию
+        if (proto_settings.walk_velocity() > 0) {
+            routing_settings_.walk_velocity = proto_settings.walk_velocity();
+            routing_settings_.max_walk_distance = proto_settings.max_walk_distance();
+        }
+        routing_settings_.engine = proto_settings.on_demand() ? RoutingEngine::OnDemand
+                                  : proto_settings.out_of_core() ? RoutingEngine::OutOfCore
+                                  : RoutingEngine::AllPairs;
+        routing_settings_.use_geo_heuristic = proto_settings.geo_heuristic();
+        routing_settings_.graph_model = proto_settings.route_stops() ? RouteGraphModel::RouteStops
+                                                                     : RouteGraphModel::StopPairs;
+    }
+
+    void CatalogueDeserializer::DeserializeStopIndex() const {
+        if (!proto_db_.has_stop_index()) {
+            // база, сохраненная без индекса
+            db_.BuildStopIndex();
+            return;
+        }
+        const pb3::StopIndex &proto_index = proto_db_.stop_index();
+        db_.stop_index_ = geo::GridIndex(BoxFromProto(proto_index.bounds()), proto_index.rows(), proto_index.cols(),
+                                         {proto_index.cell_offsets().begin(), proto_index.cell_offsets().end()},
+                                         {proto_index.cell_items().begin(), proto_index.cell_items().end()});
+        for (uint32_t id = 0; id < db_.stops_.size(); ++id) {
+            const geo::Coordinates point{db_.stops_[id].latitude, db_.stops_[id].longitude};
+            db_.stop_index_.Add(id, geo::Box::Of(point, point));
+        }
+        db_.routed_stops_bounds_ = BoxFromProto(proto_index.routed_bounds());
+    }
+
+    RoutesRow CatalogueDeserializer::RoutesRowFromProto(const pb3::CompactRoutesRow &proto_row,
+                                                        const graph::DirectedWeightedGraph<double> &graph) {
+        const auto size = static_cast<size_t>(proto_row.code_deltas_size());
+        RoutesRow row(size);
+        std::vector<bool> is_derived(size, false);
+        int64_t code = 0;
+        int weight_index = 0;
+        for (size_t vertex = 0; vertex < size; ++vertex) {
+            code += proto_row.code_deltas(static_cast<int>(vertex));
+            if (code == 0) {
+                continue;
+            }
+            auto &data = row[vertex].emplace();
+            if (code > 1) {
+                data.prev_edge = static_cast<graph::EdgeId>(code / 2 - 1);
+                if (*data.prev_edge >= graph.GetEdgeCount()) {
+                    throw std::runtime_error("Corrupted routes row in the base file");
+                }
+                is_derived[vertex] = code % 2 == 0;
+            }
+            if (!is_derived[vertex]) {
+                if (weight_index >= proto_row.weights_size()) {
+                    throw std::runtime_error("Corrupted routes row in the base file");
+                }
+                data.weight = proto_row.weights(weight_index++);
+            }
+        }
+
+        // выводимые веса: идем по ребрам назад до вершины с известным весом, затем считаем вперед
+        std::vector<size_t> chain;
+        for (size_t vertex = 0; vertex < size; ++vertex) {
+            for (size_t current = vertex; is_derived[current];) {
+                chain.push_back(current);
+                current = graph.GetEdge(*row[current]->prev_edge).from;
+                if (!row[current] || chain.size() > size) {
+                    throw std::runtime_error("Corrupted routes row in the base file");
+                }
+            }
+            for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+                const auto &edge = graph.GetEdge(*row[*it]->prev_edge);
+                row[*it]->weight = row[edge.from]->weight + edge.weight;
+                is_derived[*it] = false;
+            }
+            chain.clear();
+        }
+        return row;
+    }
+
+    geo::Box CatalogueDeserializer::BoxFromProto(const pb3::GeoBox &proto_box) {
+        return {proto_box.min_lat(), proto_box.min_lng(), proto_box.max_lat(), proto_box.max_lng()};
     }
 
     svg::Color CatalogueDeserializer::ColorFromProto(const pb3::Color &proto_color) {
@@ -315,26 +815,39 @@ namespace transcat {
         }
     }
 
-    Stop CatalogueDeserializer::StopFromProto(const pb3::Stop &proto_stop) {
+    Stop CatalogueDeserializer::StopFromProto(const pb3::Stop &proto_stop, std::string_view names) {
         return {
-            proto_stop.name(),
+            names.empty() ? std::string_view(proto_stop.name())
+                          : names.substr(proto_stop.name_offset(), proto_stop.name_size()),
             proto_stop.latitude(),
             proto_stop.longitude()
         };
     }
 
-    Bus CatalogueDeserializer::BusFromProto(const pb3::Bus &proto_bus, const std::deque<Stop> &stops) {
+    Bus CatalogueDeserializer::BusFromProto(const pb3::Bus &proto_bus, std::string_view names,
+                                            const std::deque<Stop> &stops) {
         Route route;
         for (const size_t stop_id: proto_bus.route()) {
             route.emplace_back(&stops.at(stop_id));
         }
+        std::optional<Schedule> schedule;
+        if (proto_bus.has_schedule()) {
+            schedule = Schedule{
+                    proto_bus.schedule().first_departure(),
+                    proto_bus.schedule().last_departure(),
+                    proto_bus.schedule().interval()
+            };
+        }
         return {
-            proto_bus.name(),
+            names.empty() ? std::string_view(proto_bus.name())
+                          : names.substr(proto_bus.name_offset(), proto_bus.name_size()),
             std::move(route),
             proto_bus.unique_stops(),
             proto_bus.is_roundtrip(),
             &stops.at(proto_bus.start_stop()),
-            &stops.at(proto_bus.end_stop())
+            &stops.at(proto_bus.end_stop()),
+            schedule,
+            {}      // route_distances
         };
     }
 }
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <filesystem>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
 
 #include "transport_catalogue.h"
 #include "map_renderer.h"
@@ -14,6 +17,9 @@ namespace transcat {
     //
     ///////////////////////////////////////////////////////////////////////////////////////////////
 
+    // Строка таблицы маршрутов: маршруты из одной вершины во все остальные
+    using RoutesRow = std::vector<std::optional<graph::Router<double>::RouteInternalData>>;
+
     class CatalogueSerializer {
     public:
         CatalogueSerializer(const TransportCatalogue &db,
@@ -35,8 +41,23 @@ namespace transcat {
 
         void SerializeRoutingSettings();
 
+        void SerializeStopIndex();
+
+        // Смещение названия в пуле названий базы (одинаковые названия справочника записываются один раз)
+        google::protobuf::uint32 AddName(std::string_view name);
+
+        // Остальные поля базы, затем строки таблицы маршрутов, посчитанные поиском Дейкстры по пачкам
+        // в нескольких потоках: в памяти не больше пачки строк. См. TransportCatalogue.routes_row_offsets
+        void WriteWithRoutesSection(std::ostream &out) const;
+
         static pb3::Color ColorToProto(const svg::Color &color);
 
+        static pb3::GeoBox BoxToProto(const geo::Box &box);
+
+        // Строки кодируются независимо друг от друга, см. CompactRoutesRow
+        static pb3::CompactRoutesRow RoutesRowToProto(const RoutesRow &row,
+                                                      const graph::DirectedWeightedGraph<double> &graph);
+
         static pb3::Stop StopToProto(const Stop *p_stop);
 
         static pb3::Bus BusToProto(const Bus *p_bus, const std::map<const Stop*, size_t> &stops_id);
@@ -48,6 +69,66 @@ namespace transcat {
         const renderer::RenderSettings &render_settings_;
         const RoutingSettings &routing_settings_;
         pb3::TransportCatalogue proto_db_;
+        std::unordered_map<const char *, google::protobuf::uint32> name_offsets_;
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Routes Section
+    //
+    //   Файл базы с разделом маршрутов, записанным потоком, отображенный в память только для чтения.
+    //   Строка таблицы разбирается при каждом обращении, поэтому в памяти процесса таблицы нет,
+    //   а страницы файла подгружает и вытесняет система. Читать можно из любого числа потоков.
+    //   Новая база подменяет файл переименованием (CatalogueSerializer::SerializeTo), поэтому
+    //   отображение прежнего файла остается действительным до выгрузки снимка.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    // Смещения строк раздела маршрутов при записи. Считаются по размерам полей, а не
+    // CodedOutputStream::ByteCount (int): раздел может быть больше 2 ГиБ
+    class RoutesOffsetCounter {
+    public:
+        // head_size - размер остальных полей базы, записанных перед строками
+        explicit RoutesOffsetCounter(uint64_t head_size) noexcept;
+
+        // Смещение строки размера row_size; счетчик переходит за строку (тег, длина и сама строка)
+        uint64_t AddRow(size_t row_size) noexcept;
+
+        // Смещение следующего поля после всех строк
+        [[nodiscard]] uint64_t GetOffset() const noexcept;
+
+    private:
+        uint64_t offset_;
+    };
+
+    class RoutesSection {
+    public:
+        // nullptr - в файле нет раздела маршрутов, записанного потоком
+        [[nodiscard]] static std::shared_ptr<const RoutesSection> Open(const std::filesystem::path &path);
+
+        RoutesSection(const RoutesSection &) = delete;
+
+        RoutesSection &operator=(const RoutesSection &) = delete;
+
+        ~RoutesSection();
+
+        // Остальные поля базы - сообщение TransportCatalogue без таблицы маршрутов
+        [[nodiscard]] std::string_view GetHead() const noexcept;
+
+        [[nodiscard]] size_t GetRowCount() const noexcept;
+
+        [[nodiscard]] pb3::CompactRoutesRow GetRow(graph::VertexId vertex) const;
+
+    private:
+        RoutesSection(const char *data, size_t size);
+
+        // Смещение начала строки vertex (vertex == GetRowCount() - конец раздела)
+        [[nodiscard]] size_t GetRowOffset(graph::VertexId vertex) const noexcept;
+
+        const char *data_;
+        size_t size_;
+        const char *row_offsets_ = nullptr;   // fixed64, little-endian, без выравнивания
+        size_t row_count_ = 0;
     };
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -68,6 +149,10 @@ namespace transcat {
 
         graph::Router<double>::RoutesInternalData GetRoutesInternalData() const;
 
+        // Строки таблицы из раздела маршрутов, записанного потоком (пустой загрузчик, если раздела нет).
+        // Загрузчик держит файл отображенным, graph - граф маршрутов базы, переживающий загрузчик
+        graph::Router<double>::RoutesRowLoader GetRoutesRowLoader(const graph::DirectedWeightedGraph<double> &graph) const;
+
         void DeserializeFrom(const std::filesystem::path &path);
 
     private:
@@ -81,11 +166,19 @@ namespace transcat {
 
         void DeserializeRoutingSettings();
 
+        void DeserializeStopIndex() const;
+
         static svg::Color ColorFromProto(const pb3::Color &proto_color);
 
-        static Stop StopFromProto(const pb3::Stop &proto_stop);
+        static geo::Box BoxFromProto(const pb3::GeoBox &proto_box);
+
+        static RoutesRow RoutesRowFromProto(const pb3::CompactRoutesRow &proto_row,
+                                            const graph::DirectedWeightedGraph<double> &graph);
+
+        // Название указывает в names (пул названий базы) или, для баз старого формата, в proto_stop
+        static Stop StopFromProto(const pb3::Stop &proto_stop, std::string_view names);
 
-        static Bus BusFromProto(const pb3::Bus &proto_bus, const std::deque<Stop> &stops);
+        static Bus BusFromProto(const pb3::Bus &proto_bus, std::string_view names, const std::deque<Stop> &stops);
 
     private:
         TransportCatalogue &db_;
@@ -94,6 +187,7 @@ namespace transcat {
         renderer::RenderSettings render_settings_;
         RoutingSettings routing_settings_;
         pb3::TransportCatalogue proto_db_;
+        std::shared_ptr<const RoutesSection> routes_section_;
     };
 
 }
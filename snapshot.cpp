@@ -0,0 +1,68 @@
+#include <atomic>
+
+#include "snapshot.h"
+#include "profile.h"
+#include "serialization.h"
+
+namespace transcat {
+
+    ///////////////////////// CatalogueSnapshot /////////////////////////
+
+    std::shared_ptr<const CatalogueSnapshot> CatalogueSnapshot::Load(const std::filesystem::path &path,
+                                                                     query::SlowRequestLog slow_log,
+                                                                     size_t route_planner_threads) {
+        // конструктор закрыт - make_shared недоступен
+        std::shared_ptr<CatalogueSnapshot> snapshot(new CatalogueSnapshot);
+
+        CatalogueDeserializer deserializer{snapshot->db_};
+        deserializer.DeserializeFrom(path);
+        snapshot->renderer_.UseSettings(deserializer.GetRenderSettings());
+
+        auto &json_reader = snapshot->json_reader_.emplace(snapshot->db_, snapshot->renderer_);
+        json_reader.SetRoutingSettings(deserializer.GetRoutingSettings());
+        json_reader.SetSlowRequestLog(slow_log);
+        json_reader.SetRoutePlannerThreads(route_planner_threads);
+
+        const auto &handler = snapshot->handler_.emplace(snapshot->db_, snapshot->renderer_,
+                                                         deserializer.GetRoutingSettings(),
+                                                         snapshot->db_.EvaluateVertexCount(),
+                                                         deserializer.GetRouteGraph());
+        auto &router = snapshot->router_.emplace(handler.GetRouteGraph(), deserializer.GetRoutesInternalData());
+        router.SetRoutesRowLoader(deserializer.GetRoutesRowLoader(handler.GetRouteGraph()));
+        handler.SetupRouter(router);
+        return snapshot;
+    }
+
+    void CatalogueSnapshot::ProcessRequests(const json::Document &document, std::ostream &out) const {
+        PROFILE_SCOPE("write_info");
+        json_reader_->WriteInfo(out, json_reader_->ParseStatRequests(document), *handler_, *router_);
+    }
+
+    const TransportCatalogue &CatalogueSnapshot::GetCatalogue() const noexcept {
+        return db_;
+    }
+
+    const RequestHandler &CatalogueSnapshot::GetHandler() const noexcept {
+        return *handler_;
+    }
+
+    const graph::Router<double> &CatalogueSnapshot::GetRouter() const noexcept {
+        return *router_;
+    }
+
+    ///////////////////////// SnapshotHolder ////////////////////////////
+
+    SnapshotHolder::SnapshotHolder(std::shared_ptr<const CatalogueSnapshot> snapshot)
+            : snapshot_(std::move(snapshot)) {
+    }
+
+    std::shared_ptr<const CatalogueSnapshot> SnapshotHolder::Get() const noexcept {
+        return std::atomic_load(&snapshot_);
+    }
+
+    void SnapshotHolder::Reset(std::shared_ptr<const CatalogueSnapshot> snapshot) noexcept {
+        // старый снимок освобождается, когда его отпустит последний читатель
+        std::atomic_store(&snapshot_, std::move(snapshot));
+    }
+
+} // namespace transcat
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <optional>
+
+#include "transport_catalogue.h"
+#include "map_renderer.h"
+#include "request_handler.h"
+#include "json_reader.h"
+#include "router.h"
+#include "json.h"
+
+namespace transcat {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Catalogue Snapshot
+    //
+    //   Неизменяемая загруженная база: справочник, граф, маршрутизатор и кэши отрисовки вместе.
+    //   Снимок создается целиком и дальше только читается, поэтому запросы к нему можно выполнять
+    //   из любого числа потоков. Владение - через shared_ptr: снимок живет, пока его держит
+    //   хотя бы один запрос.
+    //
+    //   SnapshotHolder - текущий снимок с атомарной заменой (в духе RCU): читатель берет
+    //   shared_ptr и работает с ним до конца запроса, Reset() публикует новый снимок,
+    //   старый освобождается после завершения последнего запроса к нему.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    class CatalogueSnapshot {
+    public:
+        // Загружает базу, сохраненную make_base (patch_base). route_planner_threads - потоки поиска
+        // маршрутов групп запросов Route внутри одного ProcessRequests (см. JsonReader::SetRoutePlannerThreads)
+        [[nodiscard]] static std::shared_ptr<const CatalogueSnapshot> Load(const std::filesystem::path &path,
+                                                                           query::SlowRequestLog slow_log = {},
+                                                                           size_t route_planner_threads = 1);
+
+        CatalogueSnapshot(const CatalogueSnapshot &) = delete;
+
+        CatalogueSnapshot &operator=(const CatalogueSnapshot &) = delete;
+
+        // Отвечает на stat_requests документа
+        void ProcessRequests(const json::Document &document, std::ostream &out) const;
+
+        [[nodiscard]] const TransportCatalogue &GetCatalogue() const noexcept;
+
+        [[nodiscard]] const RequestHandler &GetHandler() const noexcept;
+
+        [[nodiscard]] const graph::Router<double> &GetRouter() const noexcept;
+
+    private:
+        CatalogueSnapshot() = default;
+
+        TransportCatalogue db_;
+        renderer::MapRenderer renderer_;
+        std::optional<query::JsonReader> json_reader_;
+        std::optional<RequestHandler> handler_;
+        std::optional<graph::Router<double>> router_;
+    };
+
+    class SnapshotHolder {
+    public:
+        SnapshotHolder() = default;
+
+        explicit SnapshotHolder(std::shared_ptr<const CatalogueSnapshot> snapshot);
+
+        // Текущий снимок; остается действительным, даже если его успеют заменить
+        [[nodiscard]] std::shared_ptr<const CatalogueSnapshot> Get() const noexcept;
+
+        // Публикует новый снимок
+        void Reset(std::shared_ptr<const CatalogueSnapshot> snapshot) noexcept;
+
+    private:
+        std::shared_ptr<const CatalogueSnapshot> snapshot_;
+    };
+
+} // namespace transcat
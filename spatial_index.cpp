@@ -0,0 +1,233 @@
+#include <algorithm>
+#include <cmath>
+
+#include "spatial_index.h"
+
+namespace transcat::geo {
+
+    Box Box::Of(Coordinates lhs, Coordinates rhs) noexcept {
+        return {
+                std::min(lhs.lat, rhs.lat),
+                std::min(lhs.lng, rhs.lng),
+                std::max(lhs.lat, rhs.lat),
+                std::max(lhs.lng, rhs.lng)
+        };
+    }
+
+    bool Box::IsValid() const noexcept {
+        return min_lat <= max_lat && min_lng <= max_lng;
+    }
+
+    bool Box::Contains(Coordinates point) const noexcept {
+        return point.lat >= min_lat && point.lat <= max_lat && point.lng >= min_lng && point.lng <= max_lng;
+    }
+
+    bool Box::Intersects(const Box &other) const noexcept {
+        return min_lat <= other.max_lat && other.min_lat <= max_lat
+               && min_lng <= other.max_lng && other.min_lng <= max_lng;
+    }
+
+    void Box::Extend(Coordinates point) noexcept {
+        min_lat = std::min(min_lat, point.lat);
+        min_lng = std::min(min_lng, point.lng);
+        max_lat = std::max(max_lat, point.lat);
+        max_lng = std::max(max_lng, point.lng);
+    }
+
+    Box Box::Around(Coordinates center, double meters) noexcept {
+        static const double dr = 3.1415926535 / 180.;
+        const int radius = 6371000;
+        const double delta = meters / radius;  // угловое расстояние в радианах
+        const double lat_delta = delta / dr;
+
+        // наибольший разброс по долготе - на ближайшей к полюсу широте круга
+        double lng_delta = 180;
+        const double extreme_lat = (std::abs(center.lat) + lat_delta) * dr;
+        if (extreme_lat < 90 * dr && std::sin(delta) < std::cos(extreme_lat)) {
+            lng_delta = std::asin(std::sin(delta) / std::cos(extreme_lat)) / dr;
+        }
+        return {center.lat - lat_delta, center.lng - lng_delta, center.lat + lat_delta, center.lng + lng_delta};
+    }
+
+    double ComputeSafeDistance(Coordinates from, Coordinates to) {
+        const double distance = ComputeDistance(from, to);
+        return std::isnan(distance) ? 0. : distance;
+    }
+
+    ///////////////////////// GridIndex /////////////////////////////////
+
+    GridIndex::GridIndex(const Box &bounds, size_t cell_hint)
+            : bounds_(bounds) {
+        // в среднем по паре объектов на ячейку, но не больше 1024 x 1024 ячеек
+        const auto side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(cell_hint) / 2)));
+        rows_ = std::clamp<size_t>(side, 1, 1024);
+        cols_ = rows_;
+    }
+
+    GridIndex::GridIndex(const Box &bounds, size_t rows, size_t cols,
+                         std::vector<uint32_t> cell_offsets, std::vector<uint32_t> cell_items)
+            : bounds_(bounds), rows_(std::max<size_t>(rows, 1)), cols_(std::max<size_t>(cols, 1)),
+              cell_offsets_(std::move(cell_offsets)), cell_items_(std::move(cell_items)) {
+    }
+
+    void GridIndex::Add(uint32_t id, const Box &box) {
+        items_.push_back({id, box});
+    }
+
+    void GridIndex::Build() {
+        const size_t cell_count = rows_ * cols_;
+
+        // первый проход - подсчет объектов в ячейках, второй - раскладка
+        std::vector<uint32_t> counts(cell_count + 1, 0);
+        for (const Item &item: items_) {
+            for (size_t row = GetRow(item.box.min_lat); row <= GetRow(item.box.max_lat); ++row) {
+                for (size_t col = GetColumn(item.box.min_lng); col <= GetColumn(item.box.max_lng); ++col) {
+                    ++counts[row * cols_ + col + 1];
+                }
+            }
+        }
+        for (size_t cell = 1; cell <= cell_count; ++cell) {
+            counts[cell] += counts[cell - 1];
+        }
+        cell_offsets_ = counts;
+        cell_items_.resize(cell_offsets_.back());
+        for (uint32_t index = 0; index < items_.size(); ++index) {
+            const Box &box = items_[index].box;
+            for (size_t row = GetRow(box.min_lat); row <= GetRow(box.max_lat); ++row) {
+                for (size_t col = GetColumn(box.min_lng); col <= GetColumn(box.max_lng); ++col) {
+                    cell_items_[counts[row * cols_ + col]++] = index;
+                }
+            }
+        }
+    }
+
+    std::vector<uint32_t> GridIndex::Query(const Box &area) const {
+        std::vector<uint32_t> result;
+        if (items_.empty() || !area.Intersects(bounds_)) {
+            return result;
+        }
+        for (size_t row = GetRow(area.min_lat); row <= GetRow(area.max_lat); ++row) {
+            for (size_t col = GetColumn(area.min_lng); col <= GetColumn(area.max_lng); ++col) {
+                const size_t cell = row * cols_ + col;
+                for (uint32_t i = cell_offsets_[cell]; i < cell_offsets_[cell + 1]; ++i) {
+                    const Item &item = items_[cell_items_[i]];
+                    if (item.box.Intersects(area)) {
+                        result.push_back(item.id);
+                    }
+                }
+            }
+        }
+        // объект, лежащий в нескольких ячейках, встречается несколько раз
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+        return result;
+    }
+
+    std::vector<std::pair<uint32_t, double>> GridIndex::Nearest(Coordinates point, size_t count) const {
+        std::vector<std::pair<uint32_t, double>> result;
+        if (items_.empty() || count == 0) {
+            return result;
+        }
+
+        // 1. кольца ячеек вокруг точки, пока не наберется count кандидатов
+        const auto row = static_cast<long>(GetRow(point.lat));
+        const auto col = static_cast<long>(GetColumn(point.lng));
+        const auto rows = static_cast<long>(rows_);
+        const auto cols = static_cast<long>(cols_);
+        std::vector<uint32_t> candidates;
+        for (long ring = 0; candidates.size() < count; ++ring) {
+            if (row - ring < 0 && col - ring < 0 && row + ring >= rows && col + ring >= cols) {
+                break;
+            }
+            for (long r = std::max(0L, row - ring); r <= std::min(rows - 1, row + ring); ++r) {
+                for (long c = std::max(0L, col - ring); c <= std::min(cols - 1, col + ring); ++c) {
+                    if (std::max(std::abs(r - row), std::abs(c - col)) != ring) continue;
+                    const size_t cell = r * cols_ + c;
+                    for (uint32_t i = cell_offsets_[cell]; i < cell_offsets_[cell + 1]; ++i) {
+                        candidates.push_back(cell_items_[i]);
+                    }
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+            candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+        }
+
+        // 2. ближайший объект может лежать за пределами колец - дозапрашиваем круг радиусом до count-го кандидата
+        std::vector<double> distances;
+        distances.reserve(candidates.size());
+        for (uint32_t index: candidates) {
+            distances.push_back(ComputeSafeDistance(point, GetCenter(items_[index].box)));
+        }
+        const size_t kth = std::min(count, distances.size()) - 1;
+        std::nth_element(distances.begin(), distances.begin() + static_cast<long>(kth), distances.end());
+        const Box area = Box::Around(point, distances[kth]);
+
+        for (size_t row_index = GetRow(area.min_lat); row_index <= GetRow(area.max_lat); ++row_index) {
+            for (size_t col_index = GetColumn(area.min_lng); col_index <= GetColumn(area.max_lng); ++col_index) {
+                const size_t cell = row_index * cols_ + col_index;
+                for (uint32_t i = cell_offsets_[cell]; i < cell_offsets_[cell + 1]; ++i) {
+                    candidates.push_back(cell_items_[i]);
+                }
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+        result.reserve(candidates.size());
+        for (uint32_t index: candidates) {
+            result.emplace_back(items_[index].id, ComputeSafeDistance(point, GetCenter(items_[index].box)));
+        }
+        std::sort(result.begin(), result.end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.second < rhs.second || (lhs.second == rhs.second && lhs.first < rhs.first);
+        });
+        if (result.size() > count) {
+            result.resize(count);
+        }
+        return result;
+    }
+
+    const Box &GridIndex::GetBounds() const noexcept {
+        return bounds_;
+    }
+
+    size_t GridIndex::GetItemCount() const noexcept {
+        return items_.size();
+    }
+
+    size_t GridIndex::GetRows() const noexcept {
+        return rows_;
+    }
+
+    size_t GridIndex::GetColumns() const noexcept {
+        return cols_;
+    }
+
+    const std::vector<uint32_t> &GridIndex::GetCellOffsets() const noexcept {
+        return cell_offsets_;
+    }
+
+    const std::vector<uint32_t> &GridIndex::GetCellItems() const noexcept {
+        return cell_items_;
+    }
+
+    Coordinates GridIndex::GetCenter(const Box &box) noexcept {
+        return {(box.min_lat + box.max_lat) / 2, (box.min_lng + box.max_lng) / 2};
+    }
+
+    size_t GridIndex::GetColumn(double lng) const noexcept {
+        const double width = bounds_.max_lng - bounds_.min_lng;
+        if (width <= 0 || lng <= bounds_.min_lng) {
+            return 0;
+        }
+        return std::min(cols_ - 1, static_cast<size_t>((lng - bounds_.min_lng) / width * static_cast<double>(cols_)));
+    }
+
+    size_t GridIndex::GetRow(double lat) const noexcept {
+        const double height = bounds_.max_lat - bounds_.min_lat;
+        if (height <= 0 || lat <= bounds_.min_lat) {
+            return 0;
+        }
+        return std::min(rows_ - 1, static_cast<size_t>((lat - bounds_.min_lat) / height * static_cast<double>(rows_)));
+    }
+
+} //namespace transcat::geo
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "geo.h"
+
+namespace transcat::geo {
+
+    // Прямоугольная область в географических координатах
+    struct Box {
+        double min_lat = 0;
+        double min_lng = 0;
+        double max_lat = 0;
+        double max_lng = 0;
+
+        // Минимальный прямоугольник, содержащий обе точки
+        static Box Of(Coordinates lhs, Coordinates rhs) noexcept;
+
+        // Углы не перепутаны: min не больше max по обеим осям
+        [[nodiscard]] bool IsValid() const noexcept;
+
+        [[nodiscard]] bool Contains(Coordinates point) const noexcept;
+
+        [[nodiscard]] bool Intersects(const Box &other) const noexcept;
+
+        // Расширяет прямоугольник до включения точки
+        void Extend(Coordinates point) noexcept;
+
+        // Прямоугольник, гарантированно содержащий все точки не далее meters от center
+        static Box Around(Coordinates center, double meters) noexcept;
+    };
+
+    // То же, что ComputeDistance, но без NaN для совпадающих точек
+    double ComputeSafeDistance(Coordinates from, Coordinates to);
+
+    // Равномерная сетка над прямоугольником bounds. Каждый объект (точка или отрезок) попадает
+    // во все ячейки, которые пересекает его ограничивающий прямоугольник.
+    // Порядок работы: Add(...) для всех объектов, затем Build(); после этого индекс неизменяем.
+    class GridIndex {
+    public:
+        GridIndex() = default;
+
+        // cell_hint - ожидаемое количество объектов, по нему выбирается размер сетки
+        GridIndex(const Box &bounds, size_t cell_hint);
+
+        // Восстановление готовой сетки (например, из базы). Объекты затем добавляются через Add()
+        // в том же порядке, что и при построении, Build() не вызывается.
+        GridIndex(const Box &bounds, size_t rows, size_t cols,
+                  std::vector<uint32_t> cell_offsets, std::vector<uint32_t> cell_items);
+
+        void Add(uint32_t id, const Box &box);
+
+        // Раскладывает объекты по ячейкам в плоский массив (CSR)
+        void Build();
+
+        // Возвращает отсортированные идентификаторы объектов, пересекающих область
+        [[nodiscard]] std::vector<uint32_t> Query(const Box &area) const;
+
+        // Возвращает count ближайших к точке объектов (по центру их прямоугольника) с расстояниями в метрах,
+        // в порядке возрастания расстояния. Поиск расширяется кольцами ячеек от ячейки с точкой.
+        [[nodiscard]] std::vector<std::pair<uint32_t, double>> Nearest(Coordinates point, size_t count) const;
+
+        [[nodiscard]] const Box &GetBounds() const noexcept;
+
+        [[nodiscard]] size_t GetItemCount() const noexcept;
+
+        [[nodiscard]] size_t GetRows() const noexcept;
+
+        [[nodiscard]] size_t GetColumns() const noexcept;
+
+        [[nodiscard]] const std::vector<uint32_t> &GetCellOffsets() const noexcept;
+
+        [[nodiscard]] const std::vector<uint32_t> &GetCellItems() const noexcept;
+
+    private:
+        struct Item {
+            uint32_t id = 0;
+            Box box;
+        };
+
+        [[nodiscard]] size_t GetColumn(double lng) const noexcept;
+
+        [[nodiscard]] size_t GetRow(double lat) const noexcept;
+
+        [[nodiscard]] static Coordinates GetCenter(const Box &box) noexcept;
+
+        Box bounds_;
+        size_t rows_ = 1;
+        size_t cols_ = 1;
+        std::vector<Item> items_;
+        std::vector<uint32_t> cell_offsets_;    // начало списка каждой ячейки в cell_items_ (rows_ * cols_ + 1)
+        std::vector<uint32_t> cell_items_;      // индексы в items_
+    };
+
+} //namespace transcat::geo
@@ -0,0 +1,41 @@
+#include <algorithm>
+#include <cstring>
+
+#include "string_pool.h"
+
+namespace transcat {
+
+    std::string_view StringPool::Intern(std::string_view str) {
+        if (auto it = strings_.find(str); it != strings_.end()) {
+            return *it;
+        }
+        if (blocks_.empty() || blocks_.back().capacity - blocks_.back().size < str.size()) {
+            AddBlock(std::max(BLOCK_SIZE, str.size()));
+        }
+        Block &block = blocks_.back();
+        char *data = block.data.get() + block.size;
+        std::memcpy(data, str.data(), str.size());
+        block.size += str.size();
+        size_ += str.size();
+        return *strings_.emplace(data, str.size()).first;
+    }
+
+    void StringPool::Reserve(size_t bytes) {
+        if (bytes > 0 && (blocks_.empty() || blocks_.back().capacity - blocks_.back().size < bytes)) {
+            AddBlock(bytes);
+        }
+    }
+
+    size_t StringPool::GetCount() const noexcept {
+        return strings_.size();
+    }
+
+    size_t StringPool::GetSize() const noexcept {
+        return size_;
+    }
+
+    void StringPool::AddBlock(size_t capacity) {
+        blocks_.push_back({std::unique_ptr<char[]>(new char[std::max<size_t>(capacity, 1)]), capacity, 0});
+    }
+
+} // namespace transcat
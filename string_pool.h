@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace transcat {
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   String Pool
+    //
+    //   Хранилище неизменяемых строк (названий остановок и автобусов). Строки лежат подряд
+    //   в крупных блоках, одинаковые строки хранятся один раз. Возвращенные string_view
+    //   действительны, пока жив пул: блоки не перемещаются, в том числе при перемещении пула.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    class StringPool {
+    public:
+        StringPool() = default;
+
+        StringPool(const StringPool &) = delete;
+
+        StringPool &operator=(const StringPool &) = delete;
+
+        StringPool(StringPool &&) noexcept = default;
+
+        StringPool &operator=(StringPool &&) noexcept = default;
+
+        // Строка в пуле, равная str (добавляется, если ее еще нет)
+        std::string_view Intern(std::string_view str);
+
+        // Следующие bytes байт строк попадут в один блок (например, все названия из базы)
+        void Reserve(size_t bytes);
+
+        // Количество различных строк
+        [[nodiscard]] size_t GetCount() const noexcept;
+
+        // Суммарная длина различных строк
+        [[nodiscard]] size_t GetSize() const noexcept;
+
+    private:
+        static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+        struct Block {
+            std::unique_ptr<char[]> data;
+            size_t capacity = 0;
+            size_t size = 0;
+        };
+
+        void AddBlock(size_t capacity);
+
+        std::vector<Block> blocks_;
+        std::unordered_set<std::string_view> strings_;
+        size_t size_ = 0;
+    };
+
+} // namespace transcat
@@ -137,7 +137,7 @@ namespace svg {
     }
 
     Text &Text::SetData(std::string data) {
-        data_ = data;
+        data_ = std::move(data);
         return *this;
     }
 
@@ -1,10 +1,24 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <fstream>
+#include <limits>
+#include <map>
+#include <set>
 #include <sstream>
 #include <string_view>
+#include <thread>
+#include <tuple>
+
+#include <google/protobuf/io/coded_stream.h>
 
 #include "../transport_catalogue.h"
 #include "../json_reader.h"
 #include "../serialization.h"
+#include "../base_patcher.h"
+#include "../base_estimate.h"
+#include "../snapshot.h"
+#include "../profile.h"
 
 #include "gtest/gtest.h"
 
@@ -216,4 +230,1217 @@ TEST(SERIALIZE_SUITE, Test_10) {
         json_reader.WriteInfo(my_out, stat_requests, deserializer.GetRouteGraph(),
                               deserializer.GetRoutesInternalData());
     }
-}
\ No newline at end of file
+}
+
+TEST(SERIALIZE_SUITE, Compact_Routes_Are_Exact) {
+    const std::string file = "compact_routes_test.db";
+    graph::Router<double>::RoutesInternalData expected;
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        std::ifstream base_in("make_base_input10.json");
+        json::Document doc = json::Load(base_in);
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(doc);
+        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+        graph::Router<double> router(handler.GetRouteGraph());
+        expected = router.GetRoutesInternalData();
+        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+                                       handler.GetRouteGraph(), expected};
+        serializer.SerializeTo(file);
+    }
+
+    TransportCatalogue db;
+    CatalogueDeserializer deserializer{db};
+    deserializer.DeserializeFrom(file);
+    const auto actual = deserializer.GetRoutesInternalData();
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t from = 0; from < expected.size(); ++from) {
+        ASSERT_EQ(actual[from].size(), expected[from].size());
+        for (size_t to = 0; to < expected[from].size(); ++to) {
+            ASSERT_EQ(actual[from][to].has_value(), expected[from][to].has_value());
+            if (expected[from][to]) {
+                // веса должны совпадать до бита - иначе может измениться вывод
+                ASSERT_EQ(actual[from][to]->weight, expected[from][to]->weight);
+                ASSERT_EQ(actual[from][to]->prev_edge, expected[from][to]->prev_edge);
+            }
+        }
+    }
+}
+
+TEST(SERIALIZE_SUITE, Out_Of_Core_Routes_Match_All_Pairs) {
+    const std::string file = "out_of_core_test.db";
+    std::ifstream base_in("make_base_input10.json");
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    const graph::Router<double> all_pairs(handler.GetRouteGraph());
+    {
+        // таблица в make_base не строится: строки пишутся в файл по мере счета
+        RoutingSettings routing_settings = json_reader.GetRoutingSettings();
+        routing_settings.engine = RoutingEngine::OutOfCore;
+        const renderer::RenderSettings render_settings = renderer.GetSettings();
+        const graph::Router<double>::RoutesInternalData no_routes;
+        CatalogueSerializer serializer{db, render_settings, routing_settings, handler.GetRouteGraph(), no_routes};
+        serializer.SerializeTo(file);
+    }
+
+    {
+        // таблица остается в файле
+        TransportCatalogue loaded_db;
+        CatalogueDeserializer deserializer{loaded_db};
+        deserializer.DeserializeFrom(file);
+        ASSERT_EQ(deserializer.GetRoutingSettings().engine, RoutingEngine::OutOfCore);
+        ASSERT_TRUE(deserializer.GetRoutesInternalData().empty());
+        ASSERT_EQ(RoutesSection::Open(file)->GetRowCount(), handler.GetRouteGraph().GetVertexCount());
+    }
+
+    const auto snapshot = CatalogueSnapshot::Load(file);
+    const auto &router = snapshot->GetRouter();
+    ASSERT_TRUE(router.HasRoutesInternalData());
+    {
+        // новая база подменяет файл, а загруженный снимок читает строки из прежнего
+        RoutingSettings routing_settings = json_reader.GetRoutingSettings();
+        routing_settings.engine = RoutingEngine::OnDemand;
+        const renderer::RenderSettings render_settings = renderer.GetSettings();
+        const graph::Router<double>::RoutesInternalData no_routes;
+        CatalogueSerializer serializer{db, render_settings, routing_settings, handler.GetRouteGraph(), no_routes};
+        serializer.SerializeTo(file);
+        ASSERT_EQ(RoutesSection::Open(file), nullptr);
+    }
+    const size_t vertex_count = handler.GetRouteGraph().GetVertexCount();
+    for (graph::VertexId from = 0; from < vertex_count; ++from) {
+        for (graph::VertexId to = 0; to < vertex_count; ++to) {
+            const auto expected = all_pairs.BuildRoute(from, to);
+            const auto actual = router.BuildRoute(from, to);
+            ASSERT_EQ(actual.has_value(), expected.has_value());
+            if (expected) {
+                ASSERT_NEAR(actual->weight, expected->weight, 1e-6);
+                double weight = 0;
+                for (graph::EdgeId edge_id: actual->edges) {
+                    weight += snapshot->GetHandler().GetRouteGraph().GetEdge(edge_id).weight;
+                }
+                ASSERT_NEAR(weight, actual->weight, 1e-6);
+            }
+        }
+    }
+
+    // в другом файле раздела маршрутов нет
+    ASSERT_EQ(RoutesSection::Open("make_base_input10.json"), nullptr);
+}
+
+TEST(SERIALIZE_SUITE, Routes_Offsets_Past_2_GiB) {
+    // остальные поля базы - почти 2 ГиБ: смещения строк дальше уже не помещаются в int
+    constexpr uint64_t head_size = std::numeric_limits<int>::max() - 1000ull;
+    RoutesOffsetCounter offsets(head_size);
+    ASSERT_EQ(offsets.AddRow(0), head_size);
+    const uint64_t empty_row_size = offsets.GetOffset() - head_size;    // тег и нулевая длина
+    ASSERT_GE(empty_row_size, 2u);
+
+    uint64_t previous = offsets.GetOffset();
+    for (const size_t row_size: {size_t{127}, size_t{128}, size_t{1} << 20, size_t{1} << 30, size_t{1} << 30}) {
+        const uint64_t offset = offsets.AddRow(row_size);
+        ASSERT_EQ(offset, previous);
+        ASSERT_EQ(offsets.GetOffset() - offset,
+                  empty_row_size - 1 + google::protobuf::io::CodedOutputStream::VarintSize32(
+                          static_cast<uint32_t>(row_size)) + row_size);
+        previous = offsets.GetOffset();
+    }
+    ASSERT_GT(offsets.GetOffset(), uint64_t{std::numeric_limits<uint32_t>::max()});
+}
+
+TEST(MAP_SUITE, Tile_Zero_Equals_Full_Map) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+
+    std::ifstream base_in("make_base_input3.json");
+    json::Document doc = json::Load(base_in);
+
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(doc);
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+
+    std::stringstream full_map;
+    handler.RenderMap().Render(full_map);
+    std::stringstream tile_map;
+    handler.RenderMap(renderer::Tile{0, 0, 0}).Render(tile_map);
+    ASSERT_EQ(full_map.str(), tile_map.str());
+
+    // область вне карты - пустой документ
+    std::stringstream empty_map;
+    handler.RenderMap(geo::Box{-10, -10, -9, -9}).Render(empty_map);
+    std::stringstream empty_doc;
+    svg::Document().Render(empty_doc);
+    ASSERT_EQ(empty_map.str(), empty_doc.str());
+
+    // тайлы следующего уровня вместе содержат все остановки
+    size_t circles = 0;
+    for (int x = 0; x < 2; ++x) {
+        for (int y = 0; y < 2; ++y) {
+            std::stringstream part;
+            handler.RenderMap(renderer::Tile{1, x, y}).Render(part);
+            const std::string text = part.str();
+            for (size_t pos = text.find("<circle"); pos != std::string::npos; pos = text.find("<circle", pos + 1)) {
+                ++circles;
+            }
+        }
+    }
+    size_t full_circles = 0;
+    const std::string full_text = full_map.str();
+    for (size_t pos = full_text.find("<circle"); pos != std::string::npos; pos = full_text.find("<circle", pos + 1)) {
+        ++full_circles;
+    }
+    ASSERT_GE(circles, full_circles);
+
+    // некорректные тайл и прямоугольник - ответ с ошибкой
+    json::Array stat_requests{
+            json::Dict{{"id", 1}, {"type", "Map"s}, {"tile", json::Dict{{"z", 1}, {"x", 2}, {"y", 0}}}},
+            json::Dict{{"id", 2}, {"type", "Map"s}, {"tile", json::Dict{{"z", -1}, {"x", 0}, {"y", 0}}}},
+            json::Dict{{"id", 3}, {"type", "StopsInArea"s},
+                       {"bbox", json::Dict{{"min_lat", 1.}, {"min_lon", 0.}, {"max_lat", 0.}, {"max_lon", 1.}}}}
+    };
+    const auto requests = json_reader.ParseStatRequests(json::Document{json::Dict{{"stat_requests", stat_requests}}});
+    std::stringstream out;
+    json_reader.WriteInfo(out, requests, handler.GetRouteGraph(), {});
+    const json::Document responses = json::Load(out);
+    for (const auto &response: responses.GetRoot().AsArray()) {
+        ASSERT_EQ(response.AsDict().size(), 2u);
+        ASSERT_TRUE(response.AsDict().count("error_message"s));
+    }
+}
+
+TEST(SPATIAL_SUITE, Nearest_And_Area_Match_Full_Scan) {
+    const std::string file = "spatial_index_test.db";
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        std::ifstream base_in("make_base_input10.json");
+        json::Document doc = json::Load(base_in);
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(doc);
+        graph::DirectedWeightedGraph<double> graph(db.EvaluateVertexCount());
+        graph::Router<double>::RoutesInternalData routes_internal_data;
+        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+                                       graph, routes_internal_data};
+        serializer.SerializeTo(file);
+    }
+
+    TransportCatalogue db;
+    CatalogueDeserializer deserializer{db};
+    deserializer.DeserializeFrom(file);
+
+    const std::vector<StopPtr> stops = db.GetAllStops();
+    const std::vector<geo::Coordinates> points{{43.59, 39.72}, {43.0, 39.0}, {44.5, 40.5}, {stops[7]->latitude, stops[7]->longitude}};
+    for (const auto point: points) {
+        std::vector<double> expected;
+        for (StopPtr p_stop: stops) {
+            expected.push_back(geo::ComputeSafeDistance(point, {p_stop->latitude, p_stop->longitude}));
+        }
+        std::sort(expected.begin(), expected.end());
+
+        const auto nearest = db.GetNearestStops(point, 5);
+        ASSERT_EQ(nearest.size(), 5u);
+        for (size_t i = 0; i < nearest.size(); ++i) {
+            ASSERT_DOUBLE_EQ(nearest[i].second, expected[i]);
+        }
+    }
+
+    const geo::Box area{42, 38, 44, 40};
+    std::vector<StopPtr> expected;
+    for (StopPtr p_stop: stops) {
+        if (area.Contains({p_stop->latitude, p_stop->longitude})) {
+            expected.push_back(p_stop);
+        }
+    }
+    ASSERT_FALSE(expected.empty());
+    ASSERT_EQ(db.GetStopsInArea(area), expected);
+}
+
+TEST(CATALOGUE_SUITE, Names_Are_Interned_Once) {
+    const std::string file = "string_pool_test.db";
+    {
+        TransportCatalogue db;
+        std::string name = "Depot"s;
+        db.AddStop({name, 43.59, 39.72});
+        name = "Market"s;   // справочник не зависит от исходной строки
+        db.AddStop({name, 43.58, 39.73});
+        db.AddBus({"Depot"sv, {db.GetStop("Depot"sv), db.GetStop("Market"sv)}, 2, true,
+                   db.GetStop("Depot"sv), db.GetStop("Depot"sv), std::nullopt, {}});
+        ASSERT_EQ(db.GetStop("Market"sv)->name, "Market"sv);
+        ASSERT_EQ(db.GetBus("Depot"sv)->name.data(), db.GetStop("Depot"sv)->name.data());
+        ASSERT_EQ(db.GetNames().GetCount(), 2u);
+        ASSERT_EQ(db.GetNames().GetSize(), "DepotMarket"s.size());
+
+        const renderer::RenderSettings render_settings;
+        const RoutingSettings routing_settings;
+        graph::DirectedWeightedGraph<double> graph(db.EvaluateVertexCount());
+        graph::Router<double>::RoutesInternalData routes_internal_data;
+        CatalogueSerializer serializer{db, render_settings, routing_settings, graph, routes_internal_data};
+        serializer.SerializeTo(file);
+    }
+
+    TransportCatalogue db;
+    CatalogueDeserializer deserializer{db};
+    deserializer.DeserializeFrom(file);
+    ASSERT_NE(db.GetStop("Market"sv), nullptr);
+    ASSERT_EQ(db.GetBus("Depot"sv)->name.data(), db.GetStop("Depot"sv)->name.data());
+    ASSERT_EQ(db.GetNames().GetSize(), "DepotMarket"s.size());
+}
+
+TEST(CATALOGUE_SUITE, Buses_For_Stop_Survive_Serialization) {
+    const std::string file = "bus_index_test.db";
+    auto make_stop = [](const std::string &name, double latitude) {
+        return json::Dict{{"type", "Stop"s}, {"name", name}, {"latitude", latitude}, {"longitude", 37.0},
+                          {"road_distances", json::Dict{}}};
+    };
+    auto make_bus = [](const std::string &name, json::Array stops, bool is_roundtrip) {
+        return json::Dict{{"type", "Bus"s}, {"name", name}, {"is_roundtrip", is_roundtrip},
+                          {"stops", std::move(stops)}};
+    };
+    // автобусы добавлены не по порядку названий, Z проходит B дважды
+    json::Document base_doc{json::Dict{
+            {"routing_settings", json::Dict{{"bus_wait_time", 6}, {"bus_velocity", 40.}}},
+            {"base_requests", json::Array{
+                    make_bus("Z", json::Array{"A"s, "B"s, "C"s, "B"s, "A"s}, true),
+                    make_bus("M", json::Array{"B"s, "C"s}, false),
+                    make_bus("A1", json::Array{"A"s, "B"s}, false),
+                    make_stop("A", 55.00),
+                    make_stop("B", 55.01),
+                    make_stop("C", 55.02),
+                    make_stop("D", 55.03)
+            }}
+    }};
+    auto bus_names = [](const TransportCatalogue &db, std::string_view stop) {
+        std::vector<std::string_view> names;
+        for (const Bus *p_bus: db.GetBusesForStop(db.GetStop(stop))) {
+            names.push_back(p_bus->name);
+        }
+        return names;
+    };
+    using Names = std::vector<std::string_view>;
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(base_doc);
+        ASSERT_EQ(bus_names(db, "A"sv), (Names{"A1"sv, "Z"sv}));
+        ASSERT_EQ(bus_names(db, "B"sv), (Names{"A1"sv, "M"sv, "Z"sv}));
+        ASSERT_EQ(bus_names(db, "C"sv), (Names{"M"sv, "Z"sv}));
+        ASSERT_TRUE(bus_names(db, "D"sv).empty());
+        ASSERT_TRUE(db.GetBusesForStop(nullptr).empty());
+
+        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+        graph::Router<double> router(handler.GetRouteGraph());
+        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+                                       handler.GetRouteGraph(), router.GetRoutesInternalData()};
+        serializer.SerializeTo(file);
+    }
+
+    TransportCatalogue db;
+    CatalogueDeserializer deserializer{db};
+    deserializer.DeserializeFrom(file);
+    ASSERT_EQ(bus_names(db, "A"sv), (Names{"A1"sv, "Z"sv}));
+    ASSERT_EQ(bus_names(db, "B"sv), (Names{"A1"sv, "M"sv, "Z"sv}));
+    ASSERT_EQ(bus_names(db, "C"sv), (Names{"M"sv, "Z"sv}));
+    ASSERT_TRUE(bus_names(db, "D"sv).empty());
+    ASSERT_FALSE(db.IsStopInRoutes(db.GetStop("D"sv)));
+}
+
+TEST(CATALOGUE_SUITE, Distance_Table_Reverse_And_Reset) {
+    TransportCatalogue db;
+    db.AddStop({"A"sv, 55.00, 37.0});
+    db.AddStop({"B"sv, 55.01, 37.0});
+    db.AddStop({"C"sv, 55.02, 37.0});
+    const StopPtr a = db.GetStop("A"sv);
+    const StopPtr b = db.GetStop("B"sv);
+    const StopPtr c = db.GetStop("C"sv);
+    db.AddBus({"1"sv, {a, b, c, b, a}, 3, false, a, a, std::nullopt, {}});
+    db.SetDistance({a, b}, 1000);
+    db.SetDistance({b, a}, 1200);
+    db.SetDistance({b, c}, 500);
+    db.SetDistance({a, b}, 1);      // уже заданное расстояние не перезаписывается
+    db.Freeze();
+
+    // по таблице: заданное направление, иначе обратное, иначе 0
+    ASSERT_EQ(db.GetDistance({a, b}), 1000);
+    ASSERT_EQ(db.GetDistance({b, a}), 1200);
+    ASSERT_EQ(db.GetDistance({b, c}), 500);
+    ASSERT_EQ(db.GetDistance({c, b}), 500);
+    ASSERT_EQ(db.GetDistance({a, c}), 0);
+    ASSERT_EQ(db.GetDistance({c, a}), 0);
+    const Bus *p_bus = db.GetBus("1"sv);
+    ASSERT_EQ(p_bus->route_distances.size(), p_bus->route.size());
+    ASSERT_EQ(db.GetRouteDistance(p_bus, 0, 4), 1000 + 500 + 500 + 1200);
+
+    // новое расстояние после Freeze сбрасывает таблицу и префиксные суммы, поиск - по хеш-таблице
+    db.SetDistance({c, b}, 700);
+    db.SetDistance({c, a}, 2000);
+    ASSERT_TRUE(p_bus->route_distances.empty());
+    ASSERT_EQ(db.GetDistance({c, b}), 700);
+    ASSERT_EQ(db.GetDistance({b, c}), 500);
+    ASSERT_EQ(db.GetDistance({a, c}), 2000);
+    ASSERT_EQ(db.GetDistance({b, a}), 1200);
+    ASSERT_EQ(db.GetRouteDistance(p_bus, 0, 4), 1000 + 500 + 700 + 1200);
+
+    // после перестроения таблица дает те же расстояния
+    db.Freeze();
+    ASSERT_EQ(db.GetDistance({c, b}), 700);
+    ASSERT_EQ(db.GetDistance({a, c}), 2000);
+    ASSERT_EQ(db.GetRouteDistance(p_bus, 0, 4), 1000 + 500 + 700 + 1200);
+}
+
+TEST(CATALOGUE_SUITE, Segment_Time_From_Route_Prefix_Sums) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input3.json");
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+
+    // кольцевой маршрут целиком: от первой остановки до ее следующего вхождения
+    StopPtr first = db.GetStop("Улица Лизы Чайкиной"sv);
+    const auto circle = handler.GetSegmentStat(db.GetBus("14"sv), {first, first});
+    ASSERT_TRUE(circle);
+    ASSERT_EQ(circle->route_length, handler.GetBusStat("14"sv)->route_length);
+    ASSERT_EQ(circle->span_count, 7);
+    ASSERT_DOUBLE_EQ(circle->time, circle->route_length / handler.GetNormalBusVelocity());
+
+    // некольцевой маршрут: туда и обратно
+    StopPtr terminal = db.GetStop("Улица Докучаева"sv);
+    StopPtr other_terminal = db.GetStop("Санаторий Родина"sv);
+    const auto there = handler.GetSegmentStat(db.GetBus("24"sv), {terminal, other_terminal});
+    const auto back = handler.GetSegmentStat(db.GetBus("24"sv), {other_terminal, terminal});
+    ASSERT_TRUE(there && back);
+    ASSERT_EQ(there->span_count, 3);
+    ASSERT_EQ(there->route_length + back->route_length, handler.GetBusStat("24"sv)->route_length);
+
+    ASSERT_FALSE(handler.GetSegmentStat(db.GetBus("114"sv), {db.GetStop("Электросети"sv), terminal}));
+}
+
+TEST(ROUTER_SUITE, Terminal_Search_Matches_All_Pairs) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input3.json");
+    json::Document doc = json::Load(base_in);
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(doc);
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    graph::Router<double> router(handler.GetRouteGraph());
+
+    const size_t vertex_count = handler.GetRouteGraph().GetVertexCount();
+    for (graph::VertexId from = 0; from < vertex_count; ++from) {
+        for (graph::VertexId to = 0; to < vertex_count; ++to) {
+            const auto expected = router.BuildRoute(from, to);
+            // подход к остановке-соседу стоит 1000 минут и никогда не выгоден
+            const auto actual = router.BuildRoute({{from, 0}, {(from + 1) % vertex_count, 1000}},
+                                                  {{to, 0}, {(to + 1) % vertex_count, 1000}});
+            ASSERT_EQ(expected.has_value(), actual.has_value());
+            if (expected) {
+                ASSERT_DOUBLE_EQ(expected->weight, actual->weight);
+                ASSERT_EQ(actual->from, from);
+                ASSERT_EQ(actual->to, to);
+                ASSERT_EQ(expected->edges.size(), actual->edges.size());
+            }
+        }
+    }
+}
+
+TEST(ROUTER_SUITE, Bidirectional_Matches_All_Pairs) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input10.json");
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    const auto &graph = handler.GetRouteGraph();
+    graph::Router<double> all_pairs(graph);
+    const graph::Router<double> on_demand(graph, {});
+
+    profile::SetEnabled(true);
+    const auto before = profile::GetStats().counters;
+    const size_t vertex_count = graph.GetVertexCount();
+    for (graph::VertexId from = 0; from < vertex_count; from += 2) {
+        for (graph::VertexId to = 0; to < vertex_count; to += 3) {
+            const auto expected = all_pairs.BuildRoute(from, to);
+            const auto actual = on_demand.BuildRoute(from, to);
+            // тот же поиск в одну сторону - для сравнения числа просмотренных вершин
+            const auto one_way = on_demand.BuildRoute({{from, 0}}, {{to, 0}});
+            ASSERT_EQ(expected.has_value(), actual.has_value());
+            ASSERT_EQ(expected.has_value(), one_way.has_value());
+            if (!expected) {
+                continue;
+            }
+            ASSERT_NEAR(actual->weight, expected->weight, 1e-6);
+            // ребра исходного графа, цепочкой от from до to
+            double weight = 0;
+            graph::VertexId vertex = from;
+            for (graph::EdgeId edge_id: actual->edges) {
+                ASSERT_EQ(graph.GetEdge(edge_id).from, vertex);
+                vertex = graph.GetEdge(edge_id).to;
+                weight += graph.GetEdge(edge_id).weight;
+            }
+            ASSERT_EQ(vertex, to);
+            ASSERT_NEAR(weight, actual->weight, 1e-6);
+        }
+    }
+    profile::SetEnabled(false);
+    auto after = profile::GetStats().counters;
+    auto delta = [&](const std::string &name) {
+        return after[name] - (before.count(name) ? before.at(name) : 0);
+    };
+    ASSERT_LT(delta("router.bidirectional_settled"), delta("router.dijkstra_settled"));
+}
+
+TEST(ROUTER_SUITE, K_Shortest_Loopless_Routes) {
+    // C=0, D=1, E=2, F=3, G=4, H=5
+    graph::DirectedWeightedGraph<double> graph(6);
+    for (const auto &[from, to, weight]: std::vector<std::tuple<graph::VertexId, graph::VertexId, double>>{
+            {0, 1, 3}, {0, 2, 2}, {1, 3, 4}, {2, 1, 1}, {2, 3, 2}, {2, 4, 3}, {3, 4, 2}, {3, 5, 1}, {4, 5, 2}}) {
+        graph.AddEdge({from, to, weight, 1});
+    }
+    const graph::Router<double> all_pairs(graph);
+    const graph::Router<double> on_demand(graph, {});
+    for (const auto *router: {&all_pairs, &on_demand}) {
+        const auto routes = router->BuildRoutes(0, 5, 10);
+        ASSERT_EQ(routes.size(), 7u);
+        const std::vector<double> weights{5, 7, 8, 8, 8, 11, 11};
+        for (size_t i = 0; i < routes.size(); ++i) {
+            ASSERT_DOUBLE_EQ(routes[i].weight, weights[i]);
+            // без повторных вершин
+            std::set<graph::VertexId> vertices{0};
+            for (graph::EdgeId edge_id: routes[i].edges) {
+                ASSERT_TRUE(vertices.insert(graph.GetEdge(edge_id).to).second);
+            }
+        }
+        ASSERT_EQ(routes[0].edges, (std::vector<graph::EdgeId>{1, 4, 7}));
+    }
+}
+
+TEST(ROUTER_SUITE, Route_Stop_Graph_Matches_Stop_Pairs) {
+    std::ifstream base_in("make_base_input10.json");
+    json::Dict base = json::Load(base_in).GetRoot().AsDict();
+    json::Dict linear_base = base;
+    json::Dict routing_settings = linear_base.at("routing_settings"s).AsDict();
+    routing_settings["route_graph"s] = "route_stops"s;
+    linear_base["routing_settings"s] = std::move(routing_settings);
+
+    // каждой модели - свой справочник: обработчик запоминает автобусы ребер графа в справочнике
+    TransportCatalogue pairs_db;
+    TransportCatalogue linear_db;
+    renderer::MapRenderer renderer;
+    query::JsonReader pairs_reader(pairs_db, renderer);
+    pairs_reader.ReadData(json::Document{base});
+    query::JsonReader linear_reader(linear_db, renderer);
+    linear_reader.ReadData(json::Document{linear_base});
+
+    // линейный граф с таблицей всех пар - ошибка настроек
+    json::Dict conflicting_base = linear_base;
+    json::Dict conflicting_settings = conflicting_base.at("routing_settings"s).AsDict();
+    conflicting_settings["routing_engine"s] = "all_pairs"s;
+    conflicting_base["routing_settings"s] = std::move(conflicting_settings);
+    TransportCatalogue conflicting_db;
+    query::JsonReader conflicting_reader(conflicting_db, renderer);
+    ASSERT_THROW(conflicting_reader.ReadData(json::Document{conflicting_base}), std::invalid_argument);
+    ASSERT_EQ(linear_reader.GetRoutingSettings().engine, RoutingEngine::OnDemand);
+    RequestHandler pairs_handler{pairs_db, renderer, pairs_reader.GetRoutingSettings(),
+                                 pairs_db.EvaluateVertexCount()};
+    RequestHandler linear_handler{linear_db, renderer, linear_reader.GetRoutingSettings(),
+                                  linear_db.EvaluateVertexCount()};
+    ASSERT_LT(linear_handler.GetRouteGraph().GetEdgeCount(), pairs_handler.GetRouteGraph().GetEdgeCount());
+
+    const auto stops = pairs_db.GetAllStops();
+    json::Array stat_requests;
+    for (size_t i = 0; i < stops.size(); i += 7) {
+        stat_requests.push_back(json::Dict{{"id", static_cast<int>(i)}, {"type", "Route"s},
+                                           {"from", stops[i]->name}, {"to", stops[stops.size() - 1 - i]->name}});
+    }
+    auto process = [&](const query::JsonReader &reader, const RequestHandler &handler) {
+        std::stringstream out;
+        reader.WriteInfo(out, reader.ParseStatRequests(json::Document{json::Dict{{"stat_requests", stat_requests}}}),
+                         handler.GetRouteGraph(), {});
+        return json::Load(out).GetRoot().AsArray();
+    };
+    const json::Array expected = process(pairs_reader, pairs_handler);
+    const json::Array actual = process(linear_reader, linear_handler);
+
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const json::Dict &expected_resp = expected[i].AsDict();
+        const json::Dict &actual_resp = actual[i].AsDict();
+        ASSERT_EQ(actual_resp.count("total_time"s), expected_resp.count("total_time"s));
+        if (!expected_resp.count("total_time"s)) {
+            continue;
+        }
+        const double total_time = actual_resp.at("total_time"s).AsDouble();
+        ASSERT_NEAR(total_time, expected_resp.at("total_time"s).AsDouble(), 1e-6);
+        // поездка сворачивается в один элемент Bus, время элементов складывается в общее (с точностью вывода)
+        double time = 0;
+        for (const auto &item: actual_resp.at("items"s).AsArray()) {
+            const json::Dict &dict = item.AsDict();
+            time += dict.at("time"s).AsDouble();
+            if (dict.at("type"s).AsString() == "Bus"s) {
+                ASSERT_GE(dict.at("span_count"s).AsInt(), 1);
+            }
+        }
+        ASSERT_NEAR(time, total_time, 1e-2);
+    }
+}
+
+TEST(ESTIMATE_SUITE, Graph_Size_Matches_Built_Graph) {
+    std::ifstream base_in("make_base_input10.json");
+    const json::Dict base = json::Load(base_in).GetRoot().AsDict();
+    for (const auto &model: {"stop_pairs"s, "route_stops"s}) {
+        json::Dict model_base = base;
+        json::Dict routing_settings = model_base.at("routing_settings"s).AsDict();
+        routing_settings["route_graph"s] = model;
+        model_base["routing_settings"s] = std::move(routing_settings);
+
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(json::Document{model_base});
+        const BaseEstimate estimate = EstimateBase(db, json_reader.GetRoutingSettings());
+        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+        ASSERT_EQ(estimate.graph.vertex_count, handler.GetRouteGraph().GetVertexCount());
+        ASSERT_EQ(estimate.graph.edge_count, handler.GetRouteGraph().GetEdgeCount());
+        ASSERT_GT(estimate.all_pairs.file_size, estimate.on_demand.file_size);
+
+        // бюджет ниже оценки таблицы всех пар - поиск по запросу, ниже обеих оценок - отказ
+        ASSERT_EQ(ChooseEngine(estimate, RoutingEngine::AllPairs, estimate.all_pairs.peak_memory),
+                  RoutingEngine::AllPairs);
+        ASSERT_EQ(ChooseEngine(estimate, RoutingEngine::OnDemand, estimate.on_demand.peak_memory),
+                  RoutingEngine::OnDemand);
+        ASSERT_EQ(ChooseEngine(estimate, RoutingEngine::AllPairs, 0), std::nullopt);
+    }
+
+    // таблица всех пар растет как V^2 и на большом городе перевешивает граф
+    BaseEstimate estimate;
+    estimate.all_pairs.peak_memory = 1000;
+    estimate.out_of_core.peak_memory = 500;
+    estimate.on_demand.peak_memory = 10;
+    ASSERT_EQ(ChooseEngine(estimate, RoutingEngine::AllPairs, 600), RoutingEngine::OutOfCore);
+    ASSERT_EQ(ChooseEngine(estimate, RoutingEngine::AllPairs, 100), RoutingEngine::OnDemand);
+}
+
+TEST(PATCH_SUITE, Repaired_Routes_Match_Full_Recompute) {
+    const std::string file = "patch_base_test.db";
+    std::ifstream base_in("make_base_input10.json");
+    json::Document base_doc = json::Load(base_in);
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(base_doc);
+        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+        graph::Router<double> router(handler.GetRouteGraph());
+        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+                                       handler.GetRouteGraph(), router.GetRoutesInternalData()};
+        serializer.SerializeTo(file);
+    }
+
+    // удаляем один автобус, добавляем остановку и автобус через нее, меняем одно расстояние
+    std::vector<std::string> stop_names;
+    std::string removed_bus;
+    for (const auto &node: base_doc.GetRoot().AsDict().at("base_requests").AsArray()) {
+        const auto &request = node.AsDict();
+        if (request.at("type").AsString() == "Stop") {
+            stop_names.push_back(request.at("name").AsString());
+        } else if (removed_bus.empty()) {
+            removed_bus = request.at("name").AsString();
+        }
+    }
+    json::Dict new_stop{{"type", "Stop"s}, {"name", "Patch Stop"s}, {"latitude", 43.6}, {"longitude", 39.7},
+                        {"road_distances", json::Dict{{stop_names[0], 700}, {stop_names[1], 900}}}};
+    json::Dict new_bus{{"type", "Bus"s}, {"name", "Patch Bus"s}, {"is_roundtrip", false},
+                       {"stops", json::Array{stop_names[0], "Patch Stop"s, stop_names[1]}}};
+    json::Dict remove_bus{{"type", "RemoveBus"s}, {"name", removed_bus}};
+    json::Dict distance{{"type", "Distance"s}, {"from", stop_names[2]}, {"to", stop_names[3]}, {"distance", 10}};
+    json::Document patch_doc{json::Dict{{"patch_requests", json::Array{new_stop, new_bus, remove_bus, distance}}}};
+
+    // пустой патч ничего не пересчитывает, обособленная линия - только строки своих остановок
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        BasePatcher patcher{db, renderer};
+        patcher.LoadBase(file);
+        patcher.Apply(json::Document{json::Dict{}});
+        ASSERT_EQ(patcher.GetRecomputedRowCount(), 0u);
+    }
+    {
+        json::Dict stop_a{{"type", "Stop"s}, {"name", "Island A"s}, {"latitude", 43.6}, {"longitude", 39.7},
+                          {"road_distances", json::Dict{{"Island B", 500}}}};
+        json::Dict stop_b{{"type", "Stop"s}, {"name", "Island B"s}, {"latitude", 43.61}, {"longitude", 39.7},
+                          {"road_distances", json::Dict{}}};
+        json::Dict bus{{"type", "Bus"s}, {"name", "Island Bus"s}, {"is_roundtrip", false},
+                       {"stops", json::Array{"Island A"s, "Island B"s}}};
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        BasePatcher patcher{db, renderer};
+        patcher.LoadBase(file);
+        patcher.Apply(json::Document{json::Dict{{"patch_requests", json::Array{stop_a, stop_b, bus}}}});
+        ASSERT_EQ(patcher.GetRecomputedRowCount(), 2u);
+    }
+
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    BasePatcher patcher{db, renderer};
+    patcher.LoadBase(file);
+    patcher.Apply(patch_doc);
+
+    ASSERT_NE(db.GetStop("Patch Stop"), nullptr);
+    ASSERT_EQ(db.GetBus(removed_bus), nullptr);
+
+    const auto &graph = patcher.GetRouteGraph();
+    graph::Router<double> expected_router(graph);
+    graph::Router<double> patched_router(graph, patcher.GetRoutesInternalData());
+    for (graph::VertexId from = 0; from < graph.GetVertexCount(); ++from) {
+        for (graph::VertexId to = 0; to < graph.GetVertexCount(); ++to) {
+            const auto expected = expected_router.BuildRoute(from, to);
+            const auto actual = patched_router.BuildRoute(from, to);
+            ASSERT_EQ(expected.has_value(), actual.has_value());
+            if (actual) {
+                ASSERT_NEAR(expected->weight, actual->weight, 1e-9);
+                double weight = 0;
+                graph::VertexId vertex = from;
+                for (graph::EdgeId edge_id: actual->edges) {
+                    ASSERT_EQ(graph.GetEdge(edge_id).from, vertex);
+                    weight += graph.GetEdge(edge_id).weight;
+                    vertex = graph.GetEdge(edge_id).to;
+                }
+                ASSERT_EQ(vertex, to);
+                ASSERT_NEAR(weight, actual->weight, 1e-9);
+            }
+        }
+    }
+}
+
+TEST(PROFILE_SUITE, Nested_Timers_And_Histogram) {
+    profile::SetEnabled(true);
+    {
+        PROFILE_SCOPE("outer_test_timer");
+        for (int i = 0; i < 3; ++i) {
+            PROFILE_SCOPE("inner_test_timer");
+            PROFILE_COUNT("test_counter", 2);
+        }
+    }
+    for (uint64_t value = 1; value <= 1000; ++value) {
+        profile::RecordLatency("test_histogram", value * 1000);
+    }
+    profile::SetEnabled(false);
+    PROFILE_COUNT("test_counter", 100);    // выключенный сбор ничего не меняет
+
+    const profile::Stats stats = profile::GetStats();
+    size_t outer = 0;
+    for (size_t child: stats.timers[0].children) {
+        if (stats.timers[child].name == "outer_test_timer") {
+            outer = child;
+        }
+    }
+    ASSERT_NE(outer, 0u);
+    ASSERT_EQ(stats.timers[outer].calls, 1u);
+    ASSERT_EQ(stats.timers[outer].children.size(), 1u);
+    const auto &inner = stats.timers[stats.timers[outer].children[0]];
+    ASSERT_EQ(inner.calls, 3u);
+    ASSERT_LE(inner.total_ns, stats.timers[outer].total_ns);
+    ASSERT_EQ(stats.counters.at("test_counter"), 6);
+
+    const profile::Histogram &histogram = stats.histograms.at("test_histogram");
+    ASSERT_EQ(histogram.GetCount(), 1000u);
+    ASSERT_EQ(histogram.GetMax(), 1000000u);
+    ASSERT_NEAR(static_cast<double>(histogram.GetPercentile(50)), 500000., 500000. / 16);
+    ASSERT_NEAR(static_cast<double>(histogram.GetPercentile(99)), 990000., 990000. / 16);
+}
+
+TEST(PROFILE_SUITE, Slow_Request_Log_And_Latencies) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input3.json");
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    graph::Router<double> router(handler.GetRouteGraph());
+    handler.SetupRouter(router);
+    std::ifstream requests_in("process_requests_input3.json");
+    const auto requests = json_reader.ParseStatRequests(json::Load(requests_in));
+    ASSERT_FALSE(requests.empty());
+
+    std::stringstream expected;
+    json_reader.WriteInfo(expected, requests, handler, router);
+
+    // порог 0 - в журнал попадает каждый запрос, а ответ не меняется
+    std::stringstream log;
+    json_reader.SetSlowRequestLog({&log, std::chrono::nanoseconds{0}});
+    profile::SetEnabled(true);
+    const auto before = profile::GetStats().histograms;
+    std::stringstream actual;
+    json_reader.WriteInfo(actual, requests, handler, router);
+    const auto after = profile::GetStats().histograms;
+    profile::SetEnabled(false);
+    json_reader.SetSlowRequestLog({});
+    ASSERT_EQ(actual.str(), expected.str());
+
+    std::map<std::string, uint64_t> type_counts;
+    size_t record_count = 0;
+    while (log >> std::ws && log.peek() != EOF) {
+        const json::Document record = json::Load(log);
+        const json::Dict &fields = record.GetRoot().AsDict();
+        const auto &request = requests[record_count++];
+        ASSERT_EQ(fields.at("id"s).AsInt(), request.id);
+        ASSERT_EQ(fields.at("type"s).AsString(), std::string(query::StatRequestTypeToString(request.type)));
+        ASSERT_TRUE(fields.at("params"s).IsDict());
+        ASSERT_GE(fields.at("duration_ms"s).AsDouble(), 0.);
+        ++type_counts["request."s + fields.at("type"s).AsString()];
+    }
+    ASSERT_EQ(record_count, requests.size());
+
+    // гистограмма на каждый тип запроса
+    for (const auto &[name, count]: type_counts) {
+        const uint64_t previous = before.count(name) ? before.at(name).GetCount() : 0;
+        ASSERT_EQ(after.at(name).GetCount() - previous, count);
+    }
+}
+
+TEST(TIMETABLE_SUITE, Earliest_Arrival_With_Transfer) {
+    const std::string file = "timetable_test.db";
+    auto make_stop = [](const std::string &name, double latitude, json::Dict road_distances) {
+        return json::Dict{{"type", "Stop"s}, {"name", name}, {"latitude", latitude}, {"longitude", 37.0},
+                          {"road_distances", std::move(road_distances)}};
+    };
+    auto make_bus = [](const std::string &name, json::Array stops, double first, double last, double interval) {
+        return json::Dict{{"type", "Bus"s}, {"name", name}, {"is_roundtrip", false}, {"stops", std::move(stops)},
+                          {"schedule", json::Dict{{"first_departure", first}, {"last_departure", last},
+                                                  {"interval", interval}}}};
+    };
+    // 6 км/ч = 100 м/мин: A-B и B-C по 10 мин, C-D 5 мин
+    json::Document base_doc{json::Dict{
+            {"routing_settings", json::Dict{{"bus_wait_time", 6}, {"bus_velocity", 6.}}},
+            {"base_requests", json::Array{
+                    make_stop("A", 55.00, json::Dict{{"B", 1000}}),
+                    make_stop("B", 55.01, json::Dict{{"C", 1000}}),
+                    make_stop("C", 55.02, json::Dict{{"D", 500}}),
+                    make_stop("D", 55.03, json::Dict{}),
+                    make_bus("1", json::Array{"A"s, "B"s, "C"s}, 360, 420, 30),
+                    make_bus("2", json::Array{"C"s, "D"s}, 385, 500, 10)
+            }}
+    }};
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(base_doc);
+        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+        graph::Router<double> router(handler.GetRouteGraph());
+        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+                                       handler.GetRouteGraph(), router.GetRoutesInternalData()};
+        serializer.SerializeTo(file);
+    }
+
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    CatalogueDeserializer deserializer{db};
+    deserializer.DeserializeFrom(file);
+    query::JsonReader json_reader(db, renderer);
+    json_reader.SetRoutingSettings(deserializer.GetRoutingSettings());
+    json::Document requests_doc{json::Dict{{"stat_requests", json::Array{
+            json::Dict{{"id", 1}, {"type", "Route"s}, {"from", "A"s}, {"to", "D"s}, {"departure_time", 365}},
+            json::Dict{{"id", 2}, {"type", "Route"s}, {"from", "A"s}, {"to", "C"s}, {"departure_time", 421}}
+    }}}};
+    std::stringstream out;
+    json_reader.WriteInfo(out, json_reader.ParseStatRequests(requests_doc), deserializer.GetRouteGraph(),
+                          deserializer.GetRoutesInternalData());
+    const json::Array responses = json::Load(out).GetRoot().AsArray();
+
+    // посадка в 390, в C в 410, автобус 2 уходит в 415, прибытие в 420
+    const json::Dict &route = responses.at(0).AsDict();
+    ASSERT_DOUBLE_EQ(route.at("total_time").AsDouble(), 55.);
+    ASSERT_DOUBLE_EQ(route.at("arrival_time").AsDouble(), 420.);
+    const json::Array &items = route.at("items").AsArray();
+    ASSERT_EQ(items.size(), 4u);
+    ASSERT_EQ(items[0].AsDict().at("stop_name").AsString(), "A");
+    ASSERT_DOUBLE_EQ(items[0].AsDict().at("time").AsDouble(), 25.);
+    ASSERT_EQ(items[1].AsDict().at("bus").AsString(), "1");
+    ASSERT_EQ(items[1].AsDict().at("span_count").AsInt(), 2);
+    ASSERT_DOUBLE_EQ(items[1].AsDict().at("time").AsDouble(), 20.);
+    ASSERT_EQ(items[2].AsDict().at("stop_name").AsString(), "C");
+    ASSERT_DOUBLE_EQ(items[2].AsDict().at("time").AsDouble(), 5.);
+    ASSERT_EQ(items[3].AsDict().at("bus").AsString(), "2");
+
+    // после последнего рейса уехать нельзя
+    ASSERT_EQ(responses.at(1).AsDict().at("error_message").AsString(), "not found");
+}
+
+TEST(TIMETABLE_SUITE, Invalid_Schedule) {
+    auto make_base = [](double first, double last, double interval) {
+        return json::Document{json::Dict{
+                {"routing_settings", json::Dict{{"bus_wait_time", 6}, {"bus_velocity", 6.}}},
+                {"base_requests", json::Array{
+                        json::Dict{{"type", "Stop"s}, {"name", "A"s}, {"latitude", 55.0}, {"longitude", 37.0},
+                                   {"road_distances", json::Dict{{"B", 1000}}}},
+                        json::Dict{{"type", "Stop"s}, {"name", "B"s}, {"latitude", 55.01}, {"longitude", 37.0},
+                                   {"road_distances", json::Dict{}}},
+                        json::Dict{{"type", "Bus"s}, {"name", "1"s}, {"is_roundtrip", false},
+                                   {"stops", json::Array{"A"s, "B"s}},
+                                   {"schedule", json::Dict{{"first_departure", first}, {"last_departure", last},
+                                                           {"interval", interval}}}}
+                }}
+        }};
+    };
+    auto read = [](const json::Document &doc) {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(doc);
+    };
+    ASSERT_THROW(read(make_base(360, 420, 0)), std::invalid_argument);
+    ASSERT_THROW(read(make_base(360, 420, -10)), std::invalid_argument);
+    ASSERT_THROW(read(make_base(360, 420, 1e-9)), std::invalid_argument);
+    ASSERT_THROW(read(make_base(420, 360, 10)), std::invalid_argument);
+    ASSERT_NO_THROW(read(make_base(360, 360, 10)));
+
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(make_base(360, 420, 10));
+    json::Document requests_doc{json::Dict{{"stat_requests", json::Array{
+            json::Dict{{"id", 1}, {"type", "Route"s}, {"from", "A"s}, {"to", "B"s}, {"departure_time", -1}}
+    }}}};
+    const std::vector<query::StatRequest> requests = json_reader.ParseStatRequests(requests_doc);
+    ASSERT_EQ(requests.at(0).error, "invalid departure_time");
+}
+
+TEST(PARETO_SUITE, Time_Versus_Transfers) {
+    auto make_stop = [](const std::string &name, double latitude, json::Dict road_distances) {
+        return json::Dict{{"type", "Stop"s}, {"name", name}, {"latitude", latitude}, {"longitude", 37.0},
+                          {"road_distances", std::move(road_distances)}};
+    };
+    auto make_bus = [](const std::string &name, json::Array stops) {
+        return json::Dict{{"type", "Bus"s}, {"name", name}, {"is_roundtrip", false}, {"stops", std::move(stops)}};
+    };
+    // 6 км/ч = 100 м/мин: напрямую A-C 60 мин, через B - 10 + 10 мин и лишнее ожидание
+    json::Document base_doc{json::Dict{
+            {"routing_settings", json::Dict{{"bus_wait_time", 6}, {"bus_velocity", 6.}}},
+            {"base_requests", json::Array{
+                    make_stop("A", 55.00, json::Dict{{"B", 1000}, {"C", 6000}}),
+                    make_stop("B", 55.01, json::Dict{{"C", 1000}}),
+                    make_stop("C", 55.02, json::Dict{}),
+                    make_bus("direct", json::Array{"A"s, "C"s}),
+                    make_bus("2", json::Array{"A"s, "B"s}),
+                    make_bus("3", json::Array{"B"s, "C"s})
+            }}
+    }};
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(base_doc);
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    graph::Router<double> router(handler.GetRouteGraph());
+
+    json::Document requests_doc{json::Dict{{"stat_requests", json::Array{
+            json::Dict{{"id", 1}, {"type", "Route"s}, {"from", "A"s}, {"to", "C"s}},
+            json::Dict{{"id", 2}, {"type", "Route"s}, {"from", "A"s}, {"to", "C"s}, {"pareto", true}},
+            json::Dict{{"id", 3}, {"type", "Route"s}, {"from", "A"s}, {"to", "C"s}, {"pareto", true},
+                       {"max_transfers", 0}}
+    }}}};
+    std::stringstream out;
+    json_reader.WriteInfo(out, json_reader.ParseStatRequests(requests_doc), handler.GetRouteGraph(),
+                          router.GetRoutesInternalData());
+    const json::Array responses = json::Load(out).GetRoot().AsArray();
+
+    // без пересадок - 66 мин, с одной - 32 мин, как у обычного запроса Route
+    const json::Array &routes = responses.at(1).AsDict().at("routes").AsArray();
+    ASSERT_EQ(routes.size(), 2u);
+    ASSERT_EQ(routes[0].AsDict().at("transfers").AsInt(), 0);
+    ASSERT_DOUBLE_EQ(routes[0].AsDict().at("total_time").AsDouble(), 66.);
+    ASSERT_EQ(routes[0].AsDict().at("items").AsArray().at(1).AsDict().at("bus").AsString(), "direct");
+    ASSERT_EQ(routes[1].AsDict().at("transfers").AsInt(), 1);
+    ASSERT_NEAR(routes[1].AsDict().at("total_time").AsDouble(),
+                responses.at(0).AsDict().at("total_time").AsDouble(), 1e-6);
+    const json::Array &items = routes[1].AsDict().at("items").AsArray();
+    ASSERT_EQ(items.size(), 4u);
+    ASSERT_EQ(items[2].AsDict().at("stop_name").AsString(), "B");
+    ASSERT_DOUBLE_EQ(items[3].AsDict().at("time").AsDouble(), 10.);
+
+    ASSERT_EQ(responses.at(2).AsDict().at("routes").AsArray().size(), 1u);
+}
+
+TEST(MATRIX_SUITE, On_Demand_Matches_All_Pairs) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input10.json");
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    graph::Router<double> router(handler.GetRouteGraph());
+
+    const auto stops = db.GetAllStops();
+    json::Array origins{"Unknown"s};
+    json::Array destinations;
+    for (size_t i = 0; i < 16; ++i) {
+        origins.push_back(stops[i]->name);
+        destinations.push_back(stops[stops.size() - 1 - i]->name);
+    }
+    destinations.push_back(stops[0]->name);
+    json::Document requests_doc{json::Dict{{"stat_requests", json::Array{
+            json::Dict{{"id", 1}, {"type", "Matrix"s}, {"origins", origins}, {"destinations", destinations}},
+            json::Dict{{"id", 2}, {"type", "Route"s}, {"from", origins[1]}, {"to", destinations[0]}}
+    }}}};
+    const auto requests = json_reader.ParseStatRequests(requests_doc);
+
+    auto process = [&](graph::Router<double>::RoutesInternalData routes) {
+        std::stringstream out;
+        json_reader.WriteInfo(out, requests, handler.GetRouteGraph(), std::move(routes));
+        return json::Load(out).GetRoot().AsArray();
+    };
+    const json::Array all_pairs = process(router.GetRoutesInternalData());
+    const json::Array on_demand = process({});
+
+    const json::Array &expected = all_pairs.at(0).AsDict().at("times").AsArray();
+    const json::Array &actual = on_demand.at(0).AsDict().at("times").AsArray();
+    ASSERT_EQ(actual.size(), origins.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const json::Array &expected_row = expected[i].AsArray();
+        const json::Array &actual_row = actual[i].AsArray();
+        ASSERT_EQ(actual_row.size(), destinations.size());
+        for (size_t j = 0; j < expected_row.size(); ++j) {
+            ASSERT_EQ(actual_row[j].IsNull(), expected_row[j].IsNull());
+            if (!expected_row[j].IsNull()) {
+                ASSERT_NEAR(actual_row[j].AsDouble(), expected_row[j].AsDouble(), 1e-6);
+            }
+        }
+    }
+    // неизвестная остановка - строка из null; из остановки в себя - 0
+    ASSERT_TRUE(actual[0].AsArray()[0].IsNull());
+    ASSERT_DOUBLE_EQ(actual[1].AsArray().back().AsDouble(), 0.);
+
+    // без таблицы Route ищет маршрут по запросу
+    ASSERT_NEAR(on_demand.at(1).AsDict().at("total_time").AsDouble(),
+                all_pairs.at(1).AsDict().at("total_time").AsDouble(), 1e-6);
+    ASSERT_NEAR(all_pairs.at(1).AsDict().at("total_time").AsDouble(), expected[1].AsArray()[0].AsDouble(), 1e-6);
+}
+
+TEST(ROUTER_SUITE, Batched_Routes_Match_All_Pairs) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input10.json");
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    json_reader.SetRoutePlannerThreads(2);
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    graph::Router<double> router(handler.GetRouteGraph());
+
+    // 3 начальные остановки по 10 запросов вперемешку и один одиночный запрос
+    const auto stops = db.GetAllStops();
+    json::Array stat_requests;
+    for (int i = 0; i < 30; ++i) {
+        stat_requests.push_back(json::Dict{{"id", i}, {"type", "Route"s}, {"from", stops[i % 3]->name},
+                                           {"to", stops[stops.size() - 1 - i]->name}});
+    }
+    stat_requests.push_back(json::Dict{{"id", 30}, {"type", "Route"s}, {"from", stops[5]->name},
+                                       {"to", stops[6]->name}});
+    const auto requests = json_reader.ParseStatRequests(json::Document{json::Dict{{"stat_requests", stat_requests}}});
+
+    auto process = [&](graph::Router<double>::RoutesInternalData routes) {
+        std::stringstream out;
+        json_reader.WriteInfo(out, requests, handler.GetRouteGraph(), std::move(routes));
+        return json::Load(out).GetRoot().AsArray();
+    };
+    const json::Array expected = process(router.GetRoutesInternalData());
+    profile::SetEnabled(true);
+    const auto before = profile::GetStats().counters;
+    const json::Array actual = process({});
+    profile::SetEnabled(false);
+    auto after = profile::GetStats().counters;
+    auto delta = [&](const std::string &name) {
+        return after[name] - (before.count(name) ? before.at(name) : 0);
+    };
+    // по поиску на группу, одиночный запрос - отдельным поиском
+    ASSERT_EQ(delta("router.planned_groups"), 3);
+    ASSERT_EQ(delta("router.dijkstra_runs"), 3);
+    ASSERT_GT(delta("router.dijkstra_settled"), 0);
+
+    // ответы - в порядке запросов
+    ASSERT_EQ(actual.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const json::Dict &expected_resp = expected[i].AsDict();
+        const json::Dict &actual_resp = actual[i].AsDict();
+        ASSERT_EQ(actual_resp.at("request_id"s).AsInt(), static_cast<int>(i));
+        ASSERT_EQ(actual_resp.count("total_time"s), expected_resp.count("total_time"s));
+        if (expected_resp.count("total_time"s)) {
+            ASSERT_NEAR(actual_resp.at("total_time"s).AsDouble(), expected_resp.at("total_time"s).AsDouble(), 1e-6);
+        }
+    }
+}
+
+TEST(ISOCHRONE_SUITE, Bounded_Search_Matches_All_Pairs) {
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    std::ifstream base_in("make_base_input10.json");
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Load(base_in));
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+    graph::Router<double> router(handler.GetRouteGraph());
+
+    // ожидание в этих данных - 491 мин, бюджет захватывает одну-две поездки
+    const auto stops = db.GetAllStops();
+    const std::string_view from = (*std::find_if(stops.begin(), stops.end(), [&db](StopPtr p_stop) {
+        return db.IsStopInRoutes(p_stop);
+    }))->name;
+    json::Document requests_doc{json::Dict{{"stat_requests", json::Array{
+            json::Dict{{"id", 1}, {"type", "Isochrone"s}, {"from", from}, {"time", 600.}},
+            json::Dict{{"id", 2}, {"type", "Isochrone"s}, {"from", "Unknown"s}, {"time", 600.}},
+            json::Dict{{"id", 3}, {"type", "Isochrone"s}, {"from", from}, {"time", -1.}}
+    }}}};
+    const auto requests = json_reader.ParseStatRequests(requests_doc);
+    auto process = [&](graph::Router<double>::RoutesInternalData routes) {
+        std::stringstream out;
+        json_reader.WriteInfo(out, requests, handler.GetRouteGraph(), std::move(routes));
+        return json::Load(out).GetRoot().AsArray();
+    };
+    const json::Array all_pairs = process(router.GetRoutesInternalData());
+    const json::Array on_demand = process({});
+
+    const json::Array &expected = all_pairs.at(0).AsDict().at("stops").AsArray();
+    const json::Array &actual = on_demand.at(0).AsDict().at("stops").AsArray();
+    ASSERT_GT(expected.size(), 1u);
+    ASSERT_EQ(actual.size(), expected.size());
+    ASSERT_EQ(actual[0].AsDict().at("stop_name").AsString(), from);
+    ASSERT_DOUBLE_EQ(actual[0].AsDict().at("time").AsDouble(), 0.);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        ASSERT_LE(actual[i].AsDict().at("time").AsDouble(), 600.);
+        ASSERT_NEAR(actual[i].AsDict().at("time").AsDouble(), expected[i].AsDict().at("time").AsDouble(), 1e-6);
+    }
+    ASSERT_EQ(on_demand.at(1).AsDict().at("error_message").AsString(), "not found");
+    ASSERT_EQ(on_demand.at(2).AsDict().at("error_message").AsString(), "invalid time");
+}
+
+TEST(ROUTER_SUITE, AStar_Matches_Dijkstra) {
+    // решетка 8 x 8 остановок, автобусы по строкам и столбцам; дороги на 20% длиннее прямых
+    constexpr int size = 8;
+    auto stop_name = [](int row, int col) {
+        return "S"s + std::to_string(row) + "_"s + std::to_string(col);
+    };
+    auto coordinates = [](int row, int col) {
+        return geo::Coordinates{55.0 + row * 0.01, 37.0 + col * 0.015};
+    };
+    json::Array base_requests;
+    for (int row = 0; row < size; ++row) {
+        for (int col = 0; col < size; ++col) {
+            json::Dict road_distances;
+            for (auto [next_row, next_col]: {std::pair{row + 1, col}, std::pair{row, col + 1}}) {
+                if (next_row < size && next_col < size) {
+                    const double distance = geo::ComputeDistance(coordinates(row, col),
+                                                                 coordinates(next_row, next_col));
+                    road_distances[stop_name(next_row, next_col)] = static_cast<int>(std::ceil(distance * 1.2));
+                }
+            }
+            base_requests.push_back(json::Dict{
+                    {"type", "Stop"s}, {"name", stop_name(row, col)},
+                    {"latitude", coordinates(row, col).lat}, {"longitude", coordinates(row, col).lng},
+                    {"road_distances", std::move(road_distances)}});
+        }
+    }
+    for (int line = 0; line < size; ++line) {
+        json::Array row_stops;
+        json::Array col_stops;
+        for (int i = 0; i < size; ++i) {
+            row_stops.push_back(stop_name(line, i));
+            col_stops.push_back(stop_name(i, line));
+        }
+        base_requests.push_back(json::Dict{{"type", "Bus"s}, {"name", "R"s + std::to_string(line)},
+                                           {"is_roundtrip", false}, {"stops", std::move(row_stops)}});
+        base_requests.push_back(json::Dict{{"type", "Bus"s}, {"name", "C"s + std::to_string(line)},
+                                           {"is_roundtrip", false}, {"stops", std::move(col_stops)}});
+    }
+
+    TransportCatalogue db;
+    renderer::MapRenderer renderer;
+    query::JsonReader json_reader(db, renderer);
+    json_reader.ReadData(json::Document{json::Dict{
+            {"routing_settings", json::Dict{{"bus_wait_time", 2}, {"bus_velocity", 30.}}},
+            {"base_requests", std::move(base_requests)}
+    }});
+    ASSERT_TRUE(json_reader.GetRoutingSettings().use_geo_heuristic);
+    RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+
+    graph::Router<double> dijkstra(handler.GetRouteGraph(), {});
+    graph::Router<double> astar(handler.GetRouteGraph(), {});
+    astar.SetHeuristic([&handler](graph::VertexId vertex, graph::VertexId to) {
+        return handler.GetLowerBoundTime(vertex, to);
+    });
+
+    profile::SetEnabled(true);
+    const auto before = profile::GetStats().counters;
+    const size_t vertex_count = handler.GetRouteGraph().GetVertexCount();
+    for (graph::VertexId from = 0; from < vertex_count; ++from) {
+        for (graph::VertexId to = 0; to < vertex_count; to += 3) {
+            const auto expected = dijkstra.BuildRoute({{from, 0}}, {{to, 0}});
+            const auto actual = astar.BuildRoute(from, to);
+            ASSERT_TRUE(expected && actual);
+            ASSERT_NEAR(actual->weight, expected->weight, 1e-9);
+        }
+    }
+    profile::SetEnabled(false);
+    auto after = profile::GetStats().counters;
+    auto delta = [&](const std::string &name) {
+        return after[name] - (before.count(name) ? before.at(name) : 0);
+    };
+    // оценка по прямой отсекает заметную часть вершин
+    ASSERT_GT(delta("router.astar_settled"), 0);
+    ASSERT_LT(delta("router.astar_settled"), delta("router.dijkstra_settled"));
+
+    // с короткой дорогой (обратное направление перегона еще не задано) оценка уже не допустима
+    db.SetDistance({db.GetStop(stop_name(0, 1)), db.GetStop(stop_name(0, 0))}, 1);
+    ASSERT_FALSE(db.AreRoadDistancesAboveGreatCircle());
+}
+
+TEST(SNAPSHOT_SUITE, Hot_Swap_Under_Concurrent_Requests) {
+    const std::string file = "snapshot_test.db";
+    {
+        TransportCatalogue db;
+        renderer::MapRenderer renderer;
+        std::ifstream base_in("make_base_input3.json");
+        query::JsonReader json_reader(db, renderer);
+        json_reader.ReadData(json::Load(base_in));
+        RequestHandler handler{db, renderer, json_reader.GetRoutingSettings(), db.EvaluateVertexCount()};
+        graph::Router<double> router(handler.GetRouteGraph());
+        CatalogueSerializer serializer{db, renderer.GetSettings(), json_reader.GetRoutingSettings(),
+                                       handler.GetRouteGraph(), router.GetRoutesInternalData()};
+        serializer.SerializeTo(file);
+    }
+    std::ifstream requests_in("process_requests_input3.json");
+    const json::Document requests = json::Load(requests_in);
+
+    SnapshotHolder holder(CatalogueSnapshot::Load(file));
+    std::stringstream expected;
+    holder.Get()->ProcessRequests(requests, expected);
+    std::weak_ptr<const CatalogueSnapshot> first = holder.Get();
+
+    // читатели отвечают на запросы, пока базу несколько раз подменяют; ответы не должны меняться
+    std::atomic<bool> is_done{false};
+    std::atomic<int> mismatches{0};
+    std::atomic<int> batches{0};
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&]() {
+            while (!is_done || batches < 8) {
+                const auto snapshot = holder.Get();
+                std::stringstream out;
+                snapshot->ProcessRequests(requests, out);
+                mismatches += out.str() != expected.str() ? 1 : 0;
+                ++batches;
+            }
+        });
+    }
+    for (int i = 0; i < 5; ++i) {
+        holder.Reset(CatalogueSnapshot::Load(file));
+    }
+    is_done = true;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    ASSERT_EQ(mismatches, 0);
+    // замененный снимок освобожден после последнего запроса
+    ASSERT_TRUE(first.expired());
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <limits>
+
+#include "timetable.h"
+
+namespace transcat {
+
+    Timetable::Timetable(std::vector<Connection> connections, std::vector<const Bus *> trip_buses)
+            : connections_(std::move(connections)), trip_buses_(std::move(trip_buses)) {
+        std::stable_sort(connections_.begin(), connections_.end(), [](const Connection &lhs, const Connection &rhs) {
+            return lhs.departure < rhs.departure;
+        });
+    }
+
+    bool Timetable::IsEmpty() const noexcept {
+        return connections_.empty();
+    }
+
+    std::optional<Timetable::Journey> Timetable::FindEarliestArrival(uint32_t from, uint32_t to, double departure_time,
+                                                                     size_t stop_count) const {
+        if (from == to) {
+            return Journey{departure_time, departure_time, {}};
+        }
+
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+        std::vector<double> arrival(stop_count, std::numeric_limits<double>::infinity());
+        std::vector<Leg> last_leg(stop_count, {NONE, NONE});    // поездка, которой достигнута остановка
+        std::vector<uint32_t> trip_board(trip_buses_.size(), NONE);
+        arrival[from] = departure_time;
+
+        auto it = std::lower_bound(connections_.begin(), connections_.end(), departure_time,
+                                   [](const Connection &connection, double time) {
+                                       return connection.departure < time;
+                                   });
+        for (; it != connections_.end(); ++it) {
+            const Connection &connection = *it;
+            // более поздние отправления цель уже не улучшат
+            if (arrival[to] <= connection.departure) {
+                break;
+            }
+            auto &board = trip_board[connection.trip];
+            if (board == NONE) {
+                if (arrival[connection.from] > connection.departure) {
+                    continue;
+                }
+                board = static_cast<uint32_t>(it - connections_.begin());
+            }
+            if (connection.arrival < arrival[connection.to]) {
+                arrival[connection.to] = connection.arrival;
+                last_leg[connection.to] = {board, static_cast<uint32_t>(it - connections_.begin())};
+            }
+        }
+        if (last_leg[to].board == NONE) {
+            return std::nullopt;
+        }
+
+        Journey journey{departure_time, arrival[to], {}};
+        for (uint32_t stop = to; stop != from && journey.legs.size() <= stop_count;) {
+            const Leg leg = last_leg[stop];
+            journey.legs.push_back(leg);
+            stop = connections_[leg.board].from;
+        }
+        std::reverse(journey.legs.begin(), journey.legs.end());
+        return journey;
+    }
+
+    const std::vector<Connection> &Timetable::GetConnections() const noexcept {
+        return connections_;
+    }
+
+    const std::vector<const Bus *> &Timetable::GetTripBuses() const noexcept {
+        return trip_buses_;
+    }
+
+} // namespace transcat
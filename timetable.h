@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "domain.h"
+
+namespace transcat {
+
+    // Перегон одного рейса между соседними остановками. Время - в минутах от начала суток,
+    // остановки - индексы в порядке TransportCatalogue::GetAllStops() (совпадают с вершинами графа)
+    struct Connection {
+        double departure = 0;
+        double arrival = 0;
+        uint32_t from = 0;
+        uint32_t to = 0;
+        uint32_t trip = 0;
+        uint32_t sequence = 0;      // номер перегона в рейсе
+    };
+
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+    //
+    //   Timetable
+    //
+    //   Расписание в виде перегонов, упорядоченных по времени отправления. Маршрут с наиболее
+    //   ранним прибытием ищется одним проходом по массиву (Connection Scan Algorithm),
+    //   начиная с первого отправления после заданного времени.
+    //
+    ///////////////////////////////////////////////////////////////////////////////////////////////
+
+    class Timetable {
+    public:
+        // Поездка одним рейсом: индексы перегонов посадки и высадки
+        struct Leg {
+            uint32_t board = 0;
+            uint32_t alight = 0;
+        };
+
+        struct Journey {
+            double departure = 0;
+            double arrival = 0;
+            std::vector<Leg> legs;
+        };
+
+        Timetable() = default;
+
+        // connections в любом порядке; trip_buses - автобус каждого рейса
+        Timetable(std::vector<Connection> connections, std::vector<const Bus *> trip_buses);
+
+        [[nodiscard]] bool IsEmpty() const noexcept;
+
+        // Маршрут из from в to с отправлением не раньше departure_time и наиболее ранним прибытием
+        [[nodiscard]] std::optional<Journey> FindEarliestArrival(uint32_t from, uint32_t to, double departure_time,
+                                                                 size_t stop_count) const;
+
+        [[nodiscard]] const std::vector<Connection> &GetConnections() const noexcept;
+
+        [[nodiscard]] const std::vector<const Bus *> &GetTripBuses() const noexcept;
+
+    private:
+        std::vector<Connection> connections_;
+        std::vector<const Bus *> trip_buses_;
+    };
+
+} // namespace transcat
@@ -1,6 +1,9 @@
 #include <cassert>
 #include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <numeric>
+#include <stdexcept>
 
 #include "transport_catalogue.h"
 #include "geo.h"
@@ -11,24 +14,24 @@ namespace transcat {
         if (stops_by_name_.count(stop.name) == 0) {
             stops_.emplace_back(stop);
             Stop *p_stop = &stops_.back();
+            p_stop->name = names_.Intern(stop.name);
+            p_stop->id = static_cast<uint32_t>(stops_.size() - 1);
             stops_by_name_[p_stop->name] = p_stop;
-
-            buses_for_stop_[p_stop] = {};
         }
     }
 
     void TransportCatalogue::AddBus(const Bus &bus) {
         if (buses_by_name_.count(bus.name) == 0) {
-            buses_.emplace_back(bus);
-            const Bus *p_bus = &buses_.back();
+            Bus *p_bus = &buses_.emplace_back(bus);
+            p_bus->name = names_.Intern(bus.name);
             buses_by_name_[p_bus->name] = p_bus;
-
-            for (StopPtr p_stop: bus.route) {
-                buses_for_stop_[p_stop].insert(p_bus);
-            }
         }
     }
 
+    const StringPool &TransportCatalogue::GetNames() const noexcept {
+        return names_;
+    }
+
     StopPtr TransportCatalogue::GetStop(const std::string_view &name) const noexcept {
         return stops_by_name_.count(name) ? stops_by_name_.at(name) : nullptr;
     }
@@ -37,26 +40,51 @@ namespace transcat {
         return buses_by_name_.count(name) ? buses_by_name_.at(name) : nullptr;
     }
 
-    const std::set<const Bus *, TransportCatalogue::BusPtrComparator> *
-    TransportCatalogue::GetBusesForStop(StopPtr p_stop) const noexcept {
-        if (p_stop && buses_for_stop_.count(p_stop)) {
-            return &buses_for_stop_.at(p_stop);
+    TransportCatalogue::BusesRange TransportCatalogue::GetBusesForStop(StopPtr p_stop) const noexcept {
+        if (!p_stop || p_stop->id + 1 >= stop_bus_offsets_.size()) {
+            return {stop_buses_.end(), stop_buses_.end()};
         }
-        return nullptr;
+        return {stop_buses_.begin() + stop_bus_offsets_[p_stop->id],
+                stop_buses_.begin() + stop_bus_offsets_[p_stop->id + 1]};
     }
 
     void TransportCatalogue::SetDistance(StopPair from_to, distance_t distance) {
-        distances_.emplace(from_to, distance);
+        if (distances_.emplace(from_to, distance).second && !distance_offsets_.empty()) {
+            distance_offsets_.clear();
+            distance_table_.clear();
+            for (Bus &bus: buses_) {
+                bus.route_distances.clear();
+            }
+        }
     }
 
     distance_t TransportCatalogue::GetDistance(StopPair from_to) const noexcept {
-        if (distances_.count(from_to)) {
-            return distances_.at(from_to);
-        } else if (distances_.count(from_to.Reverse())) {
-            return distances_.at(from_to.Reverse());
+        if (!distance_offsets_.empty()) {
+            const auto first = distance_table_.begin() + distance_offsets_[from_to.from->id];
+            const auto last = distance_table_.begin() + distance_offsets_[from_to.from->id + 1];
+            const auto it = std::lower_bound(first, last, from_to.to->id, [](const auto &entry, uint32_t id) {
+                return entry.first < id;
+            });
+            return it != last && it->first == from_to.to->id ? it->second : 0;
+        }
+        if (auto it = distances_.find(from_to); it != distances_.end()) {
+            return it->second;
+        }
+        if (auto it = distances_.find(from_to.Reverse()); it != distances_.end()) {
+            return it->second;
         }
         return 0;
-        //return -1;
+    }
+
+    distance_t TransportCatalogue::GetRouteDistance(const Bus *p_bus, size_t from, size_t to) const noexcept {
+        if (p_bus->route_distances.size() == p_bus->route.size()) {
+            return p_bus->route_distances[to] - p_bus->route_distances[from];
+        }
+        distance_t distance = 0;
+        for (size_t i = from; i < to; ++i) {
+            distance += GetDistance({p_bus->route[i], p_bus->route[i + 1]});
+        }
+        return distance;
     }
 
     std::vector<StopPtr> TransportCatalogue::GetAllStops() const noexcept {
@@ -78,7 +106,7 @@ namespace transcat {
     }
 
     bool TransportCatalogue::IsStopInRoutes(StopPtr p_stop) const noexcept {
-        return buses_for_stop_.count(p_stop) && !buses_for_stop_.at(p_stop).empty();
+        return !GetBusesForStop(p_stop).empty();
     }
 
     size_t TransportCatalogue::EvaluateVertexCount() const noexcept {
@@ -89,11 +117,216 @@ namespace transcat {
         return edges_to_buses_[edge_id];
     }
 
-    void TransportCatalogue::SetBusForEdge(graph::EdgeId edge_id, const Bus* p_bus) const {
+    void TransportCatalogue::SetBusForEdge([[maybe_unused]] graph::EdgeId edge_id, const Bus* p_bus) const {
         assert(edge_id == edges_to_buses_.size());
         edges_to_buses_.push_back(p_bus);
     }
 
+    void TransportCatalogue::Freeze() {
+        BuildBusIndex();
+        BuildDistanceIndex();
+        BuildRouteDistances();
+        BuildStopIndex();
+    }
+
+    void TransportCatalogue::BuildBusIndex() {
+        // автобусы перебираются по названию, поэтому подсчет с раскладкой по остановкам
+        // сразу дает списки, упорядоченные по названию. last_bus - повторная остановка того же автобуса
+        const std::vector<const Bus *> buses = GetAllBuses();
+        constexpr auto NO_BUS = static_cast<size_t>(-1);
+        std::vector<size_t> last_bus(stops_.size(), NO_BUS);
+        stop_bus_offsets_.assign(stops_.size() + 1, 0);
+        for (size_t i = 0; i < buses.size(); ++i) {
+            for (StopPtr p_stop: buses[i]->route) {
+                if (last_bus[p_stop->id] != i) {
+                    last_bus[p_stop->id] = i;
+                    ++stop_bus_offsets_[p_stop->id + 1];
+                }
+            }
+        }
+        std::partial_sum(stop_bus_offsets_.begin(), stop_bus_offsets_.end(), stop_bus_offsets_.begin());
+
+        stop_buses_.resize(stop_bus_offsets_.back());
+        std::vector<uint32_t> positions(stop_bus_offsets_.begin(), stop_bus_offsets_.end() - 1);
+        last_bus.assign(stops_.size(), NO_BUS);
+        for (size_t i = 0; i < buses.size(); ++i) {
+            for (StopPtr p_stop: buses[i]->route) {
+                if (last_bus[p_stop->id] != i) {
+                    last_bus[p_stop->id] = i;
+                    stop_buses_[positions[p_stop->id]++] = buses[i];
+                }
+            }
+        }
+    }
+
+    void TransportCatalogue::BuildDistanceIndex() {
+        // строка from: заданные from -> to и незаданные в прямом направлении to -> from
+        std::vector<uint32_t> offsets(stops_.size() + 1, 0);
+        for (const auto &[from_to, distance]: distances_) {
+            ++offsets[from_to.from->id + 1];
+            if (!distances_.count(from_to.Reverse())) {
+                ++offsets[from_to.to->id + 1];
+            }
+        }
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+        std::vector<std::pair<uint32_t, distance_t>> table(offsets.back());
+        std::vector<uint32_t> positions(offsets.begin(), offsets.end() - 1);
+        for (const auto &[from_to, distance]: distances_) {
+            table[positions[from_to.from->id]++] = {from_to.to->id, distance};
+            if (!distances_.count(from_to.Reverse())) {
+                table[positions[from_to.to->id]++] = {from_to.from->id, distance};
+            }
+        }
+        for (size_t id = 0; id < stops_.size(); ++id) {
+            std::sort(table.begin() + offsets[id], table.begin() + offsets[id + 1]);
+        }
+        distance_offsets_ = std::move(offsets);
+        distance_table_ = std::move(table);
+    }
+
+    void TransportCatalogue::BuildRouteDistances() {
+        for (Bus &bus: buses_) {
+            bus.route_distances.assign(bus.route.size(), 0);
+            for (size_t i = 1; i < bus.route.size(); ++i) {
+                bus.route_distances[i] = bus.route_distances[i - 1] + GetDistance({bus.route[i - 1], bus.route[i]});
+            }
+        }
+    }
+
+    void TransportCatalogue::BuildStopIndex() {
+        geo::Box bounds;
+        bool is_routed_found = false;
+        if (!stops_.empty()) {
+            bounds = {stops_.front().latitude, stops_.front().longitude,
+                      stops_.front().latitude, stops_.front().longitude};
+        }
+        for (const Stop &stop: stops_) {
+            bounds.Extend({stop.latitude, stop.longitude});
+            if (IsStopInRoutes(&stop)) {
+                if (!is_routed_found) {
+                    routed_stops_bounds_ = {stop.latitude, stop.longitude, stop.latitude, stop.longitude};
+                    is_routed_found = true;
+                }
+                routed_stops_bounds_.Extend({stop.latitude, stop.longitude});
+            }
+        }
+
+        stop_index_ = geo::GridIndex(bounds, stops_.size());
+        for (uint32_t id = 0; id < stops_.size(); ++id) {
+            const geo::Coordinates point{stops_[id].latitude, stops_[id].longitude};
+            stop_index_.Add(id, geo::Box::Of(point, point));
+        }
+        stop_index_.Build();
+    }
+
+    std::vector<StopPtr> TransportCatalogue::GetStopsInArea(const geo::Box &area) const {
+        std::vector<StopPtr> result;
+        for (uint32_t id: stop_index_.Query(area)) {
+            result.push_back(&stops_[id]);
+        }
+        std::sort(result.begin(), result.end(), [](StopPtr lhs, StopPtr rhs) {
+            return lhs->name < rhs->name;
+        });
+        return result;
+    }
+
+    std::vector<std::pair<StopPtr, double>>
+    TransportCatalogue::GetNearestStops(geo::Coordinates point, size_t count) const {
+        std::vector<std::pair<StopPtr, double>> result;
+        for (const auto &[id, distance]: stop_index_.Nearest(point, count)) {
+            result.emplace_back(&stops_[id], distance);
+        }
+        return result;
+    }
+
+    std::vector<std::pair<StopPtr, double>>
+    TransportCatalogue::GetStopsInRadius(geo::Coordinates point, double meters) const {
+        std::vector<std::pair<StopPtr, double>> result;
+        for (uint32_t id: stop_index_.Query(geo::Box::Around(point, meters))) {
+            const double distance = geo::ComputeSafeDistance(point, {stops_[id].latitude, stops_[id].longitude});
+            if (distance <= meters) {
+                result.emplace_back(&stops_[id], distance);
+            }
+        }
+        std::sort(result.begin(), result.end(), [](const auto &lhs, const auto &rhs) {
+            return lhs.second < rhs.second || (lhs.second == rhs.second && lhs.first->name < rhs.first->name);
+        });
+        return result;
+    }
+
+    const geo::Box &TransportCatalogue::GetRoutedStopsBounds() const noexcept {
+        return routed_stops_bounds_;
+    }
+
+    void TransportCatalogue::BuildTimetable(double velocity) {
+        timetable_ = {};
+        if (velocity <= 0) {
+            return;
+        }
+        std::unordered_map<StopPtr, uint32_t> stop_ids;
+        for (StopPtr p_stop: GetAllStops()) {
+            stop_ids.emplace(p_stop, static_cast<uint32_t>(stop_ids.size()));
+        }
+
+        std::vector<Connection> connections;
+        std::vector<const Bus *> trip_buses;
+        for (const Bus &bus: buses_) {
+            if (!bus.schedule || bus.route.size() < 2) {
+                continue;
+            }
+            if (!bus.schedule->IsValid()) {
+                throw std::invalid_argument("Invalid schedule of bus " + std::string(bus.name));
+            }
+            const std::vector<StopPtr> route(bus.route.begin(), bus.route.end());
+
+            // некольцевой маршрут - два направления, рейсы отправляются с обеих конечных одновременно
+            std::vector<std::pair<size_t, size_t>> directions;
+            if (bus.is_roundtrip) {
+                directions.emplace_back(0, route.size() - 1);
+            } else {
+                directions.emplace_back(0, route.size() / 2);
+                directions.emplace_back(route.size() / 2, route.size() - 1);
+            }
+
+            const Schedule &schedule = *bus.schedule;
+            for (size_t k = 0; schedule.first_departure + static_cast<double>(k) * schedule.interval
+                               <= schedule.last_departure; ++k) {
+                const double start_time = schedule.first_departure + static_cast<double>(k) * schedule.interval;
+                for (const auto &[first, last]: directions) {
+                    const auto trip = static_cast<uint32_t>(trip_buses.size());
+                    trip_buses.push_back(&bus);
+                    double time = start_time;
+                    for (size_t i = first; i < last; ++i) {
+                        const double arrival = time + GetDistance({route[i], route[i + 1]}) / velocity;
+                        connections.push_back({time, arrival, stop_ids.at(route[i]), stop_ids.at(route[i + 1]),
+                                               trip, static_cast<uint32_t>(i - first)});
+                        time = arrival;
+                    }
+                }
+            }
+        }
+        timetable_ = Timetable(std::move(connections), std::move(trip_buses));
+    }
+
+    const Timetable &TransportCatalogue::GetTimetable() const noexcept {
+        return timetable_;
+    }
+
+    bool TransportCatalogue::AreRoadDistancesAboveGreatCircle() const noexcept {
+        for (const Bus &bus: buses_) {
+            for (auto it = bus.route.begin(); it != bus.route.end() && std::next(it) != bus.route.end(); ++it) {
+                StopPtr from = *it;
+                StopPtr to = *std::next(it);
+                if (GetDistance({from, to}) < geo::ComputeSafeDistance({from->latitude, from->longitude},
+                                                                       {to->latitude, to->longitude})) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
     namespace geo {
 
         double ComputeRouteGeoLength(const Bus *p_bus) {
@@ -110,15 +343,7 @@ namespace transcat {
         }
 
         distance_t ComputeRouteLength(const Bus *p_bus, const TransportCatalogue &catalogue) {
-            const Route &route = p_bus->route;
-            distance_t length = 0;
-            for (auto it = route.cbegin(); it != route.cend(); ++it) {
-                auto next_it = std::next(it, 1);
-                if (next_it != route.cend()) {
-                    length += catalogue.GetDistance({*it, *next_it});
-                }
-            }
-            return length;
+            return p_bus->route.empty() ? 0 : catalogue.GetRouteDistance(p_bus, 0, p_bus->route.size() - 1);
         }
 
     } //namespace transcat::geo
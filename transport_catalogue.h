@@ -4,7 +4,6 @@
 #include <map>
 #include <unordered_map>
 #include <unordered_set>
-#include <list>
 #include <deque>
 #include <vector>
 #include <set>
@@ -13,41 +12,52 @@
 
 #include "domain.h"
 #include "graph.h"
+#include "ranges.h"
 #include "router.h"
+#include "spatial_index.h"
+#include "timetable.h"
+#include "string_pool.h"
 
 namespace transcat {
 
-    using distance_t = int;
-
     class CatalogueSerializer;
     class CatalogueDeserializer;
+    class BasePatcher;
 
     class TransportCatalogue {
 
         friend class CatalogueSerializer;
         friend class CatalogueDeserializer;
+        friend class BasePatcher;
 
     public:
-        struct BusPtrComparator {
-            bool operator()(const Bus * lhs, const Bus * rhs) const {
-                return std::lexicographical_compare(lhs->name.begin(), lhs->name.end(), rhs->name.begin(), rhs->name.end());
-            }
-        };
+        // Автобусы остановки, упорядоченные по названию
+        using BusesRange = ranges::Range<std::vector<const Bus *>::const_iterator>;
 
+        // Название копируется в пул строк справочника
         void AddStop(const Stop &stop);
 
+        // Название копируется в пул строк справочника
         void AddBus(const Bus &bus);
 
         [[nodiscard]] StopPtr GetStop(const std::string_view &name) const noexcept;
 
         [[nodiscard]] const Bus *GetBus(const std::string_view &name) const noexcept;
 
-        [[nodiscard]] const std::set<const Bus *, BusPtrComparator> * GetBusesForStop(StopPtr p_stop) const noexcept;
+        // Пустой диапазон, если остановки нет или индекс еще не построен (Freeze)
+        [[nodiscard]] BusesRange GetBusesForStop(StopPtr p_stop) const noexcept;
 
+        // Уже заданное расстояние не перезаписывается. Новое расстояние после Freeze сбрасывает таблицу
+        // расстояний и расстояния по маршрутам: до их перестроения поиск идет по хеш-таблице
         void SetDistance(StopPair from_to, distance_t distance);
 
+        // Расстояние from -> to, если не задано - to -> from, если не задано и оно - 0
         distance_t GetDistance(StopPair from_to) const noexcept;
 
+        // Дорожное расстояние по маршруту автобуса от from-й до to-й остановки маршрута (from <= to).
+        // После BuildRouteDistances - разность префиксных сумм
+        distance_t GetRouteDistance(const Bus *p_bus, size_t from, size_t to) const noexcept;
+
         std::vector<StopPtr> GetAllStops() const noexcept;
 
         std::vector<const Bus *> GetAllBuses() const noexcept;
@@ -60,14 +70,65 @@ namespace transcat {
 
         void SetBusForEdge(graph::EdgeId edge_id, const Bus* p_bus) const;
 
+        // Строит индексы справочника: автобусы по остановкам, таблицу расстояний, расстояния по маршрутам
+        // и пространственный индекс.
+        // Вызывается один раз после заполнения справочника, дальше справочник не изменяется
+        void Freeze();
+
+        // Строит индекс автобусов по остановкам (CSR: смещения по id остановки и общий массив автобусов)
+        void BuildBusIndex();
+
+        // Строит таблицу расстояний: для каждой остановки - соседи по возрастанию id с расстояниями,
+        // обратное направление уже подставлено. Поиск - двоичный внутри строки остановки
+        void BuildDistanceIndex();
+
+        // Заполняет префиксные суммы расстояний маршрутов (Bus::route_distances). Использует таблицу расстояний
+        void BuildRouteDistances();
+
+        // Строит пространственный индекс остановок. Использует индекс автобусов (границы остановок маршрутов)
+        void BuildStopIndex();
+
+        // Остановки внутри области, упорядоченные по названию
+        std::vector<StopPtr> GetStopsInArea(const geo::Box &area) const;
+
+        // count ближайших к точке остановок с расстояниями (м), по возрастанию расстояния
+        std::vector<std::pair<StopPtr, double>> GetNearestStops(geo::Coordinates point, size_t count) const;
+
+        // Остановки не далее meters от точки с расстояниями (м), по возрастанию расстояния
+        std::vector<std::pair<StopPtr, double>> GetStopsInRadius(geo::Coordinates point, double meters) const;
+
+        // Границы остановок, через которые проходят маршруты (размеры карты)
+        const geo::Box &GetRoutedStopsBounds() const noexcept;
+
+        // Строит расписание перегонов автобусов, у которых задано расписание.
+        // velocity - скорость автобуса в м/мин. Вызывается после заполнения справочника.
+        // Некорректное расписание (Schedule::IsValid) - std::invalid_argument
+        void BuildTimetable(double velocity);
+
+        const Timetable &GetTimetable() const noexcept;
+
+        // Дорожное расстояние каждого перегона маршрутов не короче расстояния по прямой. Тогда расстояние
+        // по прямой, деленное на скорость, - оценка снизу оставшегося времени в пути (эвристика A*)
+        bool AreRoadDistancesAboveGreatCircle() const noexcept;
+
+        // Пул названий остановок и автобусов
+        const StringPool &GetNames() const noexcept;
+
     private:
+        StringPool names_;
         std::deque<Stop> stops_;
         std::deque<Bus> buses_;
         std::map<std::string_view, StopPtr> stops_by_name_;
         std::map<std::string_view, const Bus *> buses_by_name_;
-        std::unordered_map<StopPtr, std::set<const Bus *, BusPtrComparator>> buses_for_stop_;
-        std::unordered_map<StopPair, distance_t, StopPairHasher> distances_;
+        std::vector<uint32_t> stop_bus_offsets_;        // автобусы остановки id - [offsets[id], offsets[id + 1])
+        std::vector<const Bus *> stop_buses_;           // в пределах остановки - по названию
+        std::unordered_map<StopPair, distance_t, StopPairHasher> distances_;   // заданные расстояния
+        std::vector<uint32_t> distance_offsets_;        // строка остановки id - [offsets[id], offsets[id + 1])
+        std::vector<std::pair<uint32_t, distance_t>> distance_table_;           // (id соседа, расстояние)
         mutable std::vector<const Bus *> edges_to_buses_;
+        geo::GridIndex stop_index_;                     // идентификатор объекта - индекс в stops_
+        geo::Box routed_stops_bounds_;
+        Timetable timetable_;
     };
 
     namespace geo {
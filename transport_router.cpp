@@ -84,13 +84,13 @@ namespace transcat::query {
     }
 
     // Вывод всех автобусов, проходящих через остановку
-    void out::PrintBusesForStop(std::ostream &out, StopPtr p_stop, const std::set<const Bus *, TransportCatalogue::BusPtrComparator> * buses) {
+    void out::PrintBusesForStop(std::ostream &out, StopPtr p_stop, TransportCatalogue::BusesRange buses) {
         out << "Stop " << p_stop->name << ": ";
-        if (buses->empty()) {
+        if (buses.empty()) {
             out << "no buses";
         } else {
             out << "buses";
-            for (const auto p_bus: *buses) {
+            for (const auto p_bus: buses) {
                 out << ' ' << p_bus->name;
             }
         }
@@ -13,7 +13,7 @@ namespace transcat::query {
         void PrintBusInfo(std::ostream &out, const Bus *p, const TransportCatalogue &catalogue);
 
         // Вывод всех автобусов, проходящих через остановку
-        void PrintBusesForStop(std::ostream &out, StopPtr p_stop, const std::set<const Bus *, TransportCatalogue::BusPtrComparator> * buses);
+        void PrintBusesForStop(std::ostream &out, StopPtr p_stop, TransportCatalogue::BusesRange buses);
 
     } //namespace transcat::query::out
 